@@ -17,13 +17,29 @@
 #include <stdlib.h>
 #include <getopt.h>
 #include <fcntl.h>
-#include <sys/ioctl.h>
+#include <errno.h>
 #include <linux/types.h>
 #include <linux/spi/spidev.h>
 #include <string.h>
 #include <sys/types.h>
+#include <signal.h>
 
 #include "SimpleGPIO.h"
+#include "journal.h"
+#include "history.h"
+#include "startup.h"
+#include "led.h"
+#include "presence.h"
+#include "aggregate.h"
+#include "analytics.h"
+#include "eventbus.h"
+#include "evsock.h"
+#include "reader.h"
+#include "engine.h"
+#include "tdma.h"
+#include "rt.h"
+#include "stats.h"
+#include "trace.h"
 
 #define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
 
@@ -34,60 +50,56 @@ static void pabort(const char *s)
 }
 
 static const char *device = "/dev/spidev1.0";
+static unsigned int en_gpio = 26;   // GPIO0_26 = (0x32) + 26 = 26
+static unsigned int irq_gpio = 45;  // GPIO1_13 = (32x1) + 13 = 45
 static uint8_t mode;
 static uint8_t bits = 8;
-static uint32_t speed = 3000000;
+static uint32_t speed = READER_DEFAULT_SPEED_HZ;
+static uint32_t spi_max_hz;   /* negotiate the clock up to this, 0 = fixed */
 static uint16_t delay;
+static const char *journal_path = JOURNAL_DEFAULT_PATH;
+static unsigned int journal_sync_ms = JOURNAL_DEFAULT_SYNC_MS;
+static const char *history_dir = HISTORY_DEFAULT_DIR;
+static unsigned int retention_days = HISTORY_DEFAULT_RETENTION_DAYS;
+static const char *bus_name = BUS_DEFAULT_NAME;
+static unsigned int depart_ms = PRESENCE_DEFAULT_DEPART_MS;
+static uint8_t near_rssi;
+static unsigned int window_ms = AGGREGATE_DEFAULT_WINDOW_MS;
+static const char *sock_path = EVSOCK_DEFAULT_PATH;
+static TDMA_POLICY tdma_policy = TDMA_SHARED;
+static unsigned int slot_ms = TDMA_DEFAULT_SLOT_MS;
+static int rt_prio;
+static int rt_cpu = -1;
+static const char *stats_path = STATS_DEFAULT_PATH;
+static const char *trace_path;
+static struct bus bus;
+static struct evsock evsock;
+static struct journal journal;
+static struct history history;
+static struct leds leds;
+static int present;          /* tags present, for the activity LED */
+static struct presence presence;
+static struct aggregator aggregator;
+static struct analytics analytics;
+static struct reader readers[READER_MAX];
+static int nreaders;
+static struct engine engine;
+static struct tdma tdma;
+static volatile sig_atomic_t running = 1;
 
-static void transfer(int fd, uint8_t *tx, uint8_t *rx, uint8_t size, uint8_t printflag)
+static void stop_handler(int sig)
 {
-	int ret;
-	struct spi_ioc_transfer tr = {
-		.tx_buf = (unsigned long)tx,
-		.rx_buf = (unsigned long)rx,
-		.len = size,
-		.delay_usecs = delay,
-		.speed_hz = speed,
-		.bits_per_word = bits,
-	};
-
-	ret = ioctl(fd, SPI_IOC_MESSAGE(1), &tr);
-	if (ret < 1)
-		pabort("can't send spi message");
-
-	if (printflag) {
-		for (ret = 0; ret < size; ret++) {
-			if (!(ret % 6))
-				puts("");
-			printf("%.2X ", rx[ret]);
-		}
-		puts("");
-	}
-}
-
-int spiDeviceTreeInit(char *adr[])
-{
-        pid_t pid;
- 
-        pid=fork();
-        if (pid==0)
-        {
-                if (execv("/home/root/BBB_SPI/spiDeviceTreeInit.sh",adr)<0)
-                        return -1;
-                else
-                        return 1;
-        }
-        else if(pid>0)
-                return 2;
-        else
-                return 0;
+	running = 0;
 }
 
 static void print_usage(const char *prog)
 {
-	printf("Usage: %s [-DsbdlHOLC3]\n", prog);
-	puts("  -D --device   device to use (default /dev/spidev1.1)\n"
+	printf("Usage: %s [-DsbdlHOLC3] [-A device:en_gpio:irq_gpio ...]\n", prog);
+	puts("  -D --device   device to use (default /dev/spidev1.0)\n"
+	     "  -A --reader   add a reader as device:en_gpio:irq_gpio, repeat for more\n"
+	     "                (default <device>:26:45)\n"
 	     "  -s --speed    max speed (Hz)\n"
+	     "  -a --spi-auto negotiate the SPI clock from --speed up to this (Hz, the overlay allows 16000000)\n"
 	     "  -d --delay    delay (usec)\n"
 	     "  -b --bpw      bits per word \n"
 	     "  -l --loop     loopback\n"
@@ -95,7 +107,22 @@ static void print_usage(const char *prog)
 	     "  -O --cpol     clock polarity\n"
 	     "  -L --lsb      least significant bit first\n"
 	     "  -C --cs-high  chip select active high\n"
-	     "  -3 --3wire    SI/SO signals shared\n");
+	     "  -3 --3wire    SI/SO signals shared\n"
+	     "  -J --journal  read journal file (default " JOURNAL_DEFAULT_PATH ")\n"
+	     "  -j --sync-ms  journal group commit interval (ms)\n"
+	     "  -Y --history  indexed event history directory (default " HISTORY_DEFAULT_DIR ")\n"
+	     "  -y --retention-days  delete history older than this (default 90)\n"
+	     "  -E --bus      shared memory event bus name (default " BUS_DEFAULT_NAME ")\n"
+	     "  -P --depart-ms  tag departure timeout (ms)\n"
+	     "  -r --near-rssi  RSSI a tag must reach before it arrives (0 = any read)\n"
+	     "  -W --window-ms  merge the reads of a tag by all readers within this window (0 = publish every read)\n"
+	     "  -S --socket   event socket path (default " EVSOCK_DEFAULT_PATH ")\n"
+	     "  -M --sched    reader time slots: shared (default), rr or adaptive\n"
+	     "  -T --slot-ms  time slot length (ms, at least the longest cycle)\n"
+	     "  -F --rt-prio  real-time mode: SCHED_FIFO priority (1-99), memory locked\n"
+	     "  -c --cpu      pin the reader loop to this CPU\n"
+	     "  -K --stats    stats file, rewritten every 5 s and on SIGUSR1 (default " STATS_DEFAULT_PATH ")\n"
+	     "  -X --trace    write a Chrome trace-event timeline of the reader cycles to this file\n");
 	exit(1);
 }
 
@@ -104,7 +131,9 @@ static void parse_opts(int argc, char *argv[])
 	while (1) {
 		static const struct option lopts[] = {
 			{ "device",  1, 0, 'D' },
+			{ "reader",  1, 0, 'A' },
 			{ "speed",   1, 0, 's' },
+			{ "spi-auto", 1, 0, 'a' },
 			{ "delay",   1, 0, 'd' },
 			{ "bpw",     1, 0, 'b' },
 			{ "loop",    0, 0, 'l' },
@@ -115,11 +144,26 @@ static void parse_opts(int argc, char *argv[])
 			{ "3wire",   0, 0, '3' },
 			{ "no-cs",   0, 0, 'N' },
 			{ "ready",   0, 0, 'R' },
+			{ "journal", 1, 0, 'J' },
+			{ "sync-ms", 1, 0, 'j' },
+			{ "history", 1, 0, 'Y' },
+			{ "retention-days", 1, 0, 'y' },
+			{ "bus",     1, 0, 'E' },
+			{ "depart-ms", 1, 0, 'P' },
+			{ "near-rssi", 1, 0, 'r' },
+			{ "window-ms", 1, 0, 'W' },
+			{ "socket",  1, 0, 'S' },
+			{ "sched",   1, 0, 'M' },
+			{ "slot-ms", 1, 0, 'T' },
+			{ "rt-prio", 1, 0, 'F' },
+			{ "cpu",     1, 0, 'c' },
+			{ "stats",   1, 0, 'K' },
+			{ "trace",   1, 0, 'X' },
 			{ NULL, 0, 0, 0 },
 		};
-		int c;
+		int c, policy;
 
-		c = getopt_long(argc, argv, "D:s:d:b:lHOLC3NR", lopts, NULL);
+		c = getopt_long(argc, argv, "D:A:s:a:d:b:lHOLC3NRJ:j:Y:y:E:P:r:W:S:M:T:F:c:K:X:", lopts, NULL);
 
 		if (c == -1)
 			break;
@@ -128,9 +172,21 @@ static void parse_opts(int argc, char *argv[])
 		case 'D':
 			device = optarg;
 			break;
+		case 'A':
+			if (nreaders == READER_MAX) {
+				fprintf(stderr, "at most %d readers (-A)\n", READER_MAX);
+				print_usage(argv[0]);
+			}
+			if (reader_parse(&readers[nreaders], nreaders, optarg) < 0)
+				print_usage(argv[0]);
+			nreaders++;
+			break;
 		case 's':
 			speed = atoi(optarg);
 			break;
+		case 'a':
+			spi_max_hz = strtoul(optarg, NULL, 0);
+			break;
 		case 'd':
 			delay = atoi(optarg);
 			break;
@@ -161,6 +217,57 @@ static void parse_opts(int argc, char *argv[])
 		case 'R':
 			mode |= SPI_READY;
 			break;
+		case 'J':
+			journal_path = optarg;
+			break;
+		case 'j':
+			journal_sync_ms = atoi(optarg);
+			break;
+		case 'Y':
+			history_dir = optarg;
+			break;
+		case 'y':
+			retention_days = atoi(optarg);
+			break;
+		case 'E':
+			bus_name = optarg;
+			break;
+		case 'P':
+			depart_ms = atoi(optarg);
+			break;
+		case 'r':
+			near_rssi = atoi(optarg);
+			break;
+		case 'W':
+			window_ms = atoi(optarg);
+			break;
+		case 'S':
+			sock_path = optarg;
+			break;
+		case 'M':
+			policy = tdma_parse_policy(optarg);
+			if (policy < 0)
+				print_usage(argv[0]);
+			tdma_policy = policy;
+			break;
+		case 'T':
+			slot_ms = atoi(optarg);
+			if (slot_ms < TDMA_MIN_SLOT_MS)
+				fprintf(stderr, "slot of %u ms raised to %u ms, the longest cycle\n",
+					slot_ms, TDMA_MIN_SLOT_MS);
+			break;
+		case 'F':
+			rt_prio = atoi(optarg);
+			break;
+		case 'c':
+			rt_cpu = atoi(optarg);
+			break;
+		case 'K':
+			stats_path = optarg;
+			break;
+		case 'X':
+			trace_path = optarg;
+			break;
 		default:
 			print_usage(argv[0]);
 			break;
@@ -168,261 +275,220 @@ static void parse_opts(int argc, char *argv[])
 	}
 }
 
+/*
+ * Parse options, enable the SPI overlay and open every reader.
+ * Returns the number of readers that could be opened.
+ */
 int init(int argc, char *argv[])
 {
-	int ret = 0;
-	int fd;
+	const char *devices[READER_MAX];
+	unsigned int gpio[2 * READER_MAX];
+	char spec[64];
+	int i, opened = 0;
 
 	parse_opts(argc, argv);
 	
-	// enable SPI device tree overlay
-	spiDeviceTreeInit(argv);
-
-	usleep(250*1000);
+	if (!nreaders) {
+		snprintf(spec, sizeof(spec), "%s:%u:%u", device, en_gpio, irq_gpio);
+		reader_parse(&readers[0], 0, spec);
+		nreaders = 1;
+	}
+	startup_phase("options");
 	
-	fd = open(device, O_RDWR);
-	if (fd < 0)
-		pabort("can't open device");
-
-	/*
-	 * spi mode
-	 */
-	mode |= SPI_CPHA;
-	ret = ioctl(fd, SPI_IOC_WR_MODE, &mode);
-	if (ret == -1)
-		pabort("can't set spi mode");
+	// enable the SPI device tree overlay unless it is loaded, and wait for the spidev nodes
+	for (i = 0; i < nreaders; i++)
+		devices[i] = readers[i].device;
+	startup_spi_overlay(argv, devices, nreaders, STARTUP_DEFAULT_TIMEOUT_MS);
+	startup_phase("overlay");
+	
+	for (i = 0; i < nreaders; i++) {
+		gpio[2 * i] = readers[i].en_gpio;
+		gpio[2 * i + 1] = readers[i].irq_gpio;
+	}
+	// the lines are only configured once their value files are there
+	gpio_export_all(gpio, 2 * nreaders, STARTUP_DEFAULT_TIMEOUT_MS);
+	startup_phase("gpio");
+	
+	for (i = 0; i < nreaders; i++) {
+		struct reader *r = &readers[i];
 
-	ret = ioctl(fd, SPI_IOC_RD_MODE, &mode);
-	if (ret == -1)
-		pabort("can't get spi mode");
+		r->mode = mode | SPI_CPHA;
+		r->bits = bits;
+		r->speed = speed;
+		r->delay = delay;
+		if (reader_open(r) < 0) {
+			fprintf(stderr, "reader %d (%s): disabled\n", r->id, r->device);
+			continue;
+		}
+		if (spi_max_hz)
+			reader_set_link(r, spi_max_hz);
+		opened++;
+	}
+	startup_phase("readers");
+	return opened;
+}
 
-	/*
-	 * bits per word
-	 */
-	ret = ioctl(fd, SPI_IOC_WR_BITS_PER_WORD, &bits);
-	if (ret == -1)
-		pabort("can't set bits per word");
+static void emit_event(const struct rfid_event *ev, void *arg)
+{
+	bus_publish(&bus, ev);
+	evsock_publish(&evsock, ev);
+	analytics_event(&analytics, ev);
+	history_append(&history, ev);
+	if (ev->type == RFID_EV_ARRIVED || ev->type == RFID_EV_DEPARTED) {
+		present += ev->type == RFID_EV_ARRIVED ? 1 : -1;
+		led_set(&leds, 0, present > 0 ? LED_READING : LED_IDLE);
+	}
+}
 
-	ret = ioctl(fd, SPI_IOC_RD_BITS_PER_WORD, &bits);
-	if (ret == -1)
-		pabort("can't get bits per word");
+/*
+ * Downstream handling shared by all readers
+ */
+static void on_read(struct reader *r, const struct rfid_event *read, void *arg)
+{
+	struct rfid_event ev = *read;
+	struct presence_tag *tag;
 
-	/*
-	 * max speed hz
-	 */
-	ret = ioctl(fd, SPI_IOC_WR_MAX_SPEED_HZ, &speed);
-	if (ret == -1)
-		pabort("can't set max speed hz");
+	journal_append(&journal, ev.uid, ev.rssi, ev.reader, JREC_F_RSSI_VALID);
+	tag = presence_seen(&presence, &ev, emit_event, NULL);
+	led_shot(&leds, 0, ev.ts_ns);
+	ev.flags |= presence_trend_flags(tag);
+	aggregate_read(&aggregator, &ev, emit_event, NULL);
+}
 
-	ret = ioctl(fd, SPI_IOC_RD_MAX_SPEED_HZ, &speed);
-	if (ret == -1)
-		pabort("can't get max speed hz");
+static void engine_stats(FILE *fp, void *arg)
+{
+	engine_report(arg, fp);
+}
 
-	//printf("spi mode: %d\n", mode);
-	//printf("bits per word: %d\n", bits);
-	//printf("max speed: %d Hz (%d KHz)\n", speed, speed/1000);
-	return fd;
+static void tdma_stats(FILE *fp, void *arg)
+{
+	tdma_report(arg, fp);
 }
 
-void setLED(char lednum, char state)
+static void on_cycle_end(struct reader *r, READER_RESULT result, uint64_t now_ns, void *arg)
 {
-	FILE *LEDHandle = NULL;
-	char stateStr[1];
-	char LED_Brightness[] = "/sys/class/leds/beaglebone:green:usr0/brightness";
-	sprintf(stateStr, "%d", state);
-	switch (lednum)
-	{
-		case 0:
-			strcpy(LED_Brightness, "/sys/class/leds/beaglebone:green:usr0/brightness");
-			break;
-		case 1:
-			strcpy(LED_Brightness, "/sys/class/leds/beaglebone:green:usr1/brightness");
-			break;
-		case 2:
-			strcpy(LED_Brightness, "/sys/class/leds/beaglebone:green:usr2/brightness");
-			break;
-		case 3:
-			strcpy(LED_Brightness, "/sys/class/leds/beaglebone:green:usr3/brightness");
-			break;
-	}
-	
-	if ((LEDHandle = fopen(LED_Brightness,"r+"))!=NULL)
-	{
-		fwrite(stateStr,sizeof(char), 1, LEDHandle);
-		fclose(LEDHandle);
-	}	
+	tdma_cycle_end(&tdma, r, result, now_ns);
 }
 
 int main(int argc, char *argv[])
 {
-	unsigned char uid[10] = {0};
-	unsigned char uid_cnt = 0;
-	FILE * fp;
-	int fd;
-	unsigned char wFlag = 0; // flag written
+	static char stats_names[READER_MAX][16];
+	uint64_t now, stats_next;
+	int i, opened;
 	
-	unsigned int timeout = 0;
-	unsigned int irq_status = 0;
+	startup_begin();
+	led_open(&leds, NULL);
+	for (i = 0; i < LED_COUNT; i++)
+		led_set(&leds, i, LED_OFF);
+	startup_phase("leds");
 	
-	// GPIO pins
-	unsigned int EN_GPIO = 26;   // GPIO0_26 = (0x32) + 26 = 26
-	unsigned int IRQ_GPIO = 45;   // GPIO1_13 = (32x1) + 13 = 45
+	opened = init(argc, argv); // Initialize SPI driver and check status
+	if (opened == 0) {
+		led_set(&leds, 1, LED_ERROR);
+		pabort("no reader available");
+	}
+	
+	if (journal_open(&journal, journal_path, JOURNAL_DEFAULT_CAPACITY, journal_sync_ms) < 0)
+		pabort("can't open journal");
+	startup_phase("journal");
+	
+	if (bus_create(&bus, bus_name, BUS_DEFAULT_CAPACITY) < 0)
+		pabort("can't create event bus");
+	if (evsock_listen(&evsock, sock_path) < 0)
+		pabort("can't create event socket");
+	presence_init(&presence, depart_ms, near_rssi);
+	aggregate_init(&aggregator, window_ms, rfid_now_ns());
+	analytics_init(&analytics, ANALYTICS_DEFAULT_WINDOW_S, rfid_now_ns());
+	startup_phase("events");
 	
-	gpio_export(EN_GPIO);
-	gpio_set_dir(EN_GPIO, OUTPUT_PIN);
-	gpio_set_value(EN_GPIO, HIGH);
+	signal(SIGINT, stop_handler);
+	signal(SIGTERM, stop_handler);
 	
-	gpio_export(IRQ_GPIO);
-	gpio_set_dir(IRQ_GPIO, INPUT_PIN);
-	gpio_set_edge(IRQ_GPIO, "rising");
+	if (engine_init(&engine) < 0)
+		pabort("can't create epoll");
+	startup_phase("engine");
 	
-	setLED(0, LOW);
-	setLED(1, LOW);
-	setLED(2, LOW);
-	setLED(3, LOW);
+	// before real-time mode, so the flush and compaction threads are not SCHED_FIFO
+	if (trace_path && trace_open(trace_path) < 0)
+		pabort("can't open trace");
+	if (history_open(&history, history_dir, retention_days) < 0)
+		pabort("can't open history");
+	startup_phase("history");
 	
-	fd = init(argc, argv); // Initialize SPI driver and check status
+	if ((rt_prio || rt_cpu >= 0) && rt_enter(rt_prio, rt_cpu) < 0)
+		fprintf(stderr, "real-time mode incomplete, continuing\n");
+	startup_phase("rt");
+	
+	now = rfid_now_ns();
+	tdma_init(&tdma, tdma_policy, slot_ms, now);
+	for (i = 0; i < nreaders; i++) {
+		struct reader *r = &readers[i];
+
+		if (r->spi_fd < 0)
+			continue;
+		r->on_read = on_read;
+		r->on_cycle_end = on_cycle_end;
+		tdma_add(&tdma, r);
+		// the first cycle in the reader's slot as well
+		if (engine_add(&engine, r, tdma_next_start(&tdma, r, now)) < 0)
+			pabort("can't watch irq line");
+		snprintf(stats_names[i], sizeof(stats_names[i]), "reader %d", r->id);
+		stats_register(stats_names[i], reader_stats_dump, r);
+	}
+	stats_register("engine", engine_stats, &engine);
+	stats_register("aggregate", aggregate_stats_dump, &aggregator);
+	stats_register("analytics", analytics_stats_dump, &analytics);
+	stats_register("history", history_stats_dump, &history);
+	stats_register("startup", startup_stats_dump, NULL);
+	stats_register("leds", led_stats_dump, &leds);
+	if (nreaders > 1)
+		stats_register("tdma", tdma_stats, &tdma);
+	stats_signal();
+	stats_next = now + STATS_DEFAULT_INTERVAL_MS * 1000000ull;
+	// activity on LED 0, a disabled reader on LED 1
+	led_set(&leds, 0, LED_IDLE);
+	led_set(&leds, 1, opened < nreaders ? LED_ERROR : LED_OFF);
+	startup_phase("start");
+	startup_report(stdout);
 	
 	/*
-	 * 5438_TRF7960_SPI_ISO15693_Single_Slot 
+	 * 5438_TRF7960_SPI_ISO15693_Single_Slot on every reader, driven by
+	 * IRQ edges and per-reader deadlines in their time slots
 	 */
-	while(1)
+	while(running)
 	{
-		setLED(0, HIGH);
-		timeout = 1000; // timeout used to break from waiting for IRQ
-		
-		uint8_t tx01[] = {0x83}; // Software Initialization
-		uint8_t rx01[ARRAY_SIZE(tx01)] = {0, };
-		transfer(fd, tx01, rx01, ARRAY_SIZE(tx01),0);
-		
-		uint8_t tx02[] = {0x80}; // Idle
-		uint8_t rx02[ARRAY_SIZE(tx02)] = {0, };
-		transfer(fd, tx02, rx02, ARRAY_SIZE(tx02),0);
-		 
-		uint8_t tx03[] = {0x20,0x21,0x02,0x00,0x00,0xC1,0xBB}; // Cont write 0x21 to Chip Status Control (0x00), 
-		uint8_t rx03[ARRAY_SIZE(tx03)] = {0, }; // 0x02  to ISO Control (0x01)
-		transfer(fd, tx03, rx03, ARRAY_SIZE(tx03),0);
-		
-		usleep(1000); // Sleep 1ms
-		
-		uint8_t tx[] = {0x09, 0x21}; //Write to 0x09 (Modulator and SYS_CLK control) 0x21. 
-		uint8_t rx[ARRAY_SIZE(tx)] = {0, }; //Set SYSCLK to 6.78MHz
-		transfer(fd, tx, rx, ARRAY_SIZE(tx),0);
+		if (engine_run_once(&engine, ENGINE_MAX_WAIT_MS) < 0)
+			pabort("epoll_wait");
 		
-		uint8_t tx2[] = {0x07, 0x13}; //Write to 0x07 (RX No Response Wait Time Register) value 0x13
-		uint8_t rx2[ARRAY_SIZE(tx2)] = {0, };
-		transfer(fd, tx2, rx2, ARRAY_SIZE(tx2),0);
+		now = rfid_now_ns();
+		presence_expire(&presence, now, emit_event, NULL);
+		aggregate_expire(&aggregator, now, emit_event, NULL);
+		analytics_tick(&analytics, now);
+		evsock_service(&evsock);
+		journal_sync(&journal, 0);
+		history_sync(&history, 0);
 		
-		uint8_t tx3[] = {0x6C, 0x00, 0x00}; // Cont read from 0x0C (IRQ Status)
-		uint8_t rx3[ARRAY_SIZE(tx3)] = {0, };
-		transfer(fd, tx3, rx3, ARRAY_SIZE(tx3),0);
-		
-		uint8_t tx4[] = {0x8F,0x91,0x3D,0x00,0x30,0x26,0x01,0x00}; //Reset, Transmit w/ CRC
-		uint8_t rx4[ARRAY_SIZE(tx4)] = {0, }; // Cont write from 0x1D, TX Length 3 bytes. Data: 0x26,0x01,0x00
-		transfer(fd, tx4, rx4, ARRAY_SIZE(tx4),0); //Reset to Ready, Inventory, Idle
-		
-		irq_status = 0;
-		while (irq_status != 1) //wait till IRQ line is HIGH
-		{
-			gpio_get_value(IRQ_GPIO, &irq_status);
-		}
-
-		uint8_t tx5[] = {0x6C, 0x00,0x00}; // Cont read from 0x0C (IRQ Status)
-		uint8_t rx5[ARRAY_SIZE(tx5)] = {0, };
-		transfer(fd, tx5, rx5, ARRAY_SIZE(tx5),0);
-
-		if (rx5[1] == 0x80)
-		{
-			uint8_t tx6[] = {0x8F};
-			uint8_t rx6[ARRAY_SIZE(tx6)] = {0, };
-			transfer(fd, tx6, rx6, ARRAY_SIZE(tx6),0);
-		
-			irq_status = 0;
-			while ((irq_status != 1) && (timeout)) //wait till IRQ line is HIGH or times out
-			{
-				gpio_get_value(IRQ_GPIO, &irq_status);
-				timeout--;
-			}
-			
-			if (timeout == 0)
-			{
-				//printf("timed out\n");
-			}
-			else {
-				uint8_t tx7[] = {0x6C, 0x00,0x00};  // Cont read from 0x0C (IRQ Status)
-				uint8_t rx7[ARRAY_SIZE(tx7)] = {0, };
-				transfer(fd, tx7, rx7, ARRAY_SIZE(tx7),0);
-				if (rx7[1] != 0x40)
-				{
-					//printf("irq error: 0x%X\n",rx7[1]);
-				}
-				
-				uint8_t tx8[] = {0x5C,0x00}; //Read 0x1C (FIFO Status)
-				uint8_t rx8[ARRAY_SIZE(tx8)] = {0, };
-				transfer(fd, tx8, rx8, ARRAY_SIZE(tx8),0);
-				//printf("bytes to read: %d\n", rx8[1]);
-				
-				if ((irq_status) && (rx8[1]==10)) { // Only when bytes to read is 10, the UID in FIFO is correct
-					uint8_t tx9[] = {0x7F,0x00,0x00,0x00,0x00, 
-									 0x00,0x00,0x00,0x00,0x00,0x00}; //Read FIFO register
-					uint8_t rx9[ARRAY_SIZE(tx9)] = {0, };
-					transfer(fd, tx9, rx9, ARRAY_SIZE(tx9),0);
-					
-					fp = fopen("uid.txt", "w");
-					for (uid_cnt=0; uid_cnt<8; uid_cnt++)
-					{
-						uid[uid_cnt] = rx9[10-uid_cnt];
-						fprintf(fp, "%.2X", uid[uid_cnt]);
-					}
-					fprintf(fp, "\n");
-					fclose(fp);
-					
-					setLED(0, LOW);
-					wFlag = 1;
-					printf("UID written\n");
-				}
-				
-				uint8_t tx15[] = {0x8F};
-				uint8_t rx15[ARRAY_SIZE(tx15)] = {0, };
-				transfer(fd, tx15, rx15, ARRAY_SIZE(tx15),0);
-				
-				uint8_t tx16[] = {0x4F, 0x00}; //Read RSSI Level
-				uint8_t rx16[ARRAY_SIZE(tx16)] = {0, };
-				transfer(fd, tx16, rx16, ARRAY_SIZE(tx16),0);
-				printf("rssi: %d\n\n", rx16[1]);
-				
-				uint8_t tx17[] = {0x8F}; // Reset FIFO
-				uint8_t rx17[ARRAY_SIZE(tx17)] = {0, };
-				transfer(fd, tx17, rx17, ARRAY_SIZE(tx17),0);
-				
-				uint8_t tx18[] = {0x96}; // Block Receiver
-				uint8_t rx18[ARRAY_SIZE(tx18)] = {0, };
-				transfer(fd, tx18, rx18, ARRAY_SIZE(tx18),0);
-				
-				uint8_t tx19[] = {0x4C, 0x00}; // Read IRQ status
-				uint8_t rx19[ARRAY_SIZE(tx19)] = {0, };
-				transfer(fd, tx19, rx19, ARRAY_SIZE(tx19),0);
-				
-				uint8_t tx20[] = {0x00,0x01}; // Turn off transmitter
-				uint8_t rx20[ARRAY_SIZE(tx20)] = {0, }; // 0x02  to ISO Control (0x01)
-				transfer(fd, tx20, rx20, ARRAY_SIZE(tx20),0);
-				
-				if (wFlag)
-				{
-					wFlag = 0;
-					sleep(1);
-				}
-			}
+		if (stats_requested()) {
+			stats_dump(stdout);
+			stats_next = now;
 		}
-		else
-		{
-			//printf(" ERROR: 0x%X. \n", rx5[1]);
+		if (now >= stats_next) {
+			stats_write_file(stats_path);
+			stats_next = now + STATS_DEFAULT_INTERVAL_MS * 1000000ull;
 		}
-		
-		usleep(500*1000); //500ms
 	}
 
-	close(fd);
+	if (nreaders > 1)
+		tdma_report(&tdma, stdout);
+	engine_report(&engine, stdout);
+	engine_close(&engine);
+	trace_close();
+	aggregate_flush(&aggregator, emit_event, NULL);
+	evsock_close(&evsock);
+	bus_destroy(&bus);
+	journal_close(&journal);
+	history_close(&history);
+	led_close(&leds);
 	printf("Complete\n");
 
 	return 0;
@@ -35,6 +35,8 @@
  */
 
 #include "SimpleGPIO.h"
+#include "startup.h"
+#include "rfid_event.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -64,6 +66,50 @@ int gpio_export(unsigned int gpio)
 	return 0;
 }
 
+/****************************************************************
+ * gpio_export_all
+ *
+ * Exports the lines that are not exported yet through a single open
+ * of the export file, and waits for the value file of each one, up to
+ * timeout_ms in total, before it can be configured. Returns the number
+ * of lines that are not there.
+ ****************************************************************/
+int gpio_export_all(const unsigned int *gpio, int n, unsigned int timeout_ms)
+{
+	uint64_t deadline = rfid_now_ns() + timeout_ms * 1000000ull, now;
+	int fd = -1, i, len, missing = 0;
+	char buf[MAX_BUF];
+
+	for (i = 0; i < n; i++) {
+		snprintf(buf, sizeof(buf), SYSFS_GPIO_DIR "/gpio%d", gpio[i]);
+		if (access(buf, F_OK) == 0)
+			continue;
+		if (fd < 0) {
+			fd = open(SYSFS_GPIO_DIR "/export", O_WRONLY);
+			if (fd < 0) {
+				perror("gpio/export");
+				return n - i;
+			}
+		}
+		len = snprintf(buf, sizeof(buf), "%d", gpio[i]);
+		if (write(fd, buf, len) != len) {
+			fprintf(stderr, "gpio/export %d: %s\n", gpio[i], strerror(errno));
+			missing++;
+			continue;
+		}
+
+		snprintf(buf, sizeof(buf), SYSFS_GPIO_DIR "/gpio%d/value", gpio[i]);
+		now = rfid_now_ns();
+		if (startup_wait_path(buf, now < deadline ? (deadline - now) / 1000000 : 0) < 0) {
+			fprintf(stderr, "%s: not there after %u ms\n", buf, timeout_ms);
+			missing++;
+		}
+	}
+	if (fd >= 0)
+		close(fd);
+	return missing;
+}
+
 /****************************************************************
  * gpio_unexport
  ****************************************************************/
@@ -109,6 +155,33 @@ int gpio_set_dir(unsigned int gpio, PIN_DIRECTION out_flag)
 	return 0;
 }
 
+/****************************************************************
+ * gpio_set_output
+ *
+ * Output driving value from the start: direction and value in one write.
+ ****************************************************************/
+int gpio_set_output(unsigned int gpio, PIN_VALUE value)
+{
+	int fd;
+	char buf[MAX_BUF];
+
+	snprintf(buf, sizeof(buf), SYSFS_GPIO_DIR  "/gpio%d/direction", gpio);
+
+	fd = open(buf, O_WRONLY);
+	if (fd < 0) {
+		perror("gpio/direction");
+		return fd;
+	}
+
+	if (value == LOW)
+		write(fd, "low", 4);
+	else
+		write(fd, "high", 5);
+
+	close(fd);
+	return 0;
+}
+
 /****************************************************************
  * gpio_set_value
  ****************************************************************/
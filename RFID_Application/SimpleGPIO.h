@@ -59,8 +59,10 @@ typedef enum {
  * gpio_export
  ****************************************************************/
 int gpio_export(unsigned int gpio);
+int gpio_export_all(const unsigned int *gpio, int n, unsigned int timeout_ms);
 int gpio_unexport(unsigned int gpio);
 int gpio_set_dir(unsigned int gpio, PIN_DIRECTION out_flag);
+int gpio_set_output(unsigned int gpio, PIN_VALUE value);
 int gpio_set_value(unsigned int gpio, PIN_VALUE value);
 int gpio_get_value(unsigned int gpio, unsigned int *value);
 int gpio_set_edge(unsigned int gpio, char *edge);
@@ -0,0 +1,210 @@
+/*
+ * aggregate.c
+ *
+ * Cross-reader read deduplication, see aggregate.h.
+ *
+ * Entries are referenced by index + 1 so that 0 ends a list; a free entry
+ * is on the free list through wheel_next. An open window sits in the hash
+ * chain of its UID and in the wheel slot of the tick it closes in; the
+ * wheel is expired up to, not including, the current tick, so every entry
+ * of a scanned slot whose tick has passed is closed and the rest (a later
+ * turn of the wheel after a long gap) are linked back.
+ */
+
+#include "aggregate.h"
+#include <string.h>
+
+#define AGGREGATE_WHEEL_MASK (AGGREGATE_WHEEL_SLOTS - 1)
+
+static unsigned int aggregate_hash(const uint8_t uid[8])
+{
+	uint64_t v;
+
+	memcpy(&v, uid, sizeof(v));
+	v *= 0x9E3779B97F4A7C15ull;
+	return (unsigned int)(v >> 40) & (AGGREGATE_HASH_SIZE - 1);
+}
+
+/****************************************************************
+ * aggregate_init
+ *
+ * window_ms 0 passes every read through.
+ ****************************************************************/
+void aggregate_init(struct aggregator *a, unsigned int window_ms, uint64_t now_ns)
+{
+	int i;
+
+	memset(a, 0, sizeof(*a));
+	a->window_ms = window_ms;
+	a->tick_ns = (uint64_t)window_ms * 1000000ull / (AGGREGATE_WHEEL_SLOTS / 2);
+	if (!a->tick_ns)
+		a->tick_ns = 1;
+	a->tick = now_ns / a->tick_ns;
+	for (i = 0; i < AGGREGATE_MAX_TAGS; i++)
+		a->entries[i].wheel_next = i + 1 < AGGREGATE_MAX_TAGS ? i + 2 : 0;
+	a->free = 1;
+}
+
+static void aggregate_emit(struct aggregator *a, const struct aggregate_entry *e, rfid_event_cb cb, void *arg)
+{
+	struct rfid_event ev;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.ts_ns = e->first_ns;
+	memcpy(ev.uid, e->uid, sizeof(ev.uid));
+	ev.type = RFID_EV_READ;
+	ev.rssi = e->rssi;
+	ev.reader = e->reader;
+	ev.flags = e->flags;
+	if (e->readers & (e->readers - 1)) {
+		ev.flags |= RFID_EVF_MERGED;
+		a->merged++;
+	}
+	a->events++;
+	cb(&ev, arg);
+}
+
+/* take entry i off its hash chain and put it on the free list */
+static void aggregate_release(struct aggregator *a, uint16_t i)
+{
+	struct aggregate_entry *e = &a->entries[i - 1];
+	uint16_t *p = &a->hash[aggregate_hash(e->uid)];
+
+	while (*p != i)
+		p = &a->entries[*p - 1].hash_next;
+	*p = e->hash_next;
+	e->wheel_next = a->free;
+	a->free = i;
+	a->active--;
+}
+
+/****************************************************************
+ * aggregate_read
+ ****************************************************************/
+void aggregate_read(struct aggregator *a, const struct rfid_event *read, rfid_event_cb cb, void *arg)
+{
+	struct aggregate_entry *e = NULL;
+	unsigned int h;
+	uint64_t due;
+	uint16_t i;
+
+	a->reads++;
+	if (!a->window_ms) {
+		a->events++;
+		cb(read, arg);
+		return;
+	}
+
+	h = aggregate_hash(read->uid);
+	for (i = a->hash[h]; i; i = e->hash_next) {
+		e = &a->entries[i - 1];
+		if (!memcmp(e->uid, read->uid, sizeof(e->uid)))
+			break;
+	}
+
+	if (!i) {
+		if (!a->free) {
+			a->overflows++;
+			a->events++;
+			cb(read, arg);
+			return;
+		}
+		i = a->free;
+		e = &a->entries[i - 1];
+		a->free = e->wheel_next;
+		memset(e, 0, sizeof(*e));
+		memcpy(e->uid, read->uid, sizeof(e->uid));
+		e->first_ns = read->ts_ns;
+		e->due_ns = read->ts_ns + (uint64_t)a->window_ms * 1000000ull;
+		e->hash_next = a->hash[h];
+		a->hash[h] = i;
+
+		/* a window due in a tick already expired closes at the next one */
+		due = e->due_ns / a->tick_ns;
+		if (due < a->tick)
+			due = a->tick;
+		e->wheel_next = a->wheel[due & AGGREGATE_WHEEL_MASK];
+		a->wheel[due & AGGREGATE_WHEEL_MASK] = i;
+		if (++a->active > a->active_max)
+			a->active_max = a->active;
+	}
+
+	if (!e->reads || ((read->flags & RFID_EVF_RSSI_VALID) && read->rssi > e->rssi)) {
+		e->rssi = read->rssi;
+		e->reader = read->reader;
+	}
+	e->flags = (e->flags & RFID_EVF_RSSI_VALID) | read->flags;
+	e->reads++;
+	e->readers |= 1u << (read->reader & 31);
+}
+
+/****************************************************************
+ * aggregate_expire
+ *
+ * Publishes the windows that closed before the current wheel tick.
+ ****************************************************************/
+void aggregate_expire(struct aggregator *a, uint64_t now_ns, rfid_event_cb cb, void *arg)
+{
+	uint64_t now_tick = now_ns / a->tick_ns;
+	uint64_t limit = now_tick * a->tick_ns;
+
+	if (!a->window_ms || now_tick <= a->tick)
+		return;
+	if (now_tick - a->tick > AGGREGATE_WHEEL_SLOTS)
+		a->tick = now_tick - AGGREGATE_WHEEL_SLOTS;
+
+	for (; a->tick < now_tick; a->tick++) {
+		uint16_t *slot = &a->wheel[a->tick & AGGREGATE_WHEEL_MASK];
+		uint16_t i = *slot, next;
+
+		*slot = 0;
+		for (; i; i = next) {
+			struct aggregate_entry *e = &a->entries[i - 1];
+
+			next = e->wheel_next;
+			if (e->due_ns >= limit) {
+				e->wheel_next = *slot;
+				*slot = i;
+				continue;
+			}
+			aggregate_emit(a, e, cb, arg);
+			aggregate_release(a, i);
+		}
+	}
+}
+
+/****************************************************************
+ * aggregate_flush
+ *
+ * Publishes every open window, e.g. on shutdown.
+ ****************************************************************/
+void aggregate_flush(struct aggregator *a, rfid_event_cb cb, void *arg)
+{
+	int s;
+
+	for (s = 0; s < AGGREGATE_WHEEL_SLOTS; s++) {
+		uint16_t i = a->wheel[s], next;
+
+		a->wheel[s] = 0;
+		for (; i; i = next) {
+			next = a->entries[i - 1].wheel_next;
+			aggregate_emit(a, &a->entries[i - 1], cb, arg);
+			aggregate_release(a, i);
+		}
+	}
+}
+
+/****************************************************************
+ * aggregate_stats_dump
+ *
+ * stats section of the aggregator, arg is the struct aggregator.
+ ****************************************************************/
+void aggregate_stats_dump(FILE *fp, void *arg)
+{
+	const struct aggregator *a = arg;
+
+	fprintf(fp, "  window %u ms: %u reads -> %u events (%.1f%%), %u merged across readers, "
+		"%u overflows, %d/%d open (max %d)\n", a->window_ms, a->reads, a->events,
+		a->reads ? a->events * 100.0 / a->reads : 0.0, a->merged, a->overflows,
+		a->active, AGGREGATE_MAX_TAGS, a->active_max);
+}
@@ -0,0 +1,73 @@
+/*
+ * aggregate.h
+ *
+ * Cross-reader deduplication of reads. A tag in range of several antennas
+ * is read by every one of them; the aggregator merges all reads of one UID
+ * within window_ms of its first read into a single READ event, published
+ * when the window closes, with the RSSI and reader of the strongest read
+ * as the tag's location and the time of the first read.
+ *
+ * Memory is fixed: open windows live in a table of AGGREGATE_MAX_TAGS
+ * entries found through a hash of the UID, and close on a timing wheel of
+ * AGGREGATE_WHEEL_SLOTS slots (window_ms spans half of them), so a read
+ * and the expiry of a window are O(1). A read that finds the table full is
+ * published on its own and counted as an overflow.
+ */
+
+#ifndef AGGREGATE_H_
+#define AGGREGATE_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "rfid_event.h"
+
+#define AGGREGATE_MAX_TAGS 256
+#define AGGREGATE_HASH_SIZE 512    /* power of two */
+#define AGGREGATE_WHEEL_SLOTS 64   /* power of two */
+#define AGGREGATE_DEFAULT_WINDOW_MS 1000
+
+/* flag of a merged READ event: more than one reader read the tag */
+#define RFID_EVF_MERGED 0x08
+
+struct aggregate_entry {
+	uint8_t uid[8];
+	uint8_t rssi;          /* strongest read so far ... */
+	uint8_t reader;        /* ... and its reader */
+	uint8_t flags;
+	uint16_t hash_next;    /* entry index + 1, 0 = end of chain */
+	uint16_t wheel_next;
+	uint32_t reads;
+	uint32_t readers;      /* bit per reader id that read the tag */
+	uint64_t first_ns;     /* IRQ time of the first read of the window */
+	uint64_t due_ns;
+};
+
+struct aggregator {
+	struct aggregate_entry entries[AGGREGATE_MAX_TAGS];
+	uint16_t hash[AGGREGATE_HASH_SIZE];
+	uint16_t wheel[AGGREGATE_WHEEL_SLOTS];
+	uint16_t free;         /* free list through wheel_next */
+	unsigned int window_ms;
+	uint64_t tick_ns;
+	uint64_t tick;         /* next wheel tick to expire */
+	int active;
+
+	/* statistics */
+	uint32_t reads;
+	uint32_t events;
+	uint32_t merged;       /* events that merged reads of several readers */
+	uint32_t overflows;
+	int active_max;
+};
+
+/****************************************************************
+ * aggregator API
+ ****************************************************************/
+void aggregate_init(struct aggregator *a, unsigned int window_ms, uint64_t now_ns);
+void aggregate_read(struct aggregator *a, const struct rfid_event *read, rfid_event_cb cb, void *arg);
+void aggregate_expire(struct aggregator *a, uint64_t now_ns, rfid_event_cb cb, void *arg);
+void aggregate_flush(struct aggregator *a, rfid_event_cb cb, void *arg);
+void aggregate_stats_dump(FILE *fp, void *arg);
+
+#endif /* AGGREGATE_H_ */
@@ -0,0 +1,235 @@
+/*
+ * analytics.c
+ *
+ * Dwell and zone analytics, see analytics.h.
+ */
+
+#include "analytics.h"
+#include <string.h>
+
+#define NS_PER_MS 1000000ull
+
+static unsigned int analytics_hash(const uint8_t uid[8])
+{
+	uint64_t v;
+
+	memcpy(&v, uid, sizeof(v));
+	v *= 0x9E3779B97F4A7C15ull;
+	return (unsigned int)(v >> 40) & (ANALYTICS_HASH_SIZE - 1);
+}
+
+static void analytics_window_reset(struct analytics *a, struct analytics_window *w, uint64_t start_ns)
+{
+	memset(w, 0, sizeof(*w));
+	w->start_ns = start_ns;
+	memcpy(w->zone_peak, a->occupancy, sizeof(w->zone_peak));
+}
+
+/****************************************************************
+ * analytics_init
+ ****************************************************************/
+void analytics_init(struct analytics *a, unsigned int window_s, uint64_t now_ns)
+{
+	int i;
+
+	memset(a, 0, sizeof(*a));
+	a->window_s = window_s ? window_s : ANALYTICS_DEFAULT_WINDOW_S;
+	for (i = 0; i < ANALYTICS_MAX_TAGS; i++)
+		a->tags[i].next = i + 1 < ANALYTICS_MAX_TAGS ? i + 2 : 0;
+	a->free = 1;
+	analytics_window_reset(a, &a->cur, now_ns);
+	a->last.start_ns = now_ns;
+}
+
+/****************************************************************
+ * analytics_tick
+ *
+ * Closes the current window once window_s has passed; called for every
+ * event and from the main loop so quiet periods close windows as well.
+ ****************************************************************/
+void analytics_tick(struct analytics *a, uint64_t now_ns)
+{
+	uint64_t len = a->window_s * 1000000000ull;
+	uint64_t start;
+
+	if (now_ns < a->cur.start_ns + len)
+		return;
+	start = now_ns - (now_ns - a->cur.start_ns) % len;
+	if (start == a->cur.start_ns + len)
+		a->last = a->cur;
+	else
+		analytics_window_reset(a, &a->last, start - len);
+	analytics_window_reset(a, &a->cur, start);
+}
+
+static struct analytics_tag *analytics_find(struct analytics *a, const uint8_t uid[8], uint16_t **link)
+{
+	uint16_t *p = &a->hash[analytics_hash(uid)];
+
+	while (*p) {
+		struct analytics_tag *t = &a->tags[*p - 1];
+
+		if (!memcmp(t->uid, uid, sizeof(t->uid))) {
+			*link = p;
+			return t;
+		}
+		p = &t->next;
+	}
+	*link = p;
+	return NULL;
+}
+
+/* one more tag in zone z */
+static void analytics_enter(struct analytics *a, uint8_t z)
+{
+	a->occupancy[z]++;
+	if (a->occupancy[z] > a->occupancy_peak[z])
+		a->occupancy_peak[z] = a->occupancy[z];
+	if (a->occupancy[z] > a->cur.zone_peak[z])
+		a->cur.zone_peak[z] = a->occupancy[z];
+}
+
+static void analytics_arrived(struct analytics *a, const struct rfid_event *ev, uint8_t z)
+{
+	struct analytics_tag *t;
+	uint16_t *link, i;
+
+	if (analytics_find(a, ev->uid, &link))
+		return;
+	if (!a->free) {
+		a->overflows++;
+		return;
+	}
+	i = a->free;
+	t = &a->tags[i - 1];
+	a->free = t->next;
+	memcpy(t->uid, ev->uid, sizeof(t->uid));
+	t->zone = z;
+	t->arrive_ns = t->zone_ns = t->last_ns = ev->ts_ns;
+	t->next = 0;
+	*link = i;
+	a->tracked++;
+
+	a->cur.arrivals++;
+	a->cur.zone_arrivals[z]++;
+	analytics_enter(a, z);
+}
+
+static void analytics_moved(struct analytics *a, const struct rfid_event *ev, uint8_t z)
+{
+	struct analytics_tag *t;
+	uint16_t *link;
+
+	t = analytics_find(a, ev->uid, &link);
+	if (!t) {
+		a->untracked++;
+		return;
+	}
+	if (ev->ts_ns > t->last_ns)
+		t->last_ns = ev->ts_ns;
+	if (t->zone == z)
+		return;
+	a->occupancy[t->zone]--;
+	analytics_enter(a, z);
+	if (ev->ts_ns <= t->zone_ns) {
+		/* merged read of the arrival: located at the strongest reader */
+		if (t->arrive_ns >= a->cur.start_ns) {
+			a->cur.zone_arrivals[t->zone]--;
+			a->cur.zone_arrivals[z]++;
+		}
+		t->zone = z;
+		return;
+	}
+	a->transitions[t->zone][z]++;
+	a->cur.transitions++;
+	stats_hist_add(&a->zone_dwell_ms, (ev->ts_ns - t->zone_ns) / NS_PER_MS);
+	t->zone = z;
+	t->zone_ns = ev->ts_ns;
+}
+
+static void analytics_departed(struct analytics *a, const struct rfid_event *ev)
+{
+	struct analytics_tag *t;
+	uint16_t *link, i;
+	uint32_t dwell;
+
+	t = analytics_find(a, ev->uid, &link);
+	if (!t) {
+		a->untracked++;
+		return;
+	}
+	dwell = (t->last_ns - t->arrive_ns) / NS_PER_MS;
+	stats_hist_add(&a->dwell_ms, dwell);
+	stats_hist_add(&a->cur.dwell_ms, dwell);
+	a->cur.departures++;
+	a->occupancy[t->zone]--;
+
+	i = *link;
+	*link = t->next;
+	t->next = a->free;
+	a->free = i;
+	a->tracked--;
+}
+
+/****************************************************************
+ * analytics_event
+ ****************************************************************/
+void analytics_event(struct analytics *a, const struct rfid_event *ev)
+{
+	uint8_t z = ev->reader % ANALYTICS_MAX_ZONES;
+
+	a->events++;
+	analytics_tick(a, ev->ts_ns);
+	switch (ev->type) {
+	case RFID_EV_ARRIVED:
+		analytics_arrived(a, ev, z);
+		break;
+	case RFID_EV_READ:
+		analytics_moved(a, ev, z);
+		break;
+	case RFID_EV_DEPARTED:
+		analytics_departed(a, ev);
+		break;
+	}
+}
+
+static void analytics_window_print(const struct analytics_window *w, const char *name, FILE *fp)
+{
+	int z;
+
+	fprintf(fp, "  %s window: %u arrivals, %u departures, %u transitions, peak",
+		name, w->arrivals, w->departures, w->transitions);
+	for (z = 0; z < ANALYTICS_MAX_ZONES; z++)
+		if (w->zone_arrivals[z] || w->zone_peak[z])
+			fprintf(fp, " %d=%u", z, w->zone_peak[z]);
+	fprintf(fp, "\n");
+	stats_hist_print(&w->dwell_ms, "dwell", "ms", fp);
+}
+
+/****************************************************************
+ * analytics_stats_dump
+ *
+ * stats section of the analytics, arg is the struct analytics.
+ ****************************************************************/
+void analytics_stats_dump(FILE *fp, void *arg)
+{
+	const struct analytics *a = arg;
+	int from, to;
+
+	fprintf(fp, "  %u events, %d tags present, %u untracked, %u overflows\n",
+		a->events, a->tracked, a->untracked, a->overflows);
+	fprintf(fp, "  occupancy (peak):");
+	for (to = 0; to < ANALYTICS_MAX_ZONES; to++)
+		if (a->occupancy_peak[to])
+			fprintf(fp, " %d=%u(%u)", to, a->occupancy[to], a->occupancy_peak[to]);
+	fprintf(fp, "\n  transitions:");
+	for (from = 0; from < ANALYTICS_MAX_ZONES; from++)
+		for (to = 0; to < ANALYTICS_MAX_ZONES; to++)
+			if (a->transitions[from][to])
+				fprintf(fp, " %d->%d=%u", from, to, a->transitions[from][to]);
+	fprintf(fp, "\n");
+	stats_hist_print(&a->dwell_ms, "dwell", "ms", fp);
+	stats_hist_print(&a->zone_dwell_ms, "zone dwell", "ms", fp);
+	analytics_window_print(&a->cur, "current", fp);
+	analytics_window_print(&a->last, "last", fp);
+}
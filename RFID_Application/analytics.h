@@ -0,0 +1,85 @@
+/*
+ * analytics.h
+ *
+ * Dwell and zone analytics computed on the event stream as it is
+ * published, instead of by parsing logs afterwards. A zone is a reader.
+ *
+ * A tag is tracked from ARRIVED to DEPARTED: its dwell time, arrival to
+ * last READ, goes into a histogram when it departs, the zone it is in is
+ * counted in the occupancy of that zone, and a READ from another reader
+ * (the strongest one, see aggregate.h) moves it there and counts a
+ * transition between the two. The merged READ of the arrival itself only
+ * places the tag at its strongest reader. Every event is O(1): tags are
+ * found through a hash of the UID in a table of ANALYTICS_MAX_TAGS
+ * entries, and tags that do not fit are counted as overflows and not
+ * tracked.
+ *
+ * Besides the totals, arrivals, departures, transitions, peak occupancy
+ * and dwell times are kept per fixed window of window_s seconds; the
+ * current and the last complete window are reported. The results are
+ * printed through the stats registry (analytics_stats_dump).
+ */
+
+#ifndef ANALYTICS_H_
+#define ANALYTICS_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "rfid_event.h"
+#include "stats.h"
+
+#define ANALYTICS_MAX_TAGS 256
+#define ANALYTICS_HASH_SIZE 512    /* power of two */
+#define ANALYTICS_MAX_ZONES 32     /* one per reader */
+#define ANALYTICS_DEFAULT_WINDOW_S 60
+
+struct analytics_tag {
+	uint8_t uid[8];
+	uint8_t zone;
+	uint16_t next;         /* hash chain or free list, entry index + 1 */
+	uint64_t arrive_ns;
+	uint64_t zone_ns;      /* entered the current zone */
+	uint64_t last_ns;      /* last READ */
+};
+
+struct analytics_window {
+	uint64_t start_ns;
+	uint32_t arrivals;
+	uint32_t departures;
+	uint32_t transitions;
+	uint32_t zone_arrivals[ANALYTICS_MAX_ZONES];
+	uint16_t zone_peak[ANALYTICS_MAX_ZONES];
+	struct stats_hist dwell_ms;
+};
+
+struct analytics {
+	struct analytics_tag tags[ANALYTICS_MAX_TAGS];
+	uint16_t hash[ANALYTICS_HASH_SIZE];
+	uint16_t free;
+	unsigned int window_s;
+
+	uint16_t occupancy[ANALYTICS_MAX_ZONES];
+	uint16_t occupancy_peak[ANALYTICS_MAX_ZONES];
+	uint32_t transitions[ANALYTICS_MAX_ZONES][ANALYTICS_MAX_ZONES]; /* [from][to] */
+	struct stats_hist dwell_ms;
+	struct stats_hist zone_dwell_ms;   /* time in a zone before moving on */
+	struct analytics_window cur;
+	struct analytics_window last;
+
+	/* statistics */
+	uint32_t events;
+	uint32_t untracked;    /* READ/DEPARTED of a tag not being tracked */
+	uint32_t overflows;
+	int tracked;
+};
+
+/****************************************************************
+ * analytics API
+ ****************************************************************/
+void analytics_init(struct analytics *a, unsigned int window_s, uint64_t now_ns);
+void analytics_event(struct analytics *a, const struct rfid_event *ev);
+void analytics_tick(struct analytics *a, uint64_t now_ns);
+void analytics_stats_dump(FILE *fp, void *arg);
+
+#endif /* ANALYTICS_H_ */
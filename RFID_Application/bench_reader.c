@@ -0,0 +1,368 @@
+/*
+ * bench_reader.c
+ *
+ * Reader benchmark: the complete engine (protothread sessions, timerfd
+ * cycle clock, epoll) against emulated TRF7970A readers (see trf_emu.h)
+ * and a synthetic tag population, with the results as one JSON object so
+ * that runs can be compared across inventory and timing changes.
+ *
+ * Tag population: -n tags, all in the field for the whole run (-r 0), or
+ * arriving as a Poisson process of -r arrivals/s and staying an
+ * exponentially distributed time with mean -d ms. Each tag gets an RSSI
+ * per reader drawn uniformly from -R lo-hi; -k adds random corruption
+ * (percent) to single-tag replies. Two tags in the field at once collide,
+ * as they do with the single slot inventory. -a negotiates the SPI clock
+ * up to max_hz (see reader_set_link) and -L makes the emulated bus
+ * unreliable above link_hz.
+ *
+ * Reported: reads/s and cycles/s, detection latency (tag enters the field
+ * -> first read of it) percentiles, CPU time per read, and syscalls per
+ * cycle. Syscalls are counted in a second, shorter run of the same setup
+ * in a child under ptrace (it slows the child down, so it does not share
+ * the timed run); -S skips it.
+ *
+ * Usage: bench_reader [-t seconds] [-N readers] [-n tags] [-r arrivals/s]
+ *                     [-d dwell_ms] [-R lo-hi] [-k pct] [-c cycle_ms]
+ *                     [-H hold_ms] [-a max_hz] [-L link_hz] [-z seed] [-S]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+#include <signal.h>
+#include <sys/ptrace.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#include "engine.h"
+#include "trf_emu.h"
+#include "stats.h"
+
+#define BENCH_MAX_TAGS EMU_MAX_TAGS
+
+struct bench_config {
+	unsigned int seconds;
+	int nreaders;
+	int ntags;
+	double rate;           /* arrivals/s, 0 = all tags always present */
+	unsigned int dwell_ms;
+	unsigned int rssi_lo;
+	unsigned int rssi_hi;
+	unsigned int corrupt_pct;
+	unsigned int cycle_ms;
+	unsigned int hold_ms;
+	uint32_t spi_max_hz;   /* negotiate up to, 0 = fixed clock */
+	uint32_t link_hz;      /* emulated bus clean up to, 0 = any */
+	unsigned int seed;
+};
+
+struct bench_result {
+	uint32_t reads;
+	uint32_t cycles;
+	uint32_t errors;
+	uint32_t bad_uids;
+	uint32_t spi_hz;       /* lowest clock of the readers at the end */
+	uint32_t arrivals;
+	uint32_t missed;       /* visits that ended without a read */
+	uint64_t cpu_us;
+	struct stats_hist detect_us;
+};
+
+static struct emu_field field;
+static struct trf_emu emus[READER_MAX];
+static struct reader readers[READER_MAX];
+static uint8_t detected[BENCH_MAX_TAGS]; /* current visit already read */
+static struct bench_result *result;
+
+static double bench_exp(unsigned int *seed, double mean)
+{
+	double u = (rand_r(seed) + 1.0) / (RAND_MAX + 2.0);
+
+	return -mean * log(u);
+}
+
+static void on_read(struct reader *r, const struct rfid_event *ev, void *arg)
+{
+	int i = ev->uid[6] << 8 | ev->uid[7];
+	struct emu_tag *t;
+
+	if (i >= field.ntags)
+		return;
+	t = &field.tags[i];
+	if (!detected[i] && ev->ts_ns >= t->arrive_ns) {
+		detected[i] = 1;
+		stats_hist_add(&result->detect_us, (ev->ts_ns - t->arrive_ns) / 1000);
+	}
+}
+
+/* plan arrivals up to horizon_ns */
+static void bench_schedule(const struct bench_config *cfg, uint64_t *next_ns, uint64_t horizon_ns)
+{
+	while (*next_ns <= horizon_ns) {
+		uint64_t at = *next_ns;
+		int i, idle = -1;
+
+		for (i = 0; i < field.ntags; i++) {
+			struct emu_tag *t = &field.tags[i];
+
+			if (t->depart_ns && t->depart_ns <= at) {
+				if (!detected[i])
+					result->missed++;
+				t->depart_ns = 0;
+				t->arrive_ns = ~0ull;
+			}
+			if (idle < 0 && t->arrive_ns == ~0ull)
+				idle = i;
+		}
+		if (idle >= 0) {
+			struct emu_tag *t = &field.tags[idle];
+
+			t->arrive_ns = at;
+			t->depart_ns = at + 1 + (uint64_t)(bench_exp(&field.seed, cfg->dwell_ms) * 1e6);
+			detected[idle] = 0;
+			result->arrivals++;
+		}
+		*next_ns += (uint64_t)(bench_exp(&field.seed, 1e9 / cfg->rate));
+	}
+}
+
+/* mark: raise SIGSTOP around the timed loop for the syscall counter */
+static void bench_run(const struct bench_config *cfg, struct bench_result *res, int mark)
+{
+	struct engine engine;
+	struct rusage ru0, ru1;
+	uint64_t now, end, next_ns;
+	int i, j;
+
+	memset(res, 0, sizeof(*res));
+	result = res;
+	emu_field_init(&field, cfg->seed);
+	field.collision_pct = cfg->corrupt_pct;
+	field.spi_max_hz = cfg->link_hz;
+	for (i = 0; i < cfg->ntags; i++) {
+		uint8_t uid[8] = {0xE0,0x07,0x00,0x00,0x00,0x00,0x00,0x00};
+		struct emu_tag *t;
+
+		uid[6] = i >> 8;
+		uid[7] = i;
+		t = emu_field_add_tag(&field, uid);
+		for (j = 0; j < cfg->nreaders; j++)
+			t->rssi[j] = cfg->rssi_lo + rand_r(&field.seed) % (cfg->rssi_hi - cfg->rssi_lo + 1);
+		t->arrive_ns = cfg->rate > 0 ? ~0ull : 0;
+		detected[i] = 0;
+	}
+
+	if (engine_init(&engine) < 0)
+		exit(1);
+	now = rfid_now_ns();
+	for (i = 0; i < cfg->nreaders; i++) {
+		if (trf_emu_init(&emus[i], &field) < 0 ||
+		    reader_open_emu(&readers[i], i, &emus[i]) < 0)
+			exit(1);
+		readers[i].cycle_ms = cfg->cycle_ms;
+		readers[i].hold_ms = cfg->hold_ms;
+		readers[i].on_read = on_read;
+		if (cfg->spi_max_hz)
+			reader_set_link(&readers[i], cfg->spi_max_hz);
+		if (engine_add(&engine, &readers[i], now) < 0)
+			exit(1);
+	}
+	if (cfg->rate <= 0)
+		for (i = 0; i < field.ntags; i++)
+			field.tags[i].arrive_ns = now;
+	next_ns = now;
+
+	if (mark)
+		raise(SIGSTOP);
+	getrusage(RUSAGE_SELF, &ru0);
+	end = now + cfg->seconds * 1000000000ull;
+	while ((now = rfid_now_ns()) < end) {
+		if (cfg->rate > 0)
+			bench_schedule(cfg, &next_ns, now + 100000000ull);
+		if (engine_run_once(&engine, 100) < 0)
+			exit(1);
+	}
+	getrusage(RUSAGE_SELF, &ru1);
+	if (mark)
+		raise(SIGSTOP);
+
+	res->cpu_us = (ru1.ru_utime.tv_sec - ru0.ru_utime.tv_sec) * 1000000ull +
+		(ru1.ru_utime.tv_usec - ru0.ru_utime.tv_usec) +
+		(ru1.ru_stime.tv_sec - ru0.ru_stime.tv_sec) * 1000000ull +
+		(ru1.ru_stime.tv_usec - ru0.ru_stime.tv_usec);
+	for (i = 0; i < cfg->nreaders; i++) {
+		res->reads += readers[i].reads;
+		res->cycles += readers[i].cycles;
+		res->errors += readers[i].rx_errors;
+		res->bad_uids += readers[i].bad_uids;
+		if (!res->spi_hz || readers[i].speed < res->spi_hz)
+			res->spi_hz = readers[i].speed;
+	}
+	if (cfg->rate <= 0)
+		res->arrivals = field.ntags;
+	engine_close(&engine);
+	for (i = 0; i < cfg->nreaders; i++)
+		trf_emu_close(&emus[i]);
+}
+
+/*
+ * Syscalls per cycle: run the benchmark in a child under ptrace and count
+ * syscall entries between the two SIGSTOPs the child raises around the
+ * timed loop. Returns -1 if ptrace is not available.
+ */
+static double bench_syscalls(const struct bench_config *cfg)
+{
+	struct bench_config short_cfg = *cfg;
+	struct bench_result res;
+	uint64_t stops = 0;
+	uint32_t cycles = 0;
+	int pfd[2], status, counting = 0, sig;
+	pid_t pid;
+
+	short_cfg.seconds = cfg->seconds < 2 ? cfg->seconds : 2;
+	if (pipe(pfd) < 0)
+		return -1;
+	pid = fork();
+	if (pid < 0)
+		return -1;
+	if (pid == 0) {
+		close(pfd[0]);
+		if (ptrace(PTRACE_TRACEME, 0, 0, 0) < 0)
+			_exit(1);
+		raise(SIGSTOP);         /* wait for the tracer */
+		bench_run(&short_cfg, &res, 1);
+		if (write(pfd[1], &res.cycles, sizeof(res.cycles)) < 0)
+			_exit(1);
+		_exit(0);
+	}
+	close(pfd[1]);
+	if (waitpid(pid, &status, 0) < 0 || !WIFSTOPPED(status)) {
+		close(pfd[0]);
+		return -1;
+	}
+	ptrace(PTRACE_SETOPTIONS, pid, 0, PTRACE_O_TRACESYSGOOD);
+	sig = 0;
+	for (;;) {
+		if (ptrace(PTRACE_SYSCALL, pid, 0, sig) < 0)
+			break;
+		if (waitpid(pid, &status, 0) < 0 || WIFEXITED(status) || WIFSIGNALED(status))
+			break;
+		sig = 0;
+		if (!WIFSTOPPED(status))
+			continue;
+		if (WSTOPSIG(status) == (SIGTRAP | 0x80)) {
+			stops += counting;
+		} else if (WSTOPSIG(status) == SIGSTOP) {
+			counting = !counting;
+		} else {
+			sig = WSTOPSIG(status);
+		}
+	}
+	if (read(pfd[0], &cycles, sizeof(cycles)) != sizeof(cycles) || !cycles) {
+		close(pfd[0]);
+		return -1;
+	}
+	close(pfd[0]);
+	return stops / 2.0 / cycles;  /* a stop at entry and one at exit */
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [-t seconds] [-N readers] [-n tags] [-r arrivals/s]\n"
+		"       [-d dwell_ms] [-R lo-hi] [-k pct] [-c cycle_ms] [-H hold_ms]\n"
+		"       [-a max_hz] [-L link_hz] [-z seed] [-S]\n",
+		prog);
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	struct bench_config cfg = {
+		.seconds = 5, .nreaders = 1, .ntags = 8, .rate = 0.5, .dwell_ms = 1000,
+		.rssi_lo = 0x50, .rssi_hi = 0x7C, .corrupt_pct = 0,
+		.cycle_ms = 0, .hold_ms = 0, .seed = 1,
+	};
+	struct bench_result res;
+	double syscalls = -1;
+	int c, lo, hi, no_syscalls = 0;
+
+	while ((c = getopt(argc, argv, "t:N:n:r:d:R:k:c:H:a:L:z:S")) != -1) {
+		switch (c) {
+		case 't':
+			cfg.seconds = atoi(optarg);
+			break;
+		case 'N':
+			cfg.nreaders = atoi(optarg);
+			break;
+		case 'n':
+			cfg.ntags = atoi(optarg);
+			break;
+		case 'r':
+			cfg.rate = atof(optarg);
+			break;
+		case 'd':
+			cfg.dwell_ms = atoi(optarg);
+			break;
+		case 'R':
+			if (sscanf(optarg, "%i-%i", &lo, &hi) != 2 || lo < 1 || hi > 0xFF || lo > hi)
+				usage(argv[0]);
+			cfg.rssi_lo = lo;
+			cfg.rssi_hi = hi;
+			break;
+		case 'k':
+			cfg.corrupt_pct = atoi(optarg);
+			break;
+		case 'c':
+			cfg.cycle_ms = atoi(optarg);
+			break;
+		case 'H':
+			cfg.hold_ms = atoi(optarg);
+			break;
+		case 'a':
+			cfg.spi_max_hz = strtoul(optarg, NULL, 0);
+			break;
+		case 'L':
+			cfg.link_hz = strtoul(optarg, NULL, 0);
+			break;
+		case 'z':
+			cfg.seed = atoi(optarg);
+			break;
+		case 'S':
+			no_syscalls = 1;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (!cfg.seconds || cfg.nreaders < 1 || cfg.nreaders > READER_MAX ||
+	    cfg.ntags < 1 || cfg.ntags > BENCH_MAX_TAGS)
+		usage(argv[0]);
+
+	if (!no_syscalls)
+		syscalls = bench_syscalls(&cfg);
+	bench_run(&cfg, &res, 0);
+
+	printf("{\"config\":{\"seconds\":%u,\"readers\":%d,\"tags\":%d,\"arrivals_per_s\":%g,"
+	       "\"dwell_ms\":%u,\"rssi\":[%u,%u],\"corrupt_pct\":%u,\"cycle_ms\":%u,"
+	       "\"hold_ms\":%u,\"spi_max_hz\":%u,\"link_hz\":%u,\"seed\":%u},\n",
+	       cfg.seconds, cfg.nreaders, cfg.ntags, cfg.rate, cfg.dwell_ms, cfg.rssi_lo,
+	       cfg.rssi_hi, cfg.corrupt_pct, cfg.cycle_ms, cfg.hold_ms, cfg.spi_max_hz,
+	       cfg.link_hz, cfg.seed);
+	printf(" \"reads\":%u,\"reads_per_s\":%.1f,\"cycles\":%u,\"cycles_per_s\":%.1f,"
+	       "\"rx_errors\":%u,\"bad_uids\":%u,\"spi_hz\":%u,\"arrivals\":%u,\"missed\":%u,\n",
+	       res.reads, (double)res.reads / cfg.seconds, res.cycles,
+	       (double)res.cycles / cfg.seconds, res.errors, res.bad_uids, res.spi_hz,
+	       res.arrivals, res.missed);
+	printf(" \"detect_us\":");
+	stats_hist_json(&res.detect_us, stdout);
+	printf(",\n \"cpu_us_per_read\":%.1f,\"cpu_us_per_cycle\":%.1f,",
+	       res.reads ? (double)res.cpu_us / res.reads : 0.0,
+	       res.cycles ? (double)res.cpu_us / res.cycles : 0.0);
+	if (syscalls < 0)
+		printf("\"syscalls_per_cycle\":null}\n");
+	else
+		printf("\"syscalls_per_cycle\":%.1f}\n", syscalls);
+	return 0;
+}
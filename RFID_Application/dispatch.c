@@ -0,0 +1,181 @@
+/*
+ * dispatch.c
+ *
+ * Action dispatcher, see dispatch.h.
+ */
+
+#define _GNU_SOURCE
+#include "dispatch.h"
+#include "rfid_event.h"
+#include "probes.h"
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <spawn.h>
+#include <sys/wait.h>
+
+extern char **environ;
+
+static void dispatch_sigchld(int sig)
+{
+}
+
+void dispatch_init(struct dispatcher *d)
+{
+	struct sigaction sa, old;
+
+	memset(d, 0, sizeof(*d));
+	/* wake the loop on child exit, unless the program handles SIGCHLD */
+	if (sigaction(SIGCHLD, NULL, &old) == 0 && old.sa_handler == SIG_DFL) {
+		memset(&sa, 0, sizeof(sa));
+		sa.sa_handler = dispatch_sigchld;
+		sa.sa_flags = SA_RESTART | SA_NOCLDSTOP;
+		sigaction(SIGCHLD, &sa, NULL);
+	}
+}
+
+static struct dispatch_action *dispatch_find(struct dispatcher *d, const char *key)
+{
+	int i;
+
+	for (i = 0; i < d->count; i++)
+		if (!strcmp(d->actions[i].key, key))
+			return &d->actions[i];
+	return NULL;
+}
+
+/****************************************************************
+ * dispatch_add
+ ****************************************************************/
+struct dispatch_action *dispatch_add(struct dispatcher *d, const char *key, const char *path, unsigned int cooldown_ms)
+{
+	struct dispatch_action *a;
+
+	if (d->count == DISPATCH_MAX_ACTIONS)
+		return NULL;
+	a = &d->actions[d->count++];
+	memset(a, 0, sizeof(*a));
+	a->key = key;
+	a->path = path;
+	a->cooldown_ms = cooldown_ms;
+	return a;
+}
+
+/****************************************************************
+ * dispatch_run
+ *
+ * Returns 1 if the action was started, 0 if it was suppressed because
+ * it is still running or cooling down, -1 on error.
+ ****************************************************************/
+int dispatch_run(struct dispatcher *d, const char *key, uint64_t req_ns)
+{
+	struct dispatch_action *a = dispatch_find(d, key);
+	posix_spawnattr_t attr;
+	char *argv[2];
+	uint64_t now;
+	int ret;
+
+	if (!a)
+		return -1;
+
+	dispatch_reap(d);
+	now = rfid_now_ns();
+	if (a->pid || (a->completed && now - a->end_ns < (uint64_t)a->cooldown_ms * 1000000ull)) {
+		a->suppressed++;
+		return 0;
+	}
+
+	/* a no-op since glibc 2.24, whose posix_spawn always uses CLONE_VFORK */
+	posix_spawnattr_init(&attr);
+	posix_spawnattr_setflags(&attr, POSIX_SPAWN_USEVFORK);
+	argv[0] = (char *)a->path;
+	argv[1] = NULL;
+	ret = posix_spawn(&a->pid, a->path, NULL, &attr, argv, environ);
+	posix_spawnattr_destroy(&attr);
+	if (ret) {
+		errno = ret;
+		perror("dispatch/spawn");
+		a->pid = 0;
+		a->failed++;
+		return -1;
+	}
+
+	a->req_ns = req_ns ? req_ns : now;
+	a->start_ns = rfid_now_ns();
+	a->started++;
+	a->spawn_ns_total += a->start_ns - a->req_ns;
+	stats_hist_add(&a->spawn_us, (a->start_ns - a->req_ns) / 1000);
+	PROBE3(rfid, dispatch, a->key, a->pid, a->req_ns);
+	return 1;
+}
+
+/****************************************************************
+ * dispatch_reap
+ ****************************************************************/
+void dispatch_reap(struct dispatcher *d)
+{
+	int i, status;
+
+	for (i = 0; i < d->count; i++) {
+		struct dispatch_action *a = &d->actions[i];
+		uint64_t run;
+
+		if (!a->pid || waitpid(a->pid, &status, WNOHANG) != a->pid)
+			continue;
+
+		a->end_ns = rfid_now_ns();
+		run = a->end_ns - a->req_ns;
+		a->pid = 0;
+		if (!WIFEXITED(status) || WEXITSTATUS(status))
+			a->failed++;
+		else
+			stats_hist_add(&a->ready_us, run / 1000);
+		a->completed++;
+		a->run_ns_total += run;
+		a->run_ns_last = run;
+		if (run > a->run_ns_max)
+			a->run_ns_max = run;
+		if (d->verbose)
+			printf("action %s: %.1f ms (exit %d)\n", a->key, run / 1e6,
+			       WIFEXITED(status) ? WEXITSTATUS(status) : -1);
+	}
+}
+
+/****************************************************************
+ * dispatch_report
+ ****************************************************************/
+void dispatch_report(struct dispatcher *d, FILE *f)
+{
+	int i;
+
+	for (i = 0; i < d->count; i++) {
+		struct dispatch_action *a = &d->actions[i];
+
+		fprintf(f, "action %s: started %u suppressed %u failed %u completed %u"
+			" spawn avg %.2f ms run avg %.1f ms max %.1f ms\n",
+			a->key, a->started, a->suppressed, a->failed, a->completed,
+			a->started ? a->spawn_ns_total / 1e6 / a->started : 0.0,
+			a->completed ? a->run_ns_total / 1e6 / a->completed : 0.0,
+			a->run_ns_max / 1e6);
+	}
+}
+
+/****************************************************************
+ * dispatch_stats_dump
+ *
+ * stats section with the latency percentiles of every action.
+ ****************************************************************/
+void dispatch_stats_dump(FILE *fp, void *arg)
+{
+	struct dispatcher *d = arg;
+	int i;
+
+	dispatch_report(d, fp);
+	for (i = 0; i < d->count; i++) {
+		struct dispatch_action *a = &d->actions[i];
+
+		fprintf(fp, " %s\n", a->key);
+		stats_hist_print(&a->spawn_us, "spawn", "us", fp);
+		stats_hist_print(&a->ready_us, "ready", "us", fp);
+	}
+}
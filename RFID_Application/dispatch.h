@@ -0,0 +1,70 @@
+/*
+ * dispatch.h
+ *
+ * Action dispatcher. Actions (unlock script, video stream, ...) are started
+ * with posix_spawn, which glibc implements with clone(CLONE_VM |
+ * CLONE_VFORK) and so does not copy the reader's page tables, are reaped
+ * without blocking from the reader loop, and are deduplicated by key: an
+ * action is not started again while it is still running or within its
+ * cooldown after it exited, however long it ran.
+ *
+ * Every start carries the IRQ time of the read that asked for it, and an
+ * action counts as done (door unlocked) when its process exits with
+ * status 0; request -> done goes into a latency histogram per action.
+ * dispatch_init() installs an empty SIGCHLD handler so that the exit of a
+ * child interrupts the loop's epoll_wait/poll and dispatch_reap() sees it
+ * right away instead of at the next reader deadline.
+ */
+
+#ifndef DISPATCH_H_
+#define DISPATCH_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/types.h>
+
+#include "stats.h"
+
+#define DISPATCH_MAX_ACTIONS 8
+#define DISPATCH_DEFAULT_COOLDOWN_MS 3000
+
+struct dispatch_action {
+	const char *key;
+	const char *path;
+	unsigned int cooldown_ms;
+
+	pid_t pid;             /* running instance, 0 if none */
+	uint64_t req_ns;       /* CLOCK_MONOTONIC of the read that triggered it */
+	uint64_t start_ns;
+	uint64_t end_ns;       /* last exit, the cooldown runs from here */
+
+	/* statistics */
+	uint32_t started;
+	uint32_t suppressed;
+	uint32_t failed;
+	uint32_t completed;
+	uint64_t spawn_ns_total; /* request -> child created */
+	uint64_t run_ns_total;   /* request -> child exited */
+	uint64_t run_ns_max;
+	uint64_t run_ns_last;
+	struct stats_hist spawn_us;  /* request -> child created */
+	struct stats_hist ready_us;  /* request -> child exited with 0 */
+};
+
+struct dispatcher {
+	struct dispatch_action actions[DISPATCH_MAX_ACTIONS];
+	int count;
+	int verbose;
+};
+
+/****************************************************************
+ * dispatcher API
+ ****************************************************************/
+void dispatch_init(struct dispatcher *d);
+struct dispatch_action *dispatch_add(struct dispatcher *d, const char *key, const char *path, unsigned int cooldown_ms);
+int dispatch_run(struct dispatcher *d, const char *key, uint64_t req_ns);
+void dispatch_reap(struct dispatcher *d);
+void dispatch_report(struct dispatcher *d, FILE *f);
+void dispatch_stats_dump(FILE *fp, void *arg);
+
+#endif /* DISPATCH_H_ */
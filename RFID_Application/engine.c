@@ -0,0 +1,279 @@
+/*
+ * engine.c
+ *
+ * Reader event loop, see engine.h.
+ */
+
+#include "engine.h"
+#include "trf_emu.h"
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/eventfd.h>
+
+int engine_init(struct engine *e)
+{
+	struct epoll_event ee;
+
+	memset(e, 0, sizeof(*e));
+	e->timer_fd = -1;
+	e->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	e->epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (e->event_fd < 0 || e->epfd < 0) {
+		perror("engine/epoll");
+		goto err;
+	}
+	e->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (e->timer_fd < 0) {
+		perror("engine/timerfd");
+		goto err;
+	}
+	memset(&ee, 0, sizeof(ee));
+	ee.events = EPOLLIN;
+	ee.data.ptr = NULL;
+	if (epoll_ctl(e->epfd, EPOLL_CTL_ADD, e->timer_fd, &ee) < 0) {
+		perror("engine/timerfd");
+		goto err;
+	}
+	return 0;
+
+err:
+	engine_close(e);
+	return -1;
+}
+
+/* arm the cycle clock for the earliest deadline */
+static void engine_arm(struct engine *e, uint64_t at_ns)
+{
+	struct itimerspec its;
+
+	if (at_ns == e->armed_ns)
+		return;
+	e->armed_ns = at_ns;
+	memset(&its, 0, sizeof(its));
+	its.it_value.tv_sec = at_ns / 1000000000ull;
+	its.it_value.tv_nsec = at_ns % 1000000000ull;
+	if (!at_ns)
+		its.it_value.tv_nsec = 1; /* already due: fire at once */
+	if (timerfd_settime(e->timer_fd, TFD_TIMER_ABSTIME, &its, NULL) < 0)
+		perror("engine/timerfd_settime");
+}
+
+/* keep the cycle clock on the earliest reader deadline */
+static void engine_rearm(struct engine *e)
+{
+	uint64_t next = UINT64_MAX;
+	int i;
+
+	for (i = 0; i < e->nreaders; i++)
+		if (e->readers[i]->deadline_ns < next)
+			next = e->readers[i]->deadline_ns;
+	if (next != UINT64_MAX)
+		engine_arm(e, next);
+}
+
+/* on_read of readers without one: queue for engine_read() */
+static void engine_queue_read(struct reader *r, const struct rfid_event *ev, void *arg)
+{
+	struct engine *e = arg;
+	uint64_t one = 1;
+
+	if (e->head - e->tail == ENGINE_QUEUE_LEN) {
+		e->dropped++;
+		return;
+	}
+	e->queue[e->head++ & (ENGINE_QUEUE_LEN - 1)] = *ev;
+	if (write(e->event_fd, &one, sizeof(one)) < 0)
+		perror("engine/eventfd");
+}
+
+/****************************************************************
+ * engine_add
+ *
+ * Watches the reader's IRQ line and starts its first cycle.
+ ****************************************************************/
+int engine_add(struct engine *e, struct reader *r, uint64_t now_ns)
+{
+	struct epoll_event ee;
+
+	if (e->nreaders == READER_MAX)
+		return -1;
+	if (!r->on_read) {
+		r->on_read = engine_queue_read;
+		r->arg = e;
+	}
+	memset(&ee, 0, sizeof(ee));
+	ee.events = reader_get_events(r);
+	ee.data.ptr = r;
+	if (epoll_ctl(e->epfd, EPOLL_CTL_ADD, reader_get_fd(r), &ee) < 0) {
+		perror("engine/irq line");
+		return -1;
+	}
+	e->readers[e->nreaders++] = r;
+	reader_start_inventory(r, now_ns);
+	engine_rearm(e);
+	return 0;
+}
+
+/****************************************************************
+ * engine_run_once
+ *
+ * Waits for the next IRQ or deadline (at most max_wait_ms) and runs
+ * the readers. Returns the number of IRQ events, or -1 on error.
+ ****************************************************************/
+int engine_run_once(struct engine *e, int max_wait_ms)
+{
+	struct epoll_event events[READER_MAX + 1];
+	uint64_t now, expirations;
+	int n, i, irqs = 0;
+
+	engine_rearm(e);
+	n = epoll_wait(e->epfd, events, READER_MAX + 1, max_wait_ms);
+	if (n < 0) {
+		if (errno == EINTR)
+			return 0;
+		perror("engine/epoll_wait");
+		return -1;
+	}
+	e->wakeups++;
+
+	now = rfid_now_ns();
+	for (i = 0; i < n; i++) {
+		if (!events[i].data.ptr) {
+			if (read(e->timer_fd, &expirations, sizeof(expirations)) > 0)
+				e->armed_ns = 0;
+			continue;
+		}
+		reader_irq(events[i].data.ptr, now);
+		irqs++;
+	}
+
+	for (i = 0; i < e->nreaders; i++) {
+		struct reader *r = e->readers[i];
+
+		if (r->deadline_ns <= now) {
+			if (now - r->deadline_ns > ENGINE_LATE_US * 1000ull)
+				e->missed++;
+			if (r->state == READER_IDLE)
+				stats_hist_add(&e->jitter, (now - r->deadline_ns) / 1000);
+			reader_timer(r, now);
+			now = rfid_now_ns();
+		}
+	}
+	/* armed for the caller's own poll() as well */
+	engine_rearm(e);
+	return irqs;
+}
+
+/****************************************************************
+ * engine_next_ns
+ *
+ * Virtual clock: when the readers need to run next, the earliest
+ * deadline or pending emulated IRQ; UINT64_MAX if none.
+ ****************************************************************/
+uint64_t engine_next_ns(const struct engine *e)
+{
+	uint64_t next = UINT64_MAX;
+	int i;
+
+	for (i = 0; i < e->nreaders; i++) {
+		const struct reader *r = e->readers[i];
+
+		if (r->deadline_ns < next)
+			next = r->deadline_ns;
+		if (r->emu && r->emu->armed_ns && r->emu->armed_ns < next)
+			next = r->emu->armed_ns;
+	}
+	return next;
+}
+
+/****************************************************************
+ * engine_step
+ *
+ * Virtual clock: runs the IRQs and deadlines due at now_ns, which the
+ * caller advances to engine_next_ns() instead of sleeping on epoll.
+ * The readers must be emulated with emu_field.clock set.
+ ****************************************************************/
+void engine_step(struct engine *e, uint64_t now_ns)
+{
+	int i;
+
+	e->wakeups++;
+	for (i = 0; i < e->nreaders; i++) {
+		struct reader *r = e->readers[i];
+
+		if (r->emu && r->emu->armed_ns && r->emu->armed_ns <= now_ns)
+			reader_irq(r, now_ns);
+	}
+	for (i = 0; i < e->nreaders; i++)
+		if (e->readers[i]->deadline_ns <= now_ns)
+			reader_timer(e->readers[i], now_ns);
+}
+
+int engine_get_fd(const struct engine *e)
+{
+	return e->epfd;
+}
+
+int engine_get_event_fd(const struct engine *e)
+{
+	return e->event_fd;
+}
+
+/****************************************************************
+ * engine_read
+ *
+ * Takes the oldest queued read. Returns 1, or 0 if none is waiting;
+ * the eventfd is cleared once the queue is empty.
+ ****************************************************************/
+int engine_read(struct engine *e, struct rfid_event *ev)
+{
+	uint64_t count;
+
+	if (e->head == e->tail) {
+		if (read(e->event_fd, &count, sizeof(count)) < 0)
+			count = 0;
+		return 0;
+	}
+	*ev = e->queue[e->tail++ & (ENGINE_QUEUE_LEN - 1)];
+	return 1;
+}
+
+/****************************************************************
+ * engine_report
+ ****************************************************************/
+void engine_report(const struct engine *e, FILE *fp)
+{
+	int i;
+
+	fprintf(fp, "engine: %u wakeups, %u deadlines missed by more than %u us, %u reads dropped\n",
+		e->wakeups, e->missed, ENGINE_LATE_US, e->dropped);
+	for (i = 0; i < e->nreaders; i++) {
+		const struct reader *r = e->readers[i];
+
+		fprintf(fp, "  reader %d: %u cycles, %u reads, %u timeouts, %u overruns (%u periods skipped)\n",
+			r->id, r->cycles, r->reads, r->timeouts, r->overruns, r->skipped);
+	}
+	stats_hist_print(&e->jitter, "start jitter", "us", fp);
+}
+
+void engine_close(struct engine *e)
+{
+	int i;
+
+	for (i = 0; i < e->nreaders; i++)
+		reader_close(e->readers[i]);
+	e->nreaders = 0;
+	if (e->timer_fd >= 0)
+		close(e->timer_fd);
+	if (e->event_fd >= 0)
+		close(e->event_fd);
+	if (e->epfd >= 0)
+		close(e->epfd);
+	e->timer_fd = -1;
+	e->event_fd = -1;
+	e->epfd = -1;
+}
@@ -0,0 +1,67 @@
+/*
+ * engine.h
+ *
+ * The epoll loop that drives a set of readers: IRQ fds wake the matching
+ * reader, and a timerfd armed with TFD_TIMER_ABSTIME at the earliest reader
+ * deadline wakes the loop exactly on time, with no millisecond rounding of
+ * the epoll timeout and no drift from the loop's own work. Shared by the
+ * daemon and the offline simulator so both run the exact same code path.
+ *
+ * A deadline served more than ENGINE_LATE_US late counts as missed.
+ *
+ * Reads are delivered to the reader's on_read callback, or, for readers
+ * added without one, queued in the engine for engine_read() with the
+ * eventfd from engine_get_event_fd() signalling that reads are waiting.
+ * An application with its own event loop watches engine_get_fd() (the
+ * epoll fd, readable whenever an IRQ or a deadline is due) and calls
+ * engine_run_once(e, 0) when it fires: no extra thread, no busy wait.
+ *
+ * Emulated readers on a virtual clock (see trf_emu.h) are run with
+ * engine_step() at the times engine_next_ns() returns instead, so a
+ * simulation does not wait for real timers (see rfid_fleet.c).
+ */
+
+#ifndef ENGINE_H_
+#define ENGINE_H_
+
+#include "reader.h"
+
+#define ENGINE_MAX_WAIT_MS 1000
+#define ENGINE_LATE_US 1000
+#define ENGINE_QUEUE_LEN 64        /* power of two */
+
+struct engine {
+	int epfd;
+	int timer_fd;
+	uint64_t armed_ns;
+	struct reader *readers[READER_MAX];
+	int nreaders;
+
+	/* pull API */
+	int event_fd;
+	struct rfid_event queue[ENGINE_QUEUE_LEN];
+	uint32_t head;
+	uint32_t tail;
+
+	/* statistics */
+	struct stats_hist jitter;  /* lateness of cycle starts, us */
+	uint32_t wakeups;
+	uint32_t missed;           /* deadlines served more than ENGINE_LATE_US late */
+	uint32_t dropped;          /* queued reads lost to a full queue */
+};
+
+/****************************************************************
+ * engine API
+ ****************************************************************/
+int engine_init(struct engine *e);
+int engine_add(struct engine *e, struct reader *r, uint64_t now_ns);
+int engine_run_once(struct engine *e, int max_wait_ms);
+uint64_t engine_next_ns(const struct engine *e);
+void engine_step(struct engine *e, uint64_t now_ns);
+int engine_get_fd(const struct engine *e);
+int engine_get_event_fd(const struct engine *e);
+int engine_read(struct engine *e, struct rfid_event *ev);
+void engine_report(const struct engine *e, FILE *fp);
+void engine_close(struct engine *e);
+
+#endif /* ENGINE_H_ */
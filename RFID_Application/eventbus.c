@@ -0,0 +1,340 @@
+/*
+ * eventbus.c
+ *
+ * Shared-memory read-event bus, see eventbus.h.
+ *
+ * Single writer. Each slot carries a sequence word that is cleared while
+ * the event is being written and set to event number + 1 afterwards, so a
+ * consumer can detect a slot that was overwritten under it and count the
+ * event as lost.
+ */
+
+#include "eventbus.h"
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+static long futex(const uint32_t *addr, int op, uint32_t val, const struct timespec *ts)
+{
+	return syscall(SYS_futex, addr, op, val, ts, NULL, 0);
+}
+
+/* tells attached consumers to re-attach by name */
+static void bus_bump(struct bus_hdr *hdr)
+{
+	__atomic_add_fetch(&hdr->epoch, 1, __ATOMIC_SEQ_CST);
+	__atomic_add_fetch(&hdr->futex, 1, __ATOMIC_SEQ_CST);
+	futex(&hdr->futex, FUTEX_WAKE, INT_MAX, NULL);
+}
+
+/****************************************************************
+ * bus_create
+ *
+ * Reuses a segment of the same layout left by a previous publisher, so
+ * its consumers keep their cursors; replaces any other.
+ ****************************************************************/
+int bus_create(struct bus *b, const char *name, uint32_t capacity)
+{
+	struct bus_hdr *old;
+	struct stat st;
+
+	memset(b, 0, sizeof(*b));
+	if (!capacity || (capacity & (capacity - 1))) {
+		fprintf(stderr, "bus: capacity %u is not a power of two\n", capacity);
+		return -1;
+	}
+	snprintf(b->name, sizeof(b->name), "%s", name);
+	b->map_len = sizeof(struct bus_hdr) + (uint64_t)capacity * sizeof(struct bus_slot);
+
+	b->fd = shm_open(name, O_RDWR | O_CLOEXEC, 0);
+	if (b->fd >= 0) {
+		if (fstat(b->fd, &st) == 0 && st.st_size >= (off_t)sizeof(struct bus_hdr)) {
+			old = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, b->fd, 0);
+			if (old != MAP_FAILED) {
+				if ((uint64_t)st.st_size == b->map_len &&
+				    __atomic_load_n(&old->magic, __ATOMIC_ACQUIRE) == BUS_MAGIC &&
+				    old->capacity == capacity &&
+				    old->slot_size == sizeof(struct bus_slot)) {
+					b->hdr = old;
+					b->slots = (struct bus_slot *)(b->hdr + 1);
+					b->hdr->version = BUS_VERSION;
+					bus_bump(b->hdr);
+					return 0;
+				}
+				/* unlinked first, so a re-attach cannot find it again */
+				shm_unlink(name);
+				bus_bump(old);
+				munmap(old, st.st_size);
+			}
+		}
+		close(b->fd);
+		shm_unlink(name);
+	}
+
+	b->fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+	if (b->fd < 0) {
+		perror("bus/shm_open");
+		return -1;
+	}
+	if (ftruncate(b->fd, b->map_len) < 0) {
+		perror("bus/ftruncate");
+		goto err;
+	}
+	b->hdr = mmap(NULL, b->map_len, PROT_READ | PROT_WRITE, MAP_SHARED, b->fd, 0);
+	if (b->hdr == MAP_FAILED) {
+		perror("bus/mmap");
+		goto err;
+	}
+	b->slots = (struct bus_slot *)(b->hdr + 1);
+
+	b->hdr->version = BUS_VERSION;
+	b->hdr->capacity = capacity;
+	b->hdr->slot_size = sizeof(struct bus_slot);
+	b->hdr->epoch = 1;
+	__atomic_store_n(&b->hdr->magic, BUS_MAGIC, __ATOMIC_RELEASE);
+	return 0;
+
+err:
+	close(b->fd);
+	shm_unlink(name);
+	b->fd = -1;
+	b->hdr = NULL;
+	return -1;
+}
+
+/****************************************************************
+ * bus_publish
+ ****************************************************************/
+void bus_publish(struct bus *b, const struct rfid_event *ev)
+{
+	uint64_t n;
+	struct bus_slot *slot;
+
+	if (!b->hdr)
+		return;
+
+	n = b->hdr->head;
+	slot = &b->slots[n & (b->hdr->capacity - 1)];
+
+	__atomic_store_n(&slot->seq, 0, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	slot->ev = *ev;
+	slot->ev.seq = (uint32_t)n;
+	__atomic_store_n(&slot->seq, n + 1, __ATOMIC_RELEASE);
+	__atomic_store_n(&b->hdr->head, n + 1, __ATOMIC_SEQ_CST);
+
+	__atomic_add_fetch(&b->hdr->futex, 1, __ATOMIC_SEQ_CST);
+	futex(&b->hdr->futex, FUTEX_WAKE, INT_MAX, NULL);
+}
+
+void bus_destroy(struct bus *b)
+{
+	if (b->hdr) {
+		shm_unlink(b->name);
+		bus_bump(b->hdr);
+		munmap(b->hdr, b->map_len);
+		b->hdr = NULL;
+	}
+	if (b->fd >= 0)
+		close(b->fd);
+	b->fd = -1;
+}
+
+/* maps r->name; quiet while re-attaching, the name may be gone for a while */
+static int bus_map(struct bus_reader *r, int quiet)
+{
+	struct stat st;
+
+	r->fd = shm_open(r->name, O_RDONLY | O_CLOEXEC, 0);
+	if (r->fd < 0) {
+		if (!quiet)
+			perror("bus/shm_open");
+		return -1;
+	}
+	if (fstat(r->fd, &st) < 0 || st.st_size < (off_t)sizeof(struct bus_hdr)) {
+		if (!quiet)
+			fprintf(stderr, "bus: %s is not initialised\n", r->name);
+		goto err;
+	}
+	r->map_len = st.st_size;
+	r->hdr = mmap(NULL, r->map_len, PROT_READ, MAP_SHARED, r->fd, 0);
+	if (r->hdr == MAP_FAILED) {
+		if (!quiet)
+			perror("bus/mmap");
+		goto err;
+	}
+	if (__atomic_load_n(&r->hdr->magic, __ATOMIC_ACQUIRE) != BUS_MAGIC ||
+	    r->hdr->slot_size != sizeof(struct bus_slot) ||
+	    sizeof(struct bus_hdr) + (uint64_t)r->hdr->capacity * r->hdr->slot_size > r->map_len) {
+		if (!quiet)
+			fprintf(stderr, "bus: %s has an incompatible layout\n", r->name);
+		munmap((void *)r->hdr, r->map_len);
+		goto err;
+	}
+	r->slots = (const struct bus_slot *)(r->hdr + 1);
+	r->epoch = __atomic_load_n(&r->hdr->epoch, __ATOMIC_ACQUIRE);
+	return 0;
+
+err:
+	close(r->fd);
+	r->fd = -1;
+	r->hdr = NULL;
+	return -1;
+}
+
+/****************************************************************
+ * bus_attach
+ ****************************************************************/
+int bus_attach(struct bus_reader *r, const char *name)
+{
+	memset(r, 0, sizeof(*r));
+	snprintf(r->name, sizeof(r->name), "%s", name);
+	if (bus_map(r, 0) < 0)
+		return -1;
+	r->cursor = __atomic_load_n(&r->hdr->head, __ATOMIC_ACQUIRE);
+	return 0;
+}
+
+/*
+ * After an epoch change: maps the segment now behind the name. The cursor
+ * is kept on the same segment and starts over on a new one. Returns -1,
+ * still on the old mapping, while the name is not (yet) there.
+ */
+static int bus_reattach(struct bus_reader *r)
+{
+	struct bus_reader n = *r;
+	struct stat old_st, new_st;
+
+	if (bus_map(&n, 1) < 0)
+		return -1;
+	if (fstat(r->fd, &old_st) < 0 || fstat(n.fd, &new_st) < 0 ||
+	    old_st.st_ino != new_st.st_ino || old_st.st_dev != new_st.st_dev ||
+	    __atomic_load_n(&n.hdr->head, __ATOMIC_ACQUIRE) < n.cursor)
+		n.cursor = 0;
+	n.reattaches++;
+	bus_detach(r);
+	*r = n;
+	return 0;
+}
+
+/****************************************************************
+ * bus_read
+ *
+ * Returns 1 and fills ev if an event was available, 0 otherwise.
+ ****************************************************************/
+int bus_read(struct bus_reader *r, struct rfid_event *ev)
+{
+	uint32_t cap = r->hdr->capacity;
+
+	for (;;) {
+		uint64_t head = __atomic_load_n(&r->hdr->head, __ATOMIC_ACQUIRE);
+		const struct bus_slot *slot;
+		uint64_t s1, s2;
+
+		if (r->cursor >= head)
+			return 0;
+		if (head - r->cursor > cap) {
+			r->lost += head - cap - r->cursor;
+			r->cursor = head - cap;
+		}
+
+		slot = &r->slots[r->cursor & (cap - 1)];
+		s1 = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+		if (s1 == r->cursor + 1) {
+			*ev = slot->ev;
+			__atomic_thread_fence(__ATOMIC_ACQUIRE);
+			s2 = __atomic_load_n(&slot->seq, __ATOMIC_RELAXED);
+			if (s2 == s1) {
+				r->cursor++;
+				return 1;
+			}
+		}
+		/*
+		 * The event was published (it is below head), so the slot is
+		 * being or has been rewritten by a lap of the writer: the event
+		 * is gone. Skipping it rather than retrying also keeps a writer
+		 * stopped in the middle of a publish from spinning us.
+		 */
+		r->lost++;
+		r->cursor++;
+	}
+}
+
+static uint64_t bus_now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000ull + ts.tv_nsec / 1000000;
+}
+
+/****************************************************************
+ * bus_wait
+ *
+ * Blocks until an event is readable or timeout_ms passes (-1 waits
+ * forever), re-attaching when the publisher restarts or exits. Returns
+ * 1 when readable, 0 on timeout, -1 on error.
+ ****************************************************************/
+int bus_wait(struct bus_reader *r, int timeout_ms)
+{
+	uint64_t deadline = timeout_ms >= 0 ? bus_now_ms() + timeout_ms : 0;
+	struct timespec ts, *tsp;
+	uint64_t now = 0, left;
+	uint32_t val;
+
+	for (;;) {
+		tsp = NULL;
+		left = BUS_REATTACH_MS;
+		if (timeout_ms >= 0) {
+			now = bus_now_ms();
+			if (now >= deadline)
+				return 0;
+			if (deadline - now < left)
+				left = deadline - now;
+		}
+
+		val = __atomic_load_n(&r->hdr->futex, __ATOMIC_SEQ_CST);
+		if (__atomic_load_n(&r->hdr->epoch, __ATOMIC_SEQ_CST) != r->epoch) {
+			if (bus_reattach(r) == 0)
+				continue;
+			ts.tv_sec = left / 1000;
+			ts.tv_nsec = (left % 1000) * 1000000L;
+			nanosleep(&ts, NULL);
+			continue;
+		}
+		if (__atomic_load_n(&r->hdr->head, __ATOMIC_SEQ_CST) > r->cursor)
+			return 1;
+
+		if (timeout_ms >= 0) {
+			ts.tv_sec = (deadline - now) / 1000;
+			ts.tv_nsec = ((deadline - now) % 1000) * 1000000L;
+			tsp = &ts;
+		}
+		if (futex(&r->hdr->futex, FUTEX_WAIT, val, tsp) < 0) {
+			if (errno == ETIMEDOUT)
+				return 0;
+			if (errno != EAGAIN && errno != EINTR) {
+				perror("bus/futex");
+				return -1;
+			}
+		}
+	}
+}
+
+void bus_detach(struct bus_reader *r)
+{
+	if (r->hdr)
+		munmap((void *)r->hdr, r->map_len);
+	if (r->fd >= 0)
+		close(r->fd);
+	r->hdr = NULL;
+	r->fd = -1;
+}
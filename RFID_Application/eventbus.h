@@ -0,0 +1,89 @@
+/*
+ * eventbus.h
+ *
+ * Shared-memory read-event bus. The reader publishes every event into a
+ * POSIX shm ring (/dev/shm/rfid_events by default); any number of local
+ * consumers map it read-only, each with its own cursor, and sleep on a
+ * futex in the shared header until something is published. The publisher
+ * never waits for consumers: a consumer that falls more than one ring
+ * behind skips ahead and has the gap added to its lost count.
+ *
+ * A restarted publisher reuses the segment when its layout still matches
+ * and carries on from the old head; otherwise it unlinks it and creates a
+ * new one. Either way it bumps the epoch in the header, as it does when
+ * it exits, and bus_wait then re-attaches by name (waiting for the name to
+ * come back if the publisher is gone), so consumers outlive restarts.
+ *
+ * Consumer side:
+ *
+ *	struct bus_reader r;
+ *	struct rfid_event ev;
+ *
+ *	bus_attach(&r, BUS_DEFAULT_NAME);
+ *	while (bus_wait(&r, -1) >= 0)
+ *		while (bus_read(&r, &ev) > 0)
+ *			handle(&ev);
+ */
+
+#ifndef EVENTBUS_H_
+#define EVENTBUS_H_
+
+#include "rfid_event.h"
+
+#define BUS_DEFAULT_NAME "/rfid_events"
+#define BUS_DEFAULT_CAPACITY 1024 /* events, power of two */
+#define BUS_MAGIC 0x52464942u     /* "RFIB" */
+#define BUS_VERSION 2
+#define BUS_REATTACH_MS 100     /* retry of a re-attach while the name is gone */
+
+struct bus_slot {
+	uint64_t seq;          /* event number + 1 once written, 0 while writing */
+	struct rfid_event ev;
+};
+
+struct bus_hdr {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t capacity;
+	uint32_t slot_size;
+	uint64_t head;         /* number of events ever published */
+	uint32_t futex;        /* bumped on every publish */
+	uint32_t epoch;        /* bumped on every create and destroy */
+};
+
+struct bus {
+	int fd;
+	uint64_t map_len;
+	struct bus_hdr *hdr;
+	struct bus_slot *slots;
+	char name[64];
+};
+
+struct bus_reader {
+	int fd;
+	uint64_t map_len;
+	const struct bus_hdr *hdr;
+	const struct bus_slot *slots;
+	uint64_t cursor;
+	uint64_t lost;
+	uint32_t epoch;        /* of the header when attached */
+	uint32_t reattaches;
+	char name[64];
+};
+
+/****************************************************************
+ * publisher
+ ****************************************************************/
+int bus_create(struct bus *b, const char *name, uint32_t capacity);
+void bus_publish(struct bus *b, const struct rfid_event *ev);
+void bus_destroy(struct bus *b);
+
+/****************************************************************
+ * consumer
+ ****************************************************************/
+int bus_attach(struct bus_reader *r, const char *name);
+int bus_read(struct bus_reader *r, struct rfid_event *ev);
+int bus_wait(struct bus_reader *r, int timeout_ms);
+void bus_detach(struct bus_reader *r);
+
+#endif /* EVENTBUS_H_ */
@@ -0,0 +1,250 @@
+/*
+ * evsock.c
+ *
+ * Unix-domain socket event stream, see evsock.h.
+ *
+ * All sockets are non-blocking; evsock_service() is called once per
+ * reader cycle to accept clients, pick up subscriptions and flush every
+ * queue as frames of up to EVSOCK_MAX_BATCH events.
+ */
+
+#define _GNU_SOURCE
+#include "evsock.h"
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+static void evsock_drop_client(struct evsock_client *c)
+{
+	close(c->fd);
+	c->fd = -1;
+}
+
+/****************************************************************
+ * evsock_listen
+ ****************************************************************/
+int evsock_listen(struct evsock *s, const char *path)
+{
+	struct sockaddr_un addr;
+	int i;
+
+	memset(s, 0, sizeof(*s));
+	for (i = 0; i < EVSOCK_MAX_CLIENTS; i++)
+		s->clients[i].fd = -1;
+	snprintf(s->path, sizeof(s->path), "%s", path);
+
+	s->listen_fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (s->listen_fd < 0) {
+		perror("evsock/socket");
+		return -1;
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", path);
+	unlink(path);
+	if (bind(s->listen_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+	    listen(s->listen_fd, 8) < 0) {
+		perror("evsock/bind");
+		close(s->listen_fd);
+		s->listen_fd = -1;
+		return -1;
+	}
+	return 0;
+}
+
+static int evsock_match(const struct evsock_sub *sub, const struct rfid_event *ev)
+{
+	if (sub->type_mask && !(sub->type_mask & EVSOCK_TYPE_BIT(ev->type)))
+		return 0;
+	if ((ev->flags & RFID_EVF_RSSI_VALID) && ev->rssi < sub->min_rssi)
+		return 0;
+	return !memcmp(ev->uid, sub->prefix, sub->prefix_len);
+}
+
+/****************************************************************
+ * evsock_publish
+ ****************************************************************/
+void evsock_publish(struct evsock *s, const struct rfid_event *ev)
+{
+	int i;
+	unsigned int k;
+
+	for (i = 0; i < EVSOCK_MAX_CLIENTS; i++) {
+		struct evsock_client *c = &s->clients[i];
+
+		if (c->fd < 0 || !evsock_match(&c->sub, ev))
+			continue;
+
+		if (c->len < EVSOCK_QUEUE_LEN) {
+			c->queue[(c->head + c->len++) % EVSOCK_QUEUE_LEN] = *ev;
+			continue;
+		}
+
+		/* full: coalesce repeated reads of the same tag, drop the rest */
+		if (ev->type == RFID_EV_READ) {
+			for (k = 0; k < c->len; k++) {
+				struct rfid_event *q = &c->queue[(c->head + k) % EVSOCK_QUEUE_LEN];
+
+				if (q->type == RFID_EV_READ && !memcmp(q->uid, ev->uid, sizeof(q->uid))) {
+					*q = *ev;
+					c->coalesced++;
+					break;
+				}
+			}
+			if (k < c->len)
+				continue;
+		}
+		c->dropped++;
+	}
+}
+
+static void evsock_flush(struct evsock_client *c)
+{
+	struct {
+		struct evsock_frame hdr;
+		struct rfid_event ev[EVSOCK_MAX_BATCH];
+	} frame;
+	unsigned int n, k;
+
+	while (c->len || c->dropped) {
+		n = c->len < EVSOCK_MAX_BATCH ? c->len : EVSOCK_MAX_BATCH;
+		for (k = 0; k < n; k++)
+			frame.ev[k] = c->queue[(c->head + k) % EVSOCK_QUEUE_LEN];
+		frame.hdr.count = n;
+		frame.hdr.pad = 0;
+		frame.hdr.dropped = c->dropped;
+
+		if (send(c->fd, &frame, sizeof(frame.hdr) + n * sizeof(frame.ev[0]),
+			 MSG_DONTWAIT | MSG_NOSIGNAL) < 0) {
+			if (errno != EAGAIN && errno != EWOULDBLOCK)
+				evsock_drop_client(c);
+			return;
+		}
+		c->head = (c->head + n) % EVSOCK_QUEUE_LEN;
+		c->len -= n;
+		c->dropped = 0;
+	}
+}
+
+/****************************************************************
+ * evsock_service
+ ****************************************************************/
+void evsock_service(struct evsock *s)
+{
+	struct evsock_sub sub;
+	ssize_t len;
+	int fd, i;
+
+	if (s->listen_fd < 0)
+		return;
+
+	while ((fd = accept4(s->listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+		for (i = 0; i < EVSOCK_MAX_CLIENTS; i++)
+			if (s->clients[i].fd < 0)
+				break;
+		if (i == EVSOCK_MAX_CLIENTS) {
+			close(fd);
+			continue;
+		}
+		memset(&s->clients[i], 0, sizeof(s->clients[i]));
+		s->clients[i].fd = fd;
+	}
+
+	for (i = 0; i < EVSOCK_MAX_CLIENTS; i++) {
+		struct evsock_client *c = &s->clients[i];
+
+		if (c->fd < 0)
+			continue;
+
+		while ((len = recv(c->fd, &sub, sizeof(sub), MSG_DONTWAIT)) > 0) {
+			if (len == sizeof(sub) && sub.magic == EVSOCK_SUB_MAGIC && sub.prefix_len <= 8)
+				c->sub = sub;
+		}
+		if (len == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+			evsock_drop_client(c);
+			continue;
+		}
+		evsock_flush(c);
+	}
+}
+
+void evsock_close(struct evsock *s)
+{
+	int i;
+
+	for (i = 0; i < EVSOCK_MAX_CLIENTS; i++)
+		if (s->clients[i].fd >= 0)
+			evsock_drop_client(&s->clients[i]);
+	if (s->listen_fd >= 0) {
+		close(s->listen_fd);
+		unlink(s->path);
+	}
+	s->listen_fd = -1;
+}
+
+/****************************************************************
+ * evsock_connect
+ ****************************************************************/
+int evsock_connect(const char *path, const struct evsock_sub *sub)
+{
+	struct sockaddr_un addr;
+	int fd;
+
+	fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+	if (fd < 0) {
+		perror("evsock/socket");
+		return -1;
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", path);
+	if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		perror("evsock/connect");
+		close(fd);
+		return -1;
+	}
+
+	if (sub && send(fd, sub, sizeof(*sub), MSG_NOSIGNAL) < 0) {
+		perror("evsock/subscribe");
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+/****************************************************************
+ * evsock_recv
+ *
+ * Receives one frame. Returns the number of events stored in ev (at
+ * most max, 0 for a frame that only reports drops), -1 on error or end
+ * of stream.
+ ****************************************************************/
+int evsock_recv(int fd, struct rfid_event *ev, int max, uint32_t *dropped)
+{
+	struct {
+		struct evsock_frame hdr;
+		struct rfid_event ev[EVSOCK_MAX_BATCH];
+	} frame;
+	ssize_t len;
+	int n;
+
+	len = recv(fd, &frame, sizeof(frame), 0);
+	if (len < (ssize_t)sizeof(frame.hdr))
+		return -1;
+
+	n = (len - sizeof(frame.hdr)) / sizeof(frame.ev[0]);
+	if (n > frame.hdr.count)
+		n = frame.hdr.count;
+	if (n > max)
+		n = max;
+	memcpy(ev, frame.ev, n * sizeof(frame.ev[0]));
+	if (dropped)
+		*dropped = frame.hdr.dropped;
+	return n;
+}
@@ -0,0 +1,74 @@
+/*
+ * evsock.h
+ *
+ * Unix-domain SOCK_SEQPACKET event stream. Clients connect to the reader's
+ * socket, optionally send a struct evsock_sub to filter the stream (resend
+ * at any time to change it) and then receive one frame per batch:
+ *
+ *	struct evsock_frame | struct rfid_event[count]
+ *
+ * Every client has a bounded queue. The reader never blocks on a client:
+ * when a queue is full a READ for a UID that is already queued replaces
+ * the queued one, anything else is dropped and reported in the next
+ * frame's dropped count.
+ */
+
+#ifndef EVSOCK_H_
+#define EVSOCK_H_
+
+#include "rfid_event.h"
+
+#define EVSOCK_DEFAULT_PATH "/var/run/rfid.sock"
+#define EVSOCK_MAX_CLIENTS 16
+#define EVSOCK_QUEUE_LEN 256
+#define EVSOCK_MAX_BATCH 64
+#define EVSOCK_SUB_MAGIC 0x53554231u /* "SUB1" */
+
+#define EVSOCK_TYPE_BIT(t) (1u << (t))
+
+struct evsock_sub {
+	uint32_t magic;
+	uint32_t type_mask;    /* EVSOCK_TYPE_BIT()s, 0 = all types */
+	uint8_t min_rssi;
+	uint8_t prefix_len;    /* leading UID bytes that must match, 0..8 */
+	uint8_t prefix[8];
+	uint16_t pad;
+};
+
+struct evsock_frame {
+	uint16_t count;
+	uint16_t pad;
+	uint32_t dropped;      /* events dropped for this client since the last frame */
+};
+
+struct evsock_client {
+	int fd;
+	struct evsock_sub sub;
+	struct rfid_event queue[EVSOCK_QUEUE_LEN];
+	unsigned int head;
+	unsigned int len;
+	uint32_t dropped;
+	uint32_t coalesced;
+};
+
+struct evsock {
+	int listen_fd;
+	struct evsock_client clients[EVSOCK_MAX_CLIENTS];
+	char path[108];
+};
+
+/****************************************************************
+ * server
+ ****************************************************************/
+int evsock_listen(struct evsock *s, const char *path);
+void evsock_publish(struct evsock *s, const struct rfid_event *ev);
+void evsock_service(struct evsock *s);
+void evsock_close(struct evsock *s);
+
+/****************************************************************
+ * client
+ ****************************************************************/
+int evsock_connect(const char *path, const struct evsock_sub *sub);
+int evsock_recv(int fd, struct rfid_event *ev, int max, uint32_t *dropped);
+
+#endif /* EVSOCK_H_ */
@@ -0,0 +1,770 @@
+/*
+ * history.c
+ *
+ * Indexed read history, see history.h.
+ *
+ * The daemon thread only appends to the active segment. The background
+ * thread (or rfid_history -C) seals, merges and expires segments; every
+ * segment it writes goes to <name>.tmp first and is renamed into place
+ * before its inputs are unlinked, so a crash leaves either the inputs or
+ * the result (and, for a moment, both: queries may then report a record
+ * twice).
+ *
+ * Event times are CLOCK_MONOTONIC; they are converted with an offset to
+ * CLOCK_REALTIME that is refreshed on every sync. Merged reads can arrive
+ * slightly out of order, so a record may belong to the hour before its
+ * segment: a sealed segment's header spans all of its records, and queries
+ * look HISTORY_SLACK_S beyond their range when choosing segments by name.
+ */
+
+#include "history.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define NS_PER_S 1000000000ull
+#define HISTORY_SLACK_S 60
+
+struct history_file {
+	uint64_t start_s;
+	uint64_t end_s;
+	int active;
+	char name[48];
+};
+
+static uint64_t clock_ns(clockid_t clk)
+{
+	struct timespec ts;
+
+	clock_gettime(clk, &ts);
+	return (uint64_t)ts.tv_sec * NS_PER_S + ts.tv_nsec;
+}
+
+static uint64_t history_uid_hash(const uint8_t uid[8])
+{
+	uint64_t v;
+
+	memcpy(&v, uid, sizeof(v));
+	v ^= v >> 33;
+	v *= 0xFF51AFD7ED558CCDull;
+	v ^= v >> 33;
+	v *= 0xC4CEB9FE1A85EC53ull;
+	v ^= v >> 33;
+	return v;
+}
+
+/* bit i of the k bloom bits of a UID: double hashing */
+static uint32_t history_bloom_bit(uint64_t hash, int i, uint32_t bits)
+{
+	uint32_t h1 = hash, h2 = (hash >> 32) | 1;
+
+	return (h1 + i * h2) & (bits - 1);
+}
+
+static int history_rec_cmp(const void *a, const void *b)
+{
+	const struct history_rec *x = a, *y = b;
+
+	if (x->ts_ns != y->ts_ns)
+		return x->ts_ns < y->ts_ns ? -1 : 1;
+	return memcmp(x->uid, y->uid, sizeof(x->uid));
+}
+
+static int history_uid_cmp(const void *a, const void *b)
+{
+	const struct history_uid *x = a, *y = b;
+	int c = memcmp(x->uid, y->uid, sizeof(x->uid));
+
+	if (c)
+		return c;
+	return x->rec < y->rec ? -1 : x->rec > y->rec;
+}
+
+static int history_file_cmp(const void *a, const void *b)
+{
+	const struct history_file *x = a, *y = b;
+
+	if (x->start_s != y->start_s)
+		return x->start_s < y->start_s ? -1 : 1;
+	return x->end_s < y->end_s ? -1 : x->end_s > y->end_s;
+}
+
+/* segment files of dir sorted by start; returns the count or -1 */
+static int history_list(const char *dir, struct history_file **files)
+{
+	struct history_file *f = NULL, *nf;
+	unsigned long long a, b;
+	struct dirent *de;
+	int n = 0, cap = 0, len;
+	DIR *d;
+
+	*files = NULL;
+	d = opendir(dir);
+	if (!d) {
+		perror(dir);
+		return -1;
+	}
+	while ((de = readdir(d))) {
+		struct history_file e;
+
+		memset(&e, 0, sizeof(e));
+		len = 0;
+		if (sscanf(de->d_name, "%llu-%llu.hst%n", &a, &b, &len) == 2 &&
+		    !de->d_name[len] && b > a) {
+			e.start_s = a;
+			e.end_s = b;
+		} else if (sscanf(de->d_name, "%llu.hsa%n", &a, &len) == 1 &&
+			   !de->d_name[len]) {
+			e.start_s = a;
+			e.end_s = a + HISTORY_PARTITION_S;
+			e.active = 1;
+		} else {
+			continue;
+		}
+		if (strlen(de->d_name) >= sizeof(e.name))
+			continue;
+		strcpy(e.name, de->d_name);
+		if (n == cap) {
+			cap = cap ? 2 * cap : 16;
+			nf = realloc(f, cap * sizeof(*f));
+			if (!nf) {
+				free(f);
+				closedir(d);
+				return -1;
+			}
+			f = nf;
+		}
+		f[n++] = e;
+	}
+	closedir(d);
+	qsort(f, n, sizeof(*f), history_file_cmp);
+	*files = f;
+	return n;
+}
+
+/****************************************************************
+ * segment files
+ ****************************************************************/
+static int history_seg_open(const char *path, struct history_seg *s)
+{
+	const struct history_hdr *h;
+	struct stat st;
+	int fd;
+
+	memset(s, 0, sizeof(*s));
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -1;
+	if (fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(*h)) {
+		close(fd);
+		return -1;
+	}
+	s->len = st.st_size;
+	s->map = mmap(NULL, s->len, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (s->map == MAP_FAILED) {
+		s->map = NULL;
+		return -1;
+	}
+	h = s->hdr = s->map;
+	if (memcmp(h->magic, HISTORY_MAGIC, sizeof(h->magic)) || h->version != HISTORY_VERSION ||
+	    !h->bloom_bits || (h->bloom_bits & (h->bloom_bits - 1)) ||
+	    h->off_recs + (uint64_t)h->count * sizeof(struct history_rec) > h->off_index ||
+	    h->off_index + (uint64_t)h->nindex * sizeof(uint64_t) > h->off_bloom ||
+	    h->off_bloom + h->bloom_bits / 8 > h->off_uids ||
+	    h->off_uids + (uint64_t)h->count * sizeof(struct history_uid) > s->len) {
+		fprintf(stderr, "history: %s is not a history segment\n", path);
+		munmap(s->map, s->len);
+		s->map = NULL;
+		return -1;
+	}
+	s->recs = (const void *)((const char *)s->map + h->off_recs);
+	s->index = (const void *)((const char *)s->map + h->off_index);
+	s->bloom = (const uint8_t *)s->map + h->off_bloom;
+	s->uids = (const void *)((const char *)s->map + h->off_uids);
+	return 0;
+}
+
+static void history_seg_close(struct history_seg *s)
+{
+	if (s->map)
+		munmap(s->map, s->len);
+	s->map = NULL;
+}
+
+static int history_seg_may_have(const struct history_seg *s, const uint8_t uid[8])
+{
+	uint64_t hash = history_uid_hash(uid);
+	uint32_t bit;
+	int i;
+
+	for (i = 0; i < (int)s->hdr->bloom_k; i++) {
+		bit = history_bloom_bit(hash, i, s->hdr->bloom_bits);
+		if (!(s->bloom[bit / 8] & (1 << (bit % 8))))
+			return 0;
+	}
+	return 1;
+}
+
+/* sort recs and write them as the sealed segment <dir>/<start>-<end>.hst */
+static int history_seg_write(const char *dir, uint64_t start_s, uint64_t end_s,
+			     struct history_rec *recs, uint32_t n)
+{
+	char path[256], tmp[264];
+	struct history_hdr h;
+	struct history_uid *uids;
+	uint64_t *index;
+	uint8_t *bloom;
+	uint32_t i, k, distinct = 0;
+	FILE *fp;
+	int ret = -1;
+
+	qsort(recs, n, sizeof(*recs), history_rec_cmp);
+
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, HISTORY_MAGIC, sizeof(h.magic));
+	h.version = HISTORY_VERSION;
+	h.count = n;
+	h.start_ns = start_s * NS_PER_S;
+	h.end_ns = end_s * NS_PER_S;
+	if (n && recs[0].ts_ns < h.start_ns)
+		h.start_ns = recs[0].ts_ns;
+	if (n && recs[n - 1].ts_ns >= h.end_ns)
+		h.end_ns = recs[n - 1].ts_ns + 1;
+	h.index_stride = HISTORY_INDEX_STRIDE;
+	h.nindex = (n + HISTORY_INDEX_STRIDE - 1) / HISTORY_INDEX_STRIDE;
+
+	index = malloc((h.nindex + 1) * sizeof(*index));
+	uids = malloc((n + 1) * sizeof(*uids));
+	if (!index || !uids)
+		goto out;
+	for (i = 0; i < h.nindex; i++)
+		index[i] = recs[i * HISTORY_INDEX_STRIDE].ts_ns;
+	for (i = 0; i < n; i++) {
+		memcpy(uids[i].uid, recs[i].uid, sizeof(uids[i].uid));
+		uids[i].rec = i;
+	}
+	qsort(uids, n, sizeof(*uids), history_uid_cmp);
+	for (i = 0; i < n; i++)
+		if (!i || memcmp(uids[i].uid, uids[i - 1].uid, sizeof(uids[i].uid)))
+			distinct++;
+
+	h.bloom_bits = 64;
+	while (h.bloom_bits < distinct * HISTORY_BLOOM_BITS_PER_UID)
+		h.bloom_bits <<= 1;
+	h.bloom_k = HISTORY_BLOOM_K;
+	bloom = calloc(1, h.bloom_bits / 8);
+	if (!bloom)
+		goto out;
+	for (i = 0; i < n; i++) {
+		uint64_t hash;
+
+		if (i && !memcmp(uids[i].uid, uids[i - 1].uid, sizeof(uids[i].uid)))
+			continue;
+		hash = history_uid_hash(uids[i].uid);
+		for (k = 0; k < h.bloom_k; k++) {
+			uint32_t bit = history_bloom_bit(hash, k, h.bloom_bits);
+
+			bloom[bit / 8] |= 1 << (bit % 8);
+		}
+	}
+
+	h.off_recs = sizeof(h);
+	h.off_index = h.off_recs + (uint64_t)n * sizeof(*recs);
+	h.off_bloom = h.off_index + (uint64_t)h.nindex * sizeof(*index);
+	h.off_uids = h.off_bloom + h.bloom_bits / 8;
+
+	snprintf(path, sizeof(path), "%s/%llu-%llu.hst", dir,
+		 (unsigned long long)start_s, (unsigned long long)end_s);
+	snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+	fp = fopen(tmp, "w");
+	if (!fp) {
+		perror(tmp);
+		goto out_bloom;
+	}
+	if (fwrite(&h, sizeof(h), 1, fp) != 1 ||
+	    fwrite(recs, sizeof(*recs), n, fp) != n ||
+	    fwrite(index, sizeof(*index), h.nindex, fp) != h.nindex ||
+	    fwrite(bloom, 1, h.bloom_bits / 8, fp) != h.bloom_bits / 8 ||
+	    fwrite(uids, sizeof(*uids), n, fp) != n ||
+	    fflush(fp) != 0 || fsync(fileno(fp)) < 0) {
+		perror(tmp);
+		fclose(fp);
+		unlink(tmp);
+		goto out_bloom;
+	}
+	fclose(fp);
+	if (rename(tmp, path) < 0) {
+		perror(path);
+		unlink(tmp);
+		goto out_bloom;
+	}
+	ret = 0;
+
+out_bloom:
+	free(bloom);
+out:
+	free(index);
+	free(uids);
+	return ret;
+}
+
+/* append the records of one segment file (active or sealed) to *recs */
+static int history_load(const char *dir, const struct history_file *f,
+			struct history_rec **recs, uint32_t *n, uint32_t *cap)
+{
+	struct history_seg seg;
+	const struct history_rec *src;
+	struct history_rec *nr;
+	char path[256];
+	uint32_t count;
+	struct stat st;
+	void *map = NULL;
+	int fd = -1;
+
+	snprintf(path, sizeof(path), "%s/%s", dir, f->name);
+	if (f->active) {
+		fd = open(path, O_RDONLY | O_CLOEXEC);
+		if (fd < 0 || fstat(fd, &st) < 0) {
+			perror(path);
+			if (fd >= 0)
+				close(fd);
+			return -1;
+		}
+		count = st.st_size / sizeof(*src);  /* a torn last record is dropped */
+		if (count) {
+			map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+			if (map == MAP_FAILED) {
+				perror(path);
+				close(fd);
+				return -1;
+			}
+		}
+		src = map;
+	} else {
+		if (history_seg_open(path, &seg) < 0)
+			return -1;
+		count = seg.hdr->count;
+		src = seg.recs;
+	}
+
+	if (*n + count > *cap) {
+		uint32_t ncap = *cap ? *cap : 1024;
+
+		while (ncap < *n + count)
+			ncap *= 2;
+		nr = realloc(*recs, ncap * sizeof(*nr));
+		if (!nr) {
+			count = 0;
+		} else {
+			*recs = nr;
+			*cap = ncap;
+		}
+	}
+	if (count)
+		memcpy(*recs + *n, src, count * sizeof(*src));
+	*n += count;
+
+	if (f->active) {
+		if (map)
+			munmap(map, st.st_size);
+		close(fd);
+	} else {
+		history_seg_close(&seg);
+	}
+	return 0;
+}
+
+static void history_unlink(const char *dir, const struct history_file *f)
+{
+	char path[256];
+
+	snprintf(path, sizeof(path), "%s/%s", dir, f->name);
+	if (unlink(path) < 0)
+		perror(path);
+}
+
+/****************************************************************
+ * history_compact
+ *
+ * One pass of the background work: seals the active segments of hours
+ * that are over (but never the one of active_part_s, still being written),
+ * deletes segments older than the retention (none if retention_days is
+ * 0) and merges the segments of finished days. Counts are added to the
+ * optional counters.
+ ****************************************************************/
+int history_compact(const char *dir, uint64_t active_part_s, unsigned int retention_days,
+		    uint32_t *sealed, uint32_t *compacted, uint32_t *expired)
+{
+	uint64_t now_s = clock_ns(CLOCK_REALTIME) / NS_PER_S;
+	uint64_t today = now_s / HISTORY_DAY_S * HISTORY_DAY_S;
+	struct history_file *files;
+	struct history_rec *recs = NULL;
+	uint32_t n, cap = 0;
+	int nfiles, i, j;
+
+	/*
+	 * seal hours that are over, merging a late active segment into the
+	 * sealed one of the same hour
+	 */
+	nfiles = history_list(dir, &files);
+	if (nfiles < 0)
+		return -1;
+	for (i = 0; i < nfiles; i++) {
+		if (!files[i].active || files[i].start_s == active_part_s ||
+		    files[i].end_s + 2 * HISTORY_SLACK_S > now_s)
+			continue;
+		n = 0;
+		for (j = 0; j < nfiles; j++)
+			if (!files[j].active && files[j].start_s == files[i].start_s &&
+			    files[j].end_s == files[i].end_s)
+				history_load(dir, &files[j], &recs, &n, &cap);
+		if (history_load(dir, &files[i], &recs, &n, &cap) < 0)
+			continue;
+		if (!n || history_seg_write(dir, files[i].start_s, files[i].end_s, recs, n) == 0) {
+			history_unlink(dir, &files[i]);
+			if (sealed)
+				(*sealed)++;
+		}
+	}
+	free(files);
+
+	/* expire */
+	nfiles = history_list(dir, &files);
+	if (nfiles < 0) {
+		free(recs);
+		return -1;
+	}
+	for (i = j = 0; i < nfiles; i++) {
+		if (retention_days && !files[i].active &&
+		    files[i].end_s + (uint64_t)retention_days * HISTORY_DAY_S <= now_s) {
+			history_unlink(dir, &files[i]);
+			if (expired)
+				(*expired)++;
+			continue;
+		}
+		files[j++] = files[i];
+	}
+	nfiles = j;
+
+	/* merge the segments of every finished day into one */
+	for (i = 0; i < nfiles; i = j) {
+		uint64_t day = files[i].start_s / HISTORY_DAY_S * HISTORY_DAY_S;
+		int merge = 1;
+
+		for (j = i; j < nfiles && files[j].start_s / HISTORY_DAY_S * HISTORY_DAY_S == day; j++)
+			if (files[j].active || files[j].end_s > day + HISTORY_DAY_S)
+				merge = 0;
+		if (!merge || day + HISTORY_DAY_S > today ||
+		    (j - i == 1 && files[i].start_s == day && files[i].end_s == day + HISTORY_DAY_S))
+			continue;
+		n = 0;
+		for (merge = i; merge < j; merge++)
+			if (history_load(dir, &files[merge], &recs, &n, &cap) < 0)
+				break;
+		if (merge < j || history_seg_write(dir, day, day + HISTORY_DAY_S, recs, n) < 0)
+			continue;
+		for (merge = i; merge < j; merge++)
+			if (files[merge].start_s != day || files[merge].end_s != day + HISTORY_DAY_S)
+				history_unlink(dir, &files[merge]);
+		if (compacted)
+			(*compacted)++;
+	}
+
+	free(files);
+	free(recs);
+	return 0;
+}
+
+/****************************************************************
+ * history_query
+ *
+ * Calls cb for every record in [from_ns, to_ns) (CLOCK_REALTIME, to_ns 0
+ * = no limit), of uid only if it is not NULL, oldest segment first.
+ ****************************************************************/
+int history_query(const char *dir, const uint8_t *uid, uint64_t from_ns, uint64_t to_ns,
+		  history_cb cb, void *arg, struct history_query_stats *qs)
+{
+	struct history_query_stats dummy;
+	struct history_file *files;
+	struct history_rec *recs = NULL;
+	uint32_t n, cap = 0, k;
+	int nfiles, i;
+
+	if (!qs)
+		qs = &dummy;
+	memset(qs, 0, sizeof(*qs));
+	if (!to_ns)
+		to_ns = UINT64_MAX;
+	nfiles = history_list(dir, &files);
+	if (nfiles < 0)
+		return -1;
+
+	for (i = 0; i < nfiles; i++) {
+		const struct history_file *f = &files[i];
+		struct history_seg seg;
+		char path[256];
+		uint32_t lo, hi, mid;
+
+		if ((f->end_s + HISTORY_SLACK_S) * NS_PER_S <= from_ns ||
+		    (f->start_s > HISTORY_SLACK_S && (f->start_s - HISTORY_SLACK_S) * NS_PER_S >= to_ns))
+			continue;
+
+		if (f->active) {
+			n = 0;
+			if (history_load(dir, f, &recs, &n, &cap) < 0)
+				continue;
+			qs->active_scanned += n;
+			for (k = 0; k < n; k++) {
+				if (recs[k].ts_ns < from_ns || recs[k].ts_ns >= to_ns ||
+				    (uid && memcmp(recs[k].uid, uid, sizeof(recs[k].uid))))
+					continue;
+				qs->matched++;
+				cb(&recs[k], arg);
+			}
+			continue;
+		}
+
+		snprintf(path, sizeof(path), "%s/%s", dir, f->name);
+		if (history_seg_open(path, &seg) < 0)
+			continue;
+		if (seg.hdr->end_ns <= from_ns || seg.hdr->start_ns >= to_ns) {
+			history_seg_close(&seg);
+			continue;
+		}
+		qs->segments++;
+
+		if (uid) {
+			if (!history_seg_may_have(&seg, uid)) {
+				qs->bloom_skipped++;
+				history_seg_close(&seg);
+				continue;
+			}
+			/* first (uid, rec) pair of the UID; records follow in time order */
+			lo = 0;
+			hi = seg.hdr->count;
+			while (lo < hi) {
+				mid = lo + (hi - lo) / 2;
+				if (memcmp(seg.uids[mid].uid, uid, 8) < 0)
+					lo = mid + 1;
+				else
+					hi = mid;
+			}
+			for (k = lo; k < seg.hdr->count && !memcmp(seg.uids[k].uid, uid, 8); k++) {
+				const struct history_rec *r = &seg.recs[seg.uids[k].rec];
+
+				if (r->ts_ns < from_ns || r->ts_ns >= to_ns)
+					continue;
+				qs->matched++;
+				cb(r, arg);
+			}
+		} else {
+			/* last index entry before from_ns: the range starts in its block */
+			lo = 0;
+			hi = seg.hdr->nindex;
+			while (lo < hi) {
+				mid = lo + (hi - lo) / 2;
+				if (seg.index[mid] < from_ns)
+					lo = mid + 1;
+				else
+					hi = mid;
+			}
+			k = lo ? (lo - 1) * seg.hdr->index_stride : 0;
+			for (; k < seg.hdr->count && seg.recs[k].ts_ns < to_ns; k++) {
+				if (seg.recs[k].ts_ns < from_ns)
+					continue;
+				qs->matched++;
+				cb(&seg.recs[k], arg);
+			}
+		}
+		history_seg_close(&seg);
+	}
+	free(files);
+	free(recs);
+	return 0;
+}
+
+/****************************************************************
+ * writer
+ ****************************************************************/
+static void history_flush(struct history *h)
+{
+	ssize_t len = h->nbuf * sizeof(h->buf[0]);
+
+	if (!h->nbuf)
+		return;
+	if (h->fd < 0 || write(h->fd, h->buf, len) != len) {
+		if (!h->write_errors++)
+			perror("history/write");
+	}
+	h->nbuf = 0;
+}
+
+/* finish the active segment; a new one is started by the next append */
+static void history_finish(struct history *h)
+{
+	history_flush(h);
+	if (h->fd >= 0)
+		close(h->fd);
+	h->fd = -1;
+	pthread_mutex_lock(&h->lock);
+	h->part_s = 0;
+	pthread_cond_signal(&h->wake);
+	pthread_mutex_unlock(&h->lock);
+}
+
+static void history_start(struct history *h, uint64_t part_s)
+{
+	char path[256];
+
+	snprintf(path, sizeof(path), "%s/%llu.hsa", h->dir, (unsigned long long)part_s);
+	h->fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+	if (h->fd < 0 && !h->write_errors++)
+		perror(path);
+	pthread_mutex_lock(&h->lock);
+	h->part_s = part_s;
+	pthread_mutex_unlock(&h->lock);
+}
+
+static void *history_thread(void *arg)
+{
+	struct history *h = arg;
+	struct timespec ts;
+	uint32_t sealed = 0, compacted = 0, expired = 0;
+	uint64_t part;
+
+	pthread_mutex_lock(&h->lock);
+	while (!h->stop) {
+		part = h->part_s;
+		pthread_mutex_unlock(&h->lock);
+
+		history_compact(h->dir, part ? part : clock_ns(CLOCK_REALTIME) / NS_PER_S /
+				HISTORY_PARTITION_S * HISTORY_PARTITION_S,
+				h->retention_days, &sealed, &compacted, &expired);
+
+		pthread_mutex_lock(&h->lock);
+		h->sealed = sealed;
+		h->compacted = compacted;
+		h->expired = expired;
+		clock_gettime(CLOCK_REALTIME, &ts);
+		ts.tv_sec += HISTORY_COMPACT_S;
+		if (!h->stop)
+			pthread_cond_timedwait(&h->wake, &h->lock, &ts);
+	}
+	pthread_mutex_unlock(&h->lock);
+	return NULL;
+}
+
+/****************************************************************
+ * history_open
+ *
+ * Creates dir if needed and starts the background thread.
+ ****************************************************************/
+int history_open(struct history *h, const char *dir, unsigned int retention_days)
+{
+	memset(h, 0, sizeof(*h));
+	h->fd = -1;
+	snprintf(h->dir, sizeof(h->dir), "%s", dir);
+	h->retention_days = retention_days ? retention_days : HISTORY_DEFAULT_RETENTION_DAYS;
+	if (mkdir(dir, 0755) < 0 && errno != EEXIST) {
+		perror(dir);
+		return -1;
+	}
+	h->mono_to_real = clock_ns(CLOCK_REALTIME) - clock_ns(CLOCK_MONOTONIC);
+	h->last_sync_ns = clock_ns(CLOCK_MONOTONIC);
+	pthread_mutex_init(&h->lock, NULL);
+	pthread_cond_init(&h->wake, NULL);
+	if (pthread_create(&h->thread, NULL, history_thread, h) != 0) {
+		fprintf(stderr, "history: can't start the compaction thread\n");
+		return -1;
+	}
+	h->running = 1;
+	return 0;
+}
+
+/****************************************************************
+ * history_append
+ ****************************************************************/
+void history_append(struct history *h, const struct rfid_event *ev)
+{
+	struct history_rec *rec;
+	uint64_t ts = ev->ts_ns + h->mono_to_real;
+	uint64_t part = ts / NS_PER_S / HISTORY_PARTITION_S * HISTORY_PARTITION_S;
+
+	/* only forward: a late record stays in the newer segment */
+	if (h->fd < 0 || part > h->part_s) {
+		if (h->fd >= 0)
+			history_finish(h);
+		history_start(h, part);
+	}
+	rec = &h->buf[h->nbuf++];
+	memset(rec, 0, sizeof(*rec));
+	rec->ts_ns = ts;
+	memcpy(rec->uid, ev->uid, sizeof(rec->uid));
+	rec->rssi = ev->rssi;
+	rec->reader = ev->reader;
+	rec->flags = ev->flags;
+	rec->type = ev->type;
+	h->appended++;
+	if (h->nbuf == HISTORY_BUF_LEN)
+		history_flush(h);
+}
+
+/****************************************************************
+ * history_sync
+ *
+ * Writes the buffered records every HISTORY_SYNC_MS (or now if force),
+ * and finishes the active segment once its hour is over.
+ ****************************************************************/
+void history_sync(struct history *h, int force)
+{
+	uint64_t now = clock_ns(CLOCK_MONOTONIC);
+
+	if (!force && now - h->last_sync_ns < HISTORY_SYNC_MS * 1000000ull)
+		return;
+	h->last_sync_ns = now;
+	h->mono_to_real = clock_ns(CLOCK_REALTIME) - now;
+	history_flush(h);
+	if (h->fd >= 0 && (now + h->mono_to_real) / NS_PER_S >=
+	    h->part_s + HISTORY_PARTITION_S + HISTORY_SLACK_S)
+		history_finish(h);
+}
+
+void history_close(struct history *h)
+{
+	history_flush(h);
+	if (h->fd >= 0)
+		close(h->fd);
+	h->fd = -1;
+	if (!h->running)
+		return;
+	pthread_mutex_lock(&h->lock);
+	h->stop = 1;
+	pthread_cond_signal(&h->wake);
+	pthread_mutex_unlock(&h->lock);
+	pthread_join(h->thread, NULL);
+	h->running = 0;
+}
+
+/****************************************************************
+ * history_stats_dump
+ *
+ * stats section of the history store, arg is the struct history.
+ ****************************************************************/
+void history_stats_dump(FILE *fp, void *arg)
+{
+	struct history *h = arg;
+
+	pthread_mutex_lock(&h->lock);
+	fprintf(fp, "  %s: %u appended, %u write errors, %u hours sealed, %u days compacted, "
+		"%u segments expired\n", h->dir, h->appended, h->write_errors,
+		h->sealed, h->compacted, h->expired);
+	pthread_mutex_unlock(&h->lock);
+}
@@ -0,0 +1,134 @@
+/*
+ * history.h
+ *
+ * On-board read history that answers "when was UID X seen" over months of
+ * reads without scanning them all. Published events are appended,
+ * stamped with CLOCK_REALTIME, to the active segment of the current hour,
+ * <dir>/<start>.hsa (a plain array of records, written in groups like the
+ * journal). A background thread turns every finished hour into a sealed
+ * segment <dir>/<start>-<end>.hst:
+ *
+ *   header | records sorted by time | sparse time index (every
+ *   HISTORY_INDEX_STRIDE-th record) | UID bloom filter |
+ *   (UID, record) pairs sorted by UID
+ *
+ * merges the hourly segments of a finished day into one daily segment,
+ * and deletes segments older than the retention. A query only opens the
+ * segments whose time span overlaps it; for a UID it skips every segment
+ * whose bloom filter rules the UID out and binary searches the UID index
+ * of the rest, and a time range is found through the sparse index.
+ */
+
+#ifndef HISTORY_H_
+#define HISTORY_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <pthread.h>
+
+#include "rfid_event.h"
+
+#define HISTORY_MAGIC "RFIDHST1"
+#define HISTORY_VERSION 1
+#define HISTORY_DEFAULT_DIR "history"
+#define HISTORY_DEFAULT_RETENTION_DAYS 90
+#define HISTORY_PARTITION_S 3600           /* active segment per hour */
+#define HISTORY_DAY_S 86400                /* compacted segment per day */
+#define HISTORY_INDEX_STRIDE 256
+#define HISTORY_BLOOM_BITS_PER_UID 10
+#define HISTORY_BLOOM_K 7
+#define HISTORY_BUF_LEN 256                /* records buffered before a write */
+#define HISTORY_SYNC_MS 2000
+#define HISTORY_COMPACT_S 60               /* background pass interval */
+
+struct history_rec {
+	uint64_t ts_ns;        /* CLOCK_REALTIME */
+	uint8_t uid[8];        /* MSB first, as printed */
+	uint8_t rssi;
+	uint8_t reader;
+	uint8_t flags;         /* RFID_EVF_* */
+	uint8_t type;
+	uint32_t reserved;
+};
+
+struct history_uid {
+	uint8_t uid[8];
+	uint32_t rec;          /* index into the records */
+};
+
+struct history_hdr {
+	char magic[8];
+	uint32_t version;
+	uint32_t count;        /* records */
+	uint64_t start_ns;     /* time span of the segment, [start, end) */
+	uint64_t end_ns;
+	uint32_t index_stride;
+	uint32_t nindex;
+	uint32_t bloom_bits;   /* power of two */
+	uint32_t bloom_k;
+	uint64_t off_recs;
+	uint64_t off_index;
+	uint64_t off_bloom;
+	uint64_t off_uids;
+};
+
+/* a mapped sealed segment */
+struct history_seg {
+	void *map;
+	uint64_t len;
+	const struct history_hdr *hdr;
+	const struct history_rec *recs;
+	const uint64_t *index;
+	const uint8_t *bloom;
+	const struct history_uid *uids;
+};
+
+struct history {
+	int fd;                /* active segment, -1 if none */
+	uint64_t part_s;       /* its hour, CLOCK_REALTIME s */
+	struct history_rec buf[HISTORY_BUF_LEN];
+	int nbuf;
+	int64_t mono_to_real;  /* add to a CLOCK_MONOTONIC event time */
+	uint64_t last_sync_ns;
+	unsigned int retention_days;
+	char dir[200];
+
+	pthread_t thread;
+	pthread_mutex_t lock;  /* part_s, stop */
+	pthread_cond_t wake;
+	int stop;
+	int running;
+
+	/* statistics */
+	uint32_t appended;
+	uint32_t write_errors;
+	uint32_t sealed;
+	uint32_t compacted;
+	uint32_t expired;
+};
+
+/* what a query looked at */
+struct history_query_stats {
+	uint32_t segments;     /* overlapping the time range */
+	uint32_t bloom_skipped;
+	uint32_t active_scanned; /* records of unsealed segments scanned */
+	uint32_t matched;
+};
+
+typedef void (*history_cb)(const struct history_rec *rec, void *arg);
+
+/****************************************************************
+ * history API
+ ****************************************************************/
+int history_open(struct history *h, const char *dir, unsigned int retention_days);
+void history_append(struct history *h, const struct rfid_event *ev);
+void history_sync(struct history *h, int force);
+void history_close(struct history *h);
+void history_stats_dump(FILE *fp, void *arg);
+
+int history_compact(const char *dir, uint64_t active_part_s, unsigned int retention_days,
+		    uint32_t *sealed, uint32_t *compacted, uint32_t *expired);
+int history_query(const char *dir, const uint8_t *uid, uint64_t from_ns, uint64_t to_ns,
+		  history_cb cb, void *arg, struct history_query_stats *qs);
+
+#endif /* HISTORY_H_ */
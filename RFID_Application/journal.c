@@ -0,0 +1,256 @@
+/*
+ * journal.c
+ *
+ * Append-only binary read journal, see journal.h.
+ *
+ * Layout: one header page followed by `capacity` fixed-size records. The
+ * header count is only advanced after the records it covers have been
+ * msync'ed, so a crash loses at most one sync interval. Records written
+ * after the last commit are still recovered on open if their checksum and
+ * sequence number are intact. A full journal is rotated to <path>.1.
+ */
+
+#include "journal.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+static uint64_t now_ns(clockid_t clk)
+{
+	struct timespec ts;
+
+	clock_gettime(clk, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static uint32_t fnv1a(const void *data, size_t len)
+{
+	const uint8_t *p = data;
+	uint32_t h = 2166136261u;
+
+	while (len--) {
+		h ^= *p++;
+		h *= 16777619u;
+	}
+	return h;
+}
+
+int journal_rec_valid(const struct journal_rec *rec)
+{
+	return rec->seq != 0 &&
+	       rec->check == fnv1a(rec, offsetof(struct journal_rec, check));
+}
+
+/****************************************************************
+ * journal_map
+ ****************************************************************/
+static int journal_map(struct journal *j, uint32_t capacity, int create)
+{
+	struct stat st;
+	int prot = j->readonly ? PROT_READ : PROT_READ | PROT_WRITE;
+
+	if (fstat(j->fd, &st) < 0) {
+		perror("journal/stat");
+		return -1;
+	}
+
+	if (create || st.st_size < JOURNAL_HDR_SIZE) {
+		if (j->readonly) {
+			fprintf(stderr, "journal: %s is empty\n", j->path);
+			return -1;
+		}
+		j->map_len = JOURNAL_HDR_SIZE + (uint64_t)capacity * sizeof(struct journal_rec);
+		if (ftruncate(j->fd, 0) < 0 ||
+		    posix_fallocate(j->fd, 0, j->map_len) != 0) {
+			perror("journal/fallocate");
+			return -1;
+		}
+		create = 1;
+	} else {
+		j->map_len = st.st_size;
+	}
+
+	j->map = mmap(NULL, j->map_len, prot, MAP_SHARED, j->fd, 0);
+	if (j->map == MAP_FAILED) {
+		perror("journal/mmap");
+		j->map = NULL;
+		return -1;
+	}
+	j->hdr = j->map;
+	j->recs = (struct journal_rec *)((char *)j->map + JOURNAL_HDR_SIZE);
+
+	if (create) {
+		memset(j->hdr, 0, sizeof(*j->hdr));
+		memcpy(j->hdr->magic, JOURNAL_MAGIC, sizeof(j->hdr->magic));
+		j->hdr->version = JOURNAL_VERSION;
+		j->hdr->rec_size = sizeof(struct journal_rec);
+		j->hdr->capacity = capacity;
+		j->hdr->created_ns = now_ns(CLOCK_REALTIME);
+		msync(j->map, JOURNAL_HDR_SIZE, MS_SYNC);
+	}
+
+	if (memcmp(j->hdr->magic, JOURNAL_MAGIC, sizeof(j->hdr->magic)) ||
+	    j->hdr->rec_size != sizeof(struct journal_rec) ||
+	    JOURNAL_HDR_SIZE + (uint64_t)j->hdr->capacity * j->hdr->rec_size > j->map_len ||
+	    j->hdr->count > j->hdr->capacity) {
+		fprintf(stderr, "journal: %s is not a journal file\n", j->path);
+		munmap(j->map, j->map_len);
+		j->map = NULL;
+		return -1;
+	}
+
+	/* recover records appended after the last commit */
+	j->next = j->hdr->count;
+	j->seq = j->next ? j->recs[j->next - 1].seq : 0;
+	while (j->next < j->hdr->capacity &&
+	       journal_rec_valid(&j->recs[j->next]) &&
+	       j->recs[j->next].seq == j->seq + 1) {
+		j->seq++;
+		j->next++;
+	}
+	return 0;
+}
+
+/****************************************************************
+ * journal_open
+ ****************************************************************/
+int journal_open(struct journal *j, const char *path, uint32_t capacity, unsigned int sync_ms)
+{
+	memset(j, 0, sizeof(*j));
+	snprintf(j->path, sizeof(j->path), "%s", path);
+	j->sync_ms = sync_ms;
+	j->fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+	if (j->fd < 0) {
+		perror("journal/open");
+		return -1;
+	}
+	if (journal_map(j, capacity ? capacity : JOURNAL_DEFAULT_CAPACITY, 0) < 0) {
+		close(j->fd);
+		j->fd = -1;
+		return -1;
+	}
+	j->last_sync_ns = now_ns(CLOCK_MONOTONIC);
+	return 0;
+}
+
+int journal_open_ro(struct journal *j, const char *path)
+{
+	memset(j, 0, sizeof(*j));
+	snprintf(j->path, sizeof(j->path), "%s", path);
+	j->readonly = 1;
+	j->fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (j->fd < 0) {
+		perror("journal/open");
+		return -1;
+	}
+	if (journal_map(j, 0, 0) < 0) {
+		close(j->fd);
+		j->fd = -1;
+		return -1;
+	}
+	return 0;
+}
+
+/****************************************************************
+ * journal_sync
+ ****************************************************************/
+int journal_sync(struct journal *j, int force)
+{
+	long page = sysconf(_SC_PAGESIZE);
+	uint64_t now = now_ns(CLOCK_MONOTONIC);
+	uint64_t start, end;
+
+	if (!j->map || j->readonly || j->next == j->hdr->count)
+		return 0;
+	if (!force && now - j->last_sync_ns < (uint64_t)j->sync_ms * 1000000ull)
+		return 0;
+
+	/* records first, then the header that makes them visible */
+	start = JOURNAL_HDR_SIZE + (uint64_t)j->hdr->count * sizeof(struct journal_rec);
+	end = JOURNAL_HDR_SIZE + (uint64_t)j->next * sizeof(struct journal_rec);
+	start &= ~(uint64_t)(page - 1);
+	if (msync((char *)j->map + start, end - start, MS_SYNC) < 0) {
+		perror("journal/msync");
+		return -1;
+	}
+	j->hdr->count = j->next;
+	if (msync(j->map, JOURNAL_HDR_SIZE, MS_SYNC) < 0) {
+		perror("journal/msync");
+		return -1;
+	}
+	j->last_sync_ns = now;
+	return 1;
+}
+
+/****************************************************************
+ * journal_rotate
+ ****************************************************************/
+static int journal_rotate(struct journal *j)
+{
+	char old[sizeof(j->path) + 2];
+	uint32_t capacity = j->hdr->capacity;
+
+	journal_sync(j, 1);
+	munmap(j->map, j->map_len);
+	j->map = NULL;
+
+	snprintf(old, sizeof(old), "%s.1", j->path);
+	if (rename(j->path, old) < 0)
+		perror("journal/rename");
+	close(j->fd);
+
+	j->fd = open(j->path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (j->fd < 0) {
+		perror("journal/open");
+		return -1;
+	}
+	return journal_map(j, capacity, 1);
+}
+
+/****************************************************************
+ * journal_append
+ ****************************************************************/
+int journal_append(struct journal *j, const uint8_t uid[8], uint8_t rssi, uint8_t reader, uint16_t flags)
+{
+	struct journal_rec *rec;
+
+	if (!j->map || j->readonly)
+		return -1;
+	if (j->next >= j->hdr->capacity && journal_rotate(j) < 0)
+		return -1;
+
+	rec = &j->recs[j->next];
+	rec->ts_ns = now_ns(CLOCK_REALTIME);
+	memcpy(rec->uid, uid, sizeof(rec->uid));
+	rec->seq = ++j->seq;
+	rec->flags = flags;
+	rec->rssi = rssi;
+	rec->reader = reader;
+	rec->reserved = 0;
+	rec->check = fnv1a(rec, offsetof(struct journal_rec, check));
+	j->next++;
+
+	return journal_sync(j, 0);
+}
+
+/****************************************************************
+ * journal_close
+ ****************************************************************/
+void journal_close(struct journal *j)
+{
+	if (j->map) {
+		journal_sync(j, 1);
+		munmap(j->map, j->map_len);
+		j->map = NULL;
+	}
+	if (j->fd >= 0)
+		close(j->fd);
+	j->fd = -1;
+}
@@ -0,0 +1,73 @@
+/*
+ * journal.h
+ *
+ * Append-only binary read journal. The file is preallocated and memory
+ * mapped; each successful read is one fixed-size record. Records are made
+ * durable in groups (msync) on a configurable interval instead of rewriting
+ * a text file on the SD card for every tag.
+ */
+
+#ifndef JOURNAL_H_
+#define JOURNAL_H_
+
+#include <stdint.h>
+
+ /****************************************************************
+ * Constants
+ ****************************************************************/
+
+#define JOURNAL_MAGIC "RFIDJRN1"
+#define JOURNAL_VERSION 1
+#define JOURNAL_HDR_SIZE 4096              /* header owns the first page */
+#define JOURNAL_DEFAULT_PATH "uid.jrnl"
+#define JOURNAL_DEFAULT_CAPACITY (64 * 1024) /* records, 2 MB on disk */
+#define JOURNAL_DEFAULT_SYNC_MS 2000
+
+/* record flags */
+#define JREC_F_RSSI_VALID 0x0001
+
+struct journal_hdr {
+	char magic[8];
+	uint32_t version;
+	uint32_t rec_size;
+	uint32_t capacity;
+	uint32_t count;        /* records known to be on stable storage */
+	uint64_t created_ns;
+};
+
+struct journal_rec {
+	uint64_t ts_ns;        /* CLOCK_REALTIME */
+	uint8_t uid[8];        /* MSB first, as printed */
+	uint32_t seq;
+	uint16_t flags;
+	uint8_t rssi;
+	uint8_t reader;
+	uint32_t reserved;
+	uint32_t check;        /* FNV-1a over the preceding bytes */
+};
+
+struct journal {
+	int fd;
+	int readonly;
+	void *map;
+	uint64_t map_len;
+	struct journal_hdr *hdr;
+	struct journal_rec *recs;
+	uint32_t next;         /* next free slot */
+	uint32_t seq;
+	uint64_t last_sync_ns;
+	unsigned int sync_ms;
+	char path[256];
+};
+
+/****************************************************************
+ * journal API
+ ****************************************************************/
+int journal_open(struct journal *j, const char *path, uint32_t capacity, unsigned int sync_ms);
+int journal_open_ro(struct journal *j, const char *path);
+int journal_append(struct journal *j, const uint8_t uid[8], uint8_t rssi, uint8_t reader, uint16_t flags);
+int journal_sync(struct journal *j, int force);
+int journal_rec_valid(const struct journal_rec *rec);
+void journal_close(struct journal *j);
+
+#endif /* JOURNAL_H_ */
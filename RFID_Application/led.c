@@ -0,0 +1,169 @@
+/*
+ * led.c
+ *
+ * LED indicators on the kernel LED triggers, see led.h.
+ */
+
+#include "led.h"
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#define LED_IDLE_ON_MS 50
+#define LED_IDLE_OFF_MS 1950
+#define LED_ERROR_MS 100
+
+/* sysfs attributes are written whole, at offset 0 */
+static void led_write(struct leds *l, int fd, const char *value)
+{
+	if (fd >= 0 && pwrite(fd, value, strlen(value), 0) >= 0)
+		l->writes++;
+}
+
+/* attributes of a trigger only exist while it is selected */
+static void led_write_attr(struct leds *l, struct led *d, const char *name, unsigned int value)
+{
+	char path[96], buf[16];
+	int fd;
+
+	snprintf(path, sizeof(path), "%s/%s", d->dir, name);
+	snprintf(buf, sizeof(buf), "%u", value);
+	fd = open(path, O_WRONLY | O_CLOEXEC);
+	if (fd < 0)
+		return;
+	led_write(l, fd, buf);
+	close(fd);
+}
+
+/****************************************************************
+ * led_open
+ *
+ * Opens the LEDs <prefix>0 .. <prefix>3 (prefix NULL: the BeagleBone
+ * user LEDs). Returns how many are there.
+ ****************************************************************/
+int led_open(struct leds *l, const char *prefix)
+{
+	char path[96];
+	int n, opened = 0;
+
+	memset(l, 0, sizeof(*l));
+	for (n = 0; n < LED_COUNT; n++) {
+		struct led *d = &l->led[n];
+
+		snprintf(d->dir, sizeof(d->dir), "%s%d", prefix ? prefix : LED_DEFAULT_PREFIX, n);
+		snprintf(path, sizeof(path), "%s/trigger", d->dir);
+		d->trigger_fd = open(path, O_WRONLY | O_CLOEXEC);
+		snprintf(path, sizeof(path), "%s/brightness", d->dir);
+		d->brightness_fd = open(path, O_WRONLY | O_CLOEXEC);
+		d->shot_fd = -1;
+		d->pattern = -1;
+		if (d->trigger_fd < 0 || d->brightness_fd < 0) {
+			if (d->trigger_fd >= 0)
+				close(d->trigger_fd);
+			if (d->brightness_fd >= 0)
+				close(d->brightness_fd);
+			d->trigger_fd = d->brightness_fd = -1;
+			continue;
+		}
+		opened++;
+	}
+	return opened;
+}
+
+/****************************************************************
+ * led_set
+ ****************************************************************/
+void led_set(struct leds *l, int n, LED_PATTERN pattern)
+{
+	struct led *d = &l->led[n];
+	char path[96];
+
+	if (d->trigger_fd < 0 || d->pattern == (int)pattern) {
+		l->skipped++;
+		return;
+	}
+	if (d->shot_fd >= 0)
+		close(d->shot_fd);
+	d->shot_fd = -1;
+	d->pattern = pattern;
+
+	switch (pattern) {
+	case LED_OFF:
+	case LED_ON:
+		led_write(l, d->trigger_fd, "none");
+		led_write(l, d->brightness_fd, pattern == LED_ON ? "1" : "0");
+		break;
+	case LED_IDLE:
+		led_write(l, d->trigger_fd, "timer");
+		led_write_attr(l, d, "delay_on", LED_IDLE_ON_MS);
+		led_write_attr(l, d, "delay_off", LED_IDLE_OFF_MS);
+		break;
+	case LED_ERROR:
+		led_write(l, d->trigger_fd, "timer");
+		led_write_attr(l, d, "delay_on", LED_ERROR_MS);
+		led_write_attr(l, d, "delay_off", LED_ERROR_MS);
+		break;
+	case LED_READING:
+		led_write(l, d->trigger_fd, "oneshot");
+		led_write_attr(l, d, "invert", 1);
+		led_write_attr(l, d, "delay_on", LED_SHOT_MS);
+		led_write_attr(l, d, "delay_off", LED_SHOT_MS);
+		snprintf(path, sizeof(path), "%s/shot", d->dir);
+		d->shot_fd = open(path, O_WRONLY | O_CLOEXEC);
+		d->shot_end_ns = 0;
+		break;
+	}
+}
+
+/****************************************************************
+ * led_shot
+ *
+ * One blink of an LED showing LED_READING, unless one is still running.
+ ****************************************************************/
+void led_shot(struct leds *l, int n, uint64_t now_ns)
+{
+	struct led *d = &l->led[n];
+
+	if (d->shot_fd < 0)
+		return;
+	if (now_ns < d->shot_end_ns) {
+		l->skipped++;
+		return;
+	}
+	led_write(l, d->shot_fd, "1");
+	d->shot_end_ns = now_ns + 2 * LED_SHOT_MS * 1000000ull;
+}
+
+/****************************************************************
+ * led_close
+ *
+ * Turns the LEDs off.
+ ****************************************************************/
+void led_close(struct leds *l)
+{
+	int n;
+
+	for (n = 0; n < LED_COUNT; n++) {
+		struct led *d = &l->led[n];
+
+		if (d->trigger_fd < 0)
+			continue;
+		led_set(l, n, LED_OFF);
+		close(d->trigger_fd);
+		close(d->brightness_fd);
+		d->trigger_fd = d->brightness_fd = -1;
+	}
+}
+
+/****************************************************************
+ * led_stats_dump
+ *
+ * stats section of the LEDs, arg is the struct leds.
+ ****************************************************************/
+void led_stats_dump(FILE *fp, void *arg)
+{
+	const struct leds *l = arg;
+
+	fprintf(fp, "  %u sysfs writes, %u skipped\n", l->writes, l->skipped);
+}
@@ -0,0 +1,62 @@
+/*
+ * led.h
+ *
+ * The four user LEDs of the BeagleBone as indicators. Blinking is left to
+ * the kernel LED triggers, so the reader loop does no LED work of its own:
+ *
+ *   LED_OFF, LED_ON  trigger none, fixed brightness
+ *   LED_IDLE         trigger timer, a short flash every 2 s
+ *   LED_ERROR        trigger timer, fast blinking
+ *   LED_READING      trigger oneshot, inverted: on, and dark for a moment
+ *                    on every led_shot (one per read)
+ *
+ * The trigger and brightness files stay open, a pattern is only written
+ * when it changes, and a shot is only written when the last one is over.
+ * LEDs that cannot be opened (not a BeagleBone) are left alone.
+ */
+
+#ifndef LED_H_
+#define LED_H_
+
+#include <stdio.h>
+#include <stdint.h>
+
+#define LED_COUNT 4
+#define LED_DEFAULT_PREFIX "/sys/class/leds/beaglebone:green:usr"
+#define LED_SHOT_MS 50             /* dark time of a shot */
+
+typedef enum {
+	LED_OFF = 0,
+	LED_ON,
+	LED_IDLE,
+	LED_READING,
+	LED_ERROR
+} LED_PATTERN;
+
+struct led {
+	char dir[64];          /* <prefix><n> */
+	int trigger_fd;        /* -1 if the LED is not there */
+	int brightness_fd;
+	int shot_fd;           /* open while LED_READING */
+	int pattern;           /* LED_PATTERN, -1 before the first led_set */
+	uint64_t shot_end_ns;
+};
+
+struct leds {
+	struct led led[LED_COUNT];
+
+	/* statistics */
+	uint32_t writes;
+	uint32_t skipped;      /* unchanged pattern or shot still running */
+};
+
+/****************************************************************
+ * led API
+ ****************************************************************/
+int led_open(struct leds *l, const char *prefix);
+void led_set(struct leds *l, int n, LED_PATTERN pattern);
+void led_shot(struct leds *l, int n, uint64_t now_ns);
+void led_close(struct leds *l);
+void led_stats_dump(FILE *fp, void *arg);
+
+#endif /* LED_H_ */
@@ -0,0 +1,117 @@
+/*
+ * presence.c
+ *
+ * Tag presence tracking, see presence.h.
+ */
+
+#include "presence.h"
+#include <string.h>
+
+void presence_init(struct presence *p, unsigned int depart_ms, uint8_t near_rssi)
+{
+	memset(p, 0, sizeof(*p));
+	p->depart_ms = depart_ms ? depart_ms : PRESENCE_DEFAULT_DEPART_MS;
+	p->near_rssi = near_rssi;
+}
+
+uint8_t presence_trend_flags(const struct presence_tag *t)
+{
+	switch (rssi_trend(&t->hist)) {
+	case RSSI_APPROACHING:
+		return RFID_EVF_APPROACHING;
+	case RSSI_RECEDING:
+		return RFID_EVF_RECEDING;
+	default:
+		return 0;
+	}
+}
+
+static void presence_emit(struct presence_tag *t, uint8_t type, uint64_t ts_ns, rfid_event_cb cb, void *arg)
+{
+	struct rfid_event ev;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.ts_ns = ts_ns;
+	memcpy(ev.uid, t->uid, sizeof(ev.uid));
+	ev.type = type;
+	ev.reader = t->reader;
+	if (t->hist.count) {
+		ev.rssi = rssi_median(&t->hist);
+		ev.flags = RFID_EVF_RSSI_VALID | presence_trend_flags(t);
+	}
+	cb(&ev, arg);
+}
+
+/****************************************************************
+ * presence_seen
+ ****************************************************************/
+struct presence_tag *presence_seen(struct presence *p, const struct rfid_event *read, rfid_event_cb cb, void *arg)
+{
+	struct presence_tag *t, *slot = NULL, *oldest = NULL;
+	int i, near;
+
+	for (i = 0; i < PRESENCE_MAX_TAGS; i++) {
+		t = &p->tags[i];
+		if (!t->used) {
+			if (!slot)
+				slot = t;
+			continue;
+		}
+		if (!memcmp(t->uid, read->uid, sizeof(t->uid)))
+			break;
+		if (!oldest || t->last_ns < oldest->last_ns)
+			oldest = t;
+	}
+
+	if (i < PRESENCE_MAX_TAGS) {
+		t->last_ns = read->ts_ns;
+		t->reads++;
+	} else {
+		/* table full: the least recently seen tag departs early */
+		if (!slot) {
+			slot = oldest;
+			if (slot->near)
+				presence_emit(slot, RFID_EV_DEPARTED, read->ts_ns, cb, arg);
+		}
+		t = slot;
+		memset(t, 0, sizeof(*t));
+		memcpy(t->uid, read->uid, sizeof(t->uid));
+		t->used = 1;
+		t->first_ns = t->last_ns = read->ts_ns;
+		t->reads = 1;
+	}
+
+	t->reader = read->reader;
+	if (read->flags & RFID_EVF_RSSI_VALID) {
+		t->rssi = read->rssi;
+		rssi_add(&t->hist, read->rssi);
+		near = rssi_near(&t->hist, p->near_rssi, t->near);
+	} else {
+		near = t->near || !p->near_rssi;
+	}
+
+	if (near != t->near) {
+		t->near = near;
+		presence_emit(t, near ? RFID_EV_ARRIVED : RFID_EV_DEPARTED, read->ts_ns, cb, arg);
+	}
+	return t;
+}
+
+/****************************************************************
+ * presence_expire
+ ****************************************************************/
+void presence_expire(struct presence *p, uint64_t now_ns, rfid_event_cb cb, void *arg)
+{
+	uint64_t limit = (uint64_t)p->depart_ms * 1000000ull;
+	int i;
+
+	for (i = 0; i < PRESENCE_MAX_TAGS; i++) {
+		struct presence_tag *t = &p->tags[i];
+
+		if (t->used && now_ns - t->last_ns >= limit) {
+			if (t->near)
+				presence_emit(t, RFID_EV_DEPARTED, now_ns, cb, arg);
+			t->used = 0;
+		}
+	}
+}
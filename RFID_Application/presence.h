@@ -0,0 +1,45 @@
+/*
+ * presence.h
+ *
+ * Turns the stream of reads into ARRIVED/DEPARTED events. A tag arrives on
+ * its first read and departs once it has not been read for depart_ms.
+ *
+ * With a proximity threshold (near_rssi > 0) a tag only arrives once its
+ * median RSSI reaches the threshold, and departs again when it recedes
+ * below it, so tags passing at the edge of the field are tracked but do
+ * not trigger anything that acts on arrivals.
+ */
+
+#ifndef PRESENCE_H_
+#define PRESENCE_H_
+
+#include "rfid_event.h"
+#include "rssi.h"
+
+#define PRESENCE_MAX_TAGS 64
+#define PRESENCE_DEFAULT_DEPART_MS 3000
+
+struct presence_tag {
+	uint8_t uid[8];
+	uint8_t used;
+	uint8_t near;          /* has ARRIVED */
+	uint8_t reader;
+	uint8_t rssi;
+	struct rssi_track hist;
+	uint64_t first_ns;
+	uint64_t last_ns;
+	uint32_t reads;
+};
+
+struct presence {
+	struct presence_tag tags[PRESENCE_MAX_TAGS];
+	unsigned int depart_ms;
+	uint8_t near_rssi;
+};
+
+void presence_init(struct presence *p, unsigned int depart_ms, uint8_t near_rssi);
+uint8_t presence_trend_flags(const struct presence_tag *t);
+struct presence_tag *presence_seen(struct presence *p, const struct rfid_event *read, rfid_event_cb cb, void *arg);
+void presence_expire(struct presence *p, uint64_t now_ns, rfid_event_cb cb, void *arg);
+
+#endif /* PRESENCE_H_ */
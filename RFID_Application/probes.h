@@ -0,0 +1,49 @@
+/*
+ * probes.h
+ *
+ * Static tracepoints (USDT) on the hot paths. With <sys/sdt.h> available
+ * (systemtap-sdt-dev) every probe is a single nop plus an ELF note that
+ * perf, bpftrace and systemtap can attach to on the running binary, e.g.
+ *
+ *   bpftrace -e 'usdt:./RFID:rfid:irq_wait_end { @[arg1] = count(); }'
+ *   perf buildid-cache --add RFID; perf record -e sdt_rfid:flow_end -a
+ *
+ * Without it, or built with -DRFID_NO_PROBES, the probes compile to
+ * nothing and their arguments are not evaluated.
+ *
+ * Providers and probes:
+ *   rfid:flow_start(reader, flow)             SPI flow about to be sent
+ *   rfid:flow_end(reader, flow, ret)          SPI flow done, ret < 0 on error
+ *   rfid:irq_wait_start(reader, state)        waiting for TX or RX IRQ
+ *   rfid:irq_wait_end(reader, state, got_irq) IRQ or timeout
+ *   rfid:read_accepted(reader, uid, rssi)     uid points to 8 bytes, MSB first
+ *   rfid:read_rejected(reader, irq_status, fifo_bytes)
+ *   rfid:dispatch(key, pid, req_ns)           action spawned
+ *   capture:dqbuf(index, bytesused)           V4L2 buffer dequeued
+ *   capture:qbuf(index)                       V4L2 buffer queued back
+ */
+
+#ifndef PROBES_H_
+#define PROBES_H_
+
+#if !defined(RFID_NO_PROBES) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define RFID_PROBES 1
+#endif
+#endif
+
+#ifdef RFID_PROBES
+#define PROBE0(prov, name) STAP_PROBE(prov, name)
+#define PROBE1(prov, name, a) STAP_PROBE1(prov, name, a)
+#define PROBE2(prov, name, a, b) STAP_PROBE2(prov, name, a, b)
+#define PROBE3(prov, name, a, b, c) STAP_PROBE3(prov, name, a, b, c)
+#else
+#define PROBE0(prov, name) do { } while (0)
+#define PROBE1(prov, name, a) do { (void)sizeof(a); } while (0)
+#define PROBE2(prov, name, a, b) do { (void)sizeof(a); (void)sizeof(b); } while (0)
+#define PROBE3(prov, name, a, b, c) \
+	do { (void)sizeof(a); (void)sizeof(b); (void)sizeof(c); } while (0)
+#endif
+
+#endif /* PROBES_H_ */
@@ -0,0 +1,39 @@
+/*
+ * pt.h
+ *
+ * Protothreads: stackless coroutines in plain C, after Adam Dunkels'
+ * protothreads. A protothread is a function whose body sits between
+ * PT_BEGIN and PT_END; PT_WAIT_UNTIL returns to the caller and, when the
+ * function is called again, resumes right after the wait. The only state
+ * kept is the resume point, so variables that must survive a wait live in
+ * the caller's structure, not on the stack, and the body must not contain
+ * switch statements of its own.
+ */
+
+#ifndef PT_H_
+#define PT_H_
+
+struct pt {
+	unsigned short lc;     /* resume point, 0 = start */
+};
+
+#define PT_WAITING 0
+#define PT_ENDED 1
+
+#define PT_INIT(pt) ((pt)->lc = 0)
+
+#define PT_THREAD(decl) int decl
+
+#define PT_BEGIN(pt) switch ((pt)->lc) { case 0:
+
+#define PT_WAIT_UNTIL(pt, cond)			\
+	do {					\
+		(pt)->lc = __LINE__;		\
+	case __LINE__:				\
+		if (!(cond))			\
+			return PT_WAITING;	\
+	} while (0)
+
+#define PT_END(pt) } (pt)->lc = 0; return PT_ENDED
+
+#endif /* PT_H_ */
@@ -0,0 +1,593 @@
+/*
+ * reader.c
+ *
+ * TRF7970A reader state machine, see reader.h.
+ *
+ * One inventory cycle (5438_TRF7960_SPI_ISO15693_Single_Slot), with the
+ * state the session waits in:
+ *
+ *   IDLE     --deadline-->  software init, idle, chip status/ISO control
+ *   SETTLE   --1 ms------>  SYS_CLK, RX wait time, clear IRQ, inventory
+ *   WAIT_TX  --IRQ 0x80-->  reset FIFO
+ *   WAIT_RX  --IRQ------->  read FIFO (UID), RSSI, block receiver, RF off
+ *
+ * A timeout in either wait state ends the cycle with the RF field off.
+ * Cycles start on a fixed period counted from the deadline of the previous
+ * start, not from its end, so the rate does not drift with the time the
+ * cycle takes; a cycle running past its period skips to the next one.
+ */
+
+#include "reader.h"
+#include "SimpleGPIO.h"
+#include "startup.h"
+#include "trf_emu.h"
+#include "probes.h"
+#include "trace.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/epoll.h>
+#include <linux/types.h>
+#include <linux/spi/spidev.h>
+
+#define MS(x) ((uint64_t)(x) * 1000000ull)
+
+/* send one compiled flow; its rx buffers hold the replies afterwards */
+static struct trf_batch *reader_run(struct reader *r, TRF_FLOW flow)
+{
+	struct trf_batch *b = &r->batch[flow];
+	uint64_t t0 = rfid_now_ns(), t1;
+	int ret;
+
+	PROBE2(rfid, flow_start, r->id, flow);
+	if (r->emu)
+		ret = trf_emu_batch(r->emu, b);
+	else
+		ret = trf_batch_run(b, r->spi_fd);
+	PROBE3(rfid, flow_end, r->id, flow, ret);
+	t1 = rfid_now_ns();
+	r->st.flow_runs[flow]++;
+	stats_hist_add(&r->st.flow_us[flow], (t1 - t0) / 1000);
+	TRACE_SPAN(b->flow->name, r->id, t0, t1);
+	if (ret < 0) {
+		r->st.flow_errors[flow]++;
+		return NULL;
+	}
+	return b;
+}
+
+/* build the spi_ioc_transfer arrays of every flow for this reader */
+static void reader_compile(struct reader *r)
+{
+	int i;
+
+	for (i = 0; i < TRF_FLOW_COUNT; i++)
+		trf_batch_compile(&r->batch[i], &trf_flows[i], r->speed, r->bits, r->delay);
+}
+
+/* clocks the negotiation steps through */
+static const uint32_t reader_link_hz[] = {
+	1000000, 2000000, 3000000, 4000000, 6000000, 8000000, 10000000, 12000000, 16000000,
+};
+
+static void reader_set_speed(struct reader *r, uint32_t hz)
+{
+	r->speed = hz;
+	if (r->spi_fd >= 0 && ioctl(r->spi_fd, SPI_IOC_WR_MAX_SPEED_HZ, &r->speed) == -1)
+		perror("reader/max speed hz");
+	reader_compile(r);
+}
+
+/* READER_LINK_TESTS rounds of the link test flow; the number that failed */
+static int reader_link_test(struct reader *r)
+{
+	struct trf_batch *b;
+	int i, failed = 0;
+
+	for (i = 0; i < READER_LINK_TESTS; i++) {
+		b = reader_run(r, TRF_FLOW_LINK_TEST);
+		if (!b || trf_link_check(b) < 0)
+			failed++;
+	}
+	r->link.tests += READER_LINK_TESTS;
+	r->link.test_errors += failed;
+	return failed;
+}
+
+/*
+ * Between cycles: step the clock up until a step fails (once), then check
+ * the clock and fall back a step at a time while it fails. A clock that
+ * has been clean for READER_LINK_REPROBE_CHECKS checks tries one step up.
+ */
+static void reader_link_check(struct reader *r)
+{
+	int n = sizeof(reader_link_hz) / sizeof(reader_link_hz[0]);
+	uint64_t t0 = rfid_now_ns();
+	uint32_t fallbacks = r->link.fallbacks;
+	int i = 0;
+
+	r->link.checks++;
+	while (i + 1 < n && reader_link_hz[i + 1] <= r->speed)
+		i++;
+	if (!r->link.settled) {
+		while (i + 1 < n && reader_link_hz[i + 1] <= r->link.max_hz) {
+			reader_set_speed(r, reader_link_hz[i + 1]);
+			if (reader_link_test(r))
+				break;
+			i++;
+			r->link.steps_up++;
+		}
+		r->link.settled = 1;
+	} else if (r->link.clean_checks >= READER_LINK_REPROBE_CHECKS &&
+		   i + 1 < n && reader_link_hz[i + 1] <= r->link.max_hz) {
+		r->link.reprobes++;
+		r->link.clean_checks = 0;
+		reader_set_speed(r, reader_link_hz[i + 1]);
+		if (!reader_link_test(r)) {
+			i++;
+			r->link.steps_up++;
+		}
+	}
+	if (r->speed != reader_link_hz[i])
+		reader_set_speed(r, reader_link_hz[i]);
+	while (reader_link_test(r) && i > 0) {
+		reader_set_speed(r, reader_link_hz[--i]);
+		r->link.fallbacks++;
+	}
+	if (r->link.fallbacks != fallbacks)
+		r->link.clean_checks = 0;
+	else
+		r->link.clean_checks++;
+	r->link.next_ns = r->now_ns + MS(READER_LINK_CHECK_MS);
+	TRACE_SPAN("link check", r->id, t0, rfid_now_ns());
+}
+
+/* current level of the IRQ line; also acknowledges the sysfs edge event */
+static int reader_irq_level(struct reader *r)
+{
+	char ch = '0';
+
+	if (r->emu)
+		return trf_emu_irq_level(r->emu);
+	if (pread(r->irq_fd, &ch, 1, 0) < 1)
+		return 0;
+	return ch != '0';
+}
+
+/****************************************************************
+ * reader_parse
+ *
+ * spec is "device:en_gpio:irq_gpio", e.g. "/dev/spidev1.0:26:45"
+ ****************************************************************/
+int reader_parse(struct reader *r, int id, const char *spec)
+{
+	static char specs[READER_MAX][64];
+	char *en, *irq;
+
+	if (id < 0 || id >= READER_MAX) {
+		fprintf(stderr, "reader: at most %d readers\n", READER_MAX);
+		return -1;
+	}
+	memset(r, 0, sizeof(*r));
+	r->id = id;
+	r->spi_fd = -1;
+	r->irq_fd = -1;
+	r->mode = SPI_CPHA;
+	r->bits = 8;
+	r->speed = READER_DEFAULT_SPEED_HZ;
+	r->cycle_ms = READER_CYCLE_MS;
+	r->hold_ms = READER_READ_HOLD_MS;
+
+	snprintf(specs[id], sizeof(specs[id]), "%s", spec);
+	en = strchr(specs[id], ':');
+	irq = en ? strchr(en + 1, ':') : NULL;
+	if (!irq) {
+		fprintf(stderr, "reader: bad spec '%s', expected device:en_gpio:irq_gpio\n", spec);
+		return -1;
+	}
+	*en++ = 0;
+	*irq++ = 0;
+	r->device = specs[id];
+	r->en_gpio = atoi(en);
+	r->irq_gpio = atoi(irq);
+	return 0;
+}
+
+/****************************************************************
+ * reader_open
+ *
+ * GPIO lines that are already exported, e.g. in bulk with
+ * gpio_export_all, are used as they are.
+ ****************************************************************/
+int reader_open(struct reader *r)
+{
+	unsigned int gpio[2] = { r->en_gpio, r->irq_gpio };
+
+	gpio_export_all(gpio, 2, STARTUP_DEFAULT_TIMEOUT_MS);
+	gpio_set_output(r->en_gpio, HIGH);
+	gpio_set_dir(r->irq_gpio, INPUT_PIN);
+	gpio_set_edge(r->irq_gpio, "rising");
+
+	r->irq_fd = gpio_fd_open(r->irq_gpio);
+	if (r->irq_fd < 0)
+		return -1;
+
+	r->spi_fd = open(r->device, O_RDWR | O_CLOEXEC);
+	if (r->spi_fd < 0) {
+		perror(r->device);
+		goto err;
+	}
+
+	if (ioctl(r->spi_fd, SPI_IOC_WR_MODE, &r->mode) == -1 ||
+	    ioctl(r->spi_fd, SPI_IOC_RD_MODE, &r->mode) == -1) {
+		perror("reader/spi mode");
+		goto err;
+	}
+	if (ioctl(r->spi_fd, SPI_IOC_WR_BITS_PER_WORD, &r->bits) == -1 ||
+	    ioctl(r->spi_fd, SPI_IOC_RD_BITS_PER_WORD, &r->bits) == -1) {
+		perror("reader/bits per word");
+		goto err;
+	}
+	if (ioctl(r->spi_fd, SPI_IOC_WR_MAX_SPEED_HZ, &r->speed) == -1 ||
+	    ioctl(r->spi_fd, SPI_IOC_RD_MAX_SPEED_HZ, &r->speed) == -1) {
+		perror("reader/max speed hz");
+		goto err;
+	}
+	reader_compile(r);
+	return 0;
+
+err:
+	reader_close(r);
+	return -1;
+}
+
+/****************************************************************
+ * reader_open_emu
+ *
+ * Reader backed by an emulated chip; its IRQ fd is the emulator's
+ * timerfd, which signals EPOLLIN rather than EPOLLPRI.
+ ****************************************************************/
+int reader_open_emu(struct reader *r, int id, struct trf_emu *emu)
+{
+	if (reader_parse(r, id, "emu:0:0") < 0)
+		return -1;
+	r->emu = emu;
+	r->irq_fd = emu->irq_fd;
+	reader_compile(r);
+	return 0;
+}
+
+/****************************************************************
+ * reader_set_link
+ *
+ * Negotiates the SPI clock up to max_hz from the next idle time on,
+ * starting at the current one; 0 keeps the clock fixed.
+ ****************************************************************/
+void reader_set_link(struct reader *r, uint32_t max_hz)
+{
+	memset(&r->link, 0, sizeof(r->link));
+	r->link.max_hz = max_hz;
+}
+
+void reader_close(struct reader *r)
+{
+	if (r->emu) {
+		r->irq_fd = -1;
+		r->emu = NULL;
+		return;
+	}
+	if (r->spi_fd >= 0)
+		close(r->spi_fd);
+	if (r->irq_fd >= 0)
+		gpio_fd_close(r->irq_fd);
+	r->spi_fd = -1;
+	r->irq_fd = -1;
+}
+
+/****************************************************************
+ * inventory steps
+ *
+ * Each step sends one flow of trf_flows[] as a single batch. SPI
+ * transfers are synchronous ioctls, so a step is complete when its
+ * function returns; only the air interface is waited for.
+ ****************************************************************/
+static void reader_end_cycle(struct reader *r, READER_RESULT result)
+{
+	uint64_t now_ns = r->now_ns;
+
+	reader_run(r, TRF_FLOW_RF_OFF);
+	TRACE_SPAN("cycle", r->id, r->cycle_start_ns, rfid_now_ns());
+	r->state = READER_IDLE;
+	r->last_end_ns = now_ns;
+	if (r->cycle_ms) {
+		uint64_t period = MS(r->cycle_ms);
+
+		r->deadline_ns = r->period_start_ns + period;
+		if (r->deadline_ns <= now_ns) {
+			uint64_t k = (now_ns - r->deadline_ns) / period + 1;
+
+			r->overruns++;
+			r->skipped += k;
+			r->deadline_ns += k * period;
+		}
+	} else {
+		r->deadline_ns = now_ns;
+	}
+	if (result == READER_RESULT_READ)
+		r->deadline_ns += MS(r->hold_ms);
+	if (r->on_cycle_end)
+		r->on_cycle_end(r, result, now_ns, r->arg);
+}
+
+static int reader_begin_cycle(struct reader *r)
+{
+	r->cycles++;
+	r->cycle_start_ns = r->now_ns;
+	return reader_run(r, TRF_FLOW_INIT) ? 0 : -1;
+}
+
+static int reader_inventory(struct reader *r)
+{
+	r->tx_ns = r->now_ns;
+	TRACE_SPAN("init", r->id, r->cycle_start_ns, r->tx_ns);
+	reader_irq_level(r);
+	return reader_run(r, TRF_FLOW_INVENTORY) ? 0 : -1;
+}
+
+static int reader_tx_done(struct reader *r)
+{
+	struct trf_batch *b = reader_run(r, TRF_FLOW_TX_DONE);
+
+	r->tx_irq_ns = r->now_ns;
+	stats_hist_add(&r->st.tx_irq_us, (r->now_ns - r->tx_ns) / 1000);
+	TRACE_SPAN("inventory tx", r->id, r->tx_ns, r->now_ns);
+	if (!b)
+		return -1;
+	r->st.irq_status[b->rx[0][1]]++;
+	if (b->rx[0][1] != b->flow->expect_irq) {
+		r->irq_errors++;
+		r->link.next_ns = r->now_ns;
+		return -1;
+	}
+	return 0;
+}
+
+static READER_RESULT reader_rx_done(struct reader *r)
+{
+	struct rfid_event ev;
+	struct trf_batch *b;
+	uint8_t status;
+	int i;
+
+	r->irq_ns = r->now_ns;
+	stats_hist_add(&r->st.rx_irq_us, (r->now_ns - r->tx_irq_ns) / 1000);
+	TRACE_SPAN("irq wait", r->id, r->tx_irq_ns, r->now_ns);
+	b = reader_run(r, TRF_FLOW_RX);
+	TRACE_SPAN("fifo read", r->id, r->now_ns, rfid_now_ns());
+	if (!b)
+		return READER_RESULT_ERROR;
+
+	status = b->rx[TRF_RX_IRQ_STATUS][1];
+	r->st.irq_status[status]++;
+	if (b->rx[TRF_RX_FIFO_STATUS][1] <= READER_FIFO_MAX)
+		r->st.fifo_bytes[b->rx[TRF_RX_FIFO_STATUS][1]]++;
+	if (status != b->flow->expect_irq)
+		r->irq_errors++;
+	// Only when bytes to read is 10, the UID in FIFO is correct
+	if (b->rx[TRF_RX_FIFO_STATUS][1] != 10) {
+		PROBE3(rfid, read_rejected, r->id, status, b->rx[TRF_RX_FIFO_STATUS][1]);
+		if (status & TRF_IRQ_NORESP)
+			return READER_RESULT_EMPTY;
+		r->rx_errors++;
+		return READER_RESULT_ERROR;
+	}
+
+	memset(&ev, 0, sizeof(ev));
+	for (i = 0; i < 8; i++)
+		ev.uid[i] = b->rx[TRF_RX_FIFO][10-i];
+	// the chip checked the CRC on air: a UID that is not E0... went wrong on SPI
+	if (ev.uid[0] != 0xE0) {
+		PROBE3(rfid, read_rejected, r->id, status, b->rx[TRF_RX_FIFO_STATUS][1]);
+		r->bad_uids++;
+		r->link.next_ns = r->now_ns;
+		return READER_RESULT_ERROR;
+	}
+	ev.ts_ns = r->irq_ns;
+	ev.type = RFID_EV_READ;
+	ev.rssi = b->rx[TRF_RX_RSSI][1];
+	ev.reader = r->id;
+	ev.flags = RFID_EVF_RSSI_VALID;
+	r->reads++;
+	PROBE3(rfid, read_accepted, r->id, ev.uid, ev.rssi);
+	if (r->on_read) {
+		uint64_t t0 = rfid_now_ns();
+
+		r->on_read(r, &ev, r->arg);
+		TRACE_SPAN("dispatch", r->id, t0, rfid_now_ns());
+	}
+	return READER_RESULT_READ;
+}
+
+/****************************************************************
+ * awaitables
+ *
+ * READER_AWAIT_TIMER  until deadline_ns
+ * READER_AWAIT_IRQ    until the IRQ line rises or the timeout passes;
+ *                     true afterwards if it was the IRQ
+ ****************************************************************/
+#define READER_AWAIT_TIMER(r, st, at)					\
+	do {								\
+		(r)->state = (st);					\
+		(r)->deadline_ns = (at);				\
+		PT_WAIT_UNTIL(&(r)->pt, (r)->now_ns >= (r)->deadline_ns);	\
+	} while (0)
+
+#define READER_AWAIT_IRQ(r, st, timeout_ns)				\
+	do {								\
+		(r)->state = (st);					\
+		(r)->deadline_ns = (r)->now_ns + (timeout_ns);		\
+		(r)->wake &= ~READER_WAKE_IRQ;				\
+		PROBE2(rfid, irq_wait_start, (r)->id, (st));		\
+		PT_WAIT_UNTIL(&(r)->pt, ((r)->wake & READER_WAKE_IRQ) ||	\
+			      (r)->now_ns >= (r)->deadline_ns);		\
+		PROBE3(rfid, irq_wait_end, (r)->id, (st),		\
+		       !!((r)->wake & READER_WAKE_IRQ));		\
+	} while (0)
+
+#define READER_GOT_IRQ(r) ((r)->wake & READER_WAKE_IRQ)
+
+/****************************************************************
+ * reader_session
+ *
+ * 5438_TRF7960_SPI_ISO15693_Single_Slot, one cycle per loop.
+ ****************************************************************/
+static PT_THREAD(reader_session(struct reader *r))
+{
+	PT_BEGIN(&r->pt);
+
+	for (;;) {
+		READER_AWAIT_TIMER(r, READER_IDLE, r->deadline_ns);
+		r->period_start_ns = r->deadline_ns;
+		if (r->link.max_hz && r->now_ns >= r->link.next_ns)
+			reader_link_check(r);
+		if (reader_begin_cycle(r) < 0) {
+			reader_end_cycle(r, READER_RESULT_ERROR);
+			continue;
+		}
+
+		READER_AWAIT_TIMER(r, READER_SETTLE, r->now_ns + READER_SETTLE_US * 1000ull);
+		if (reader_inventory(r) < 0) {
+			reader_end_cycle(r, READER_RESULT_ERROR);
+			continue;
+		}
+
+		READER_AWAIT_IRQ(r, READER_WAIT_TX, MS(READER_TX_TIMEOUT_MS));
+		if (!READER_GOT_IRQ(r)) {
+			r->timeouts++;
+			r->st.tx_timeouts++;
+			reader_end_cycle(r, READER_RESULT_TIMEOUT);
+			continue;
+		}
+		if (reader_tx_done(r) < 0) {
+			reader_end_cycle(r, READER_RESULT_ERROR);
+			continue;
+		}
+
+		READER_AWAIT_IRQ(r, READER_WAIT_RX, MS(READER_RX_TIMEOUT_MS));
+		if (!READER_GOT_IRQ(r)) {
+			r->timeouts++;
+			r->st.rx_timeouts++;
+			reader_end_cycle(r, READER_RESULT_TIMEOUT);
+			continue;
+		}
+		reader_end_cycle(r, reader_rx_done(r));
+	}
+
+	PT_END(&r->pt);
+}
+
+static void reader_resume(struct reader *r, uint64_t now_ns, uint8_t wake)
+{
+	r->now_ns = now_ns;
+	r->wake |= wake;
+	reader_session(r);
+	r->wake = 0;
+}
+
+/****************************************************************
+ * reader_start_inventory
+ *
+ * Starts the inventory cycles, the first one at now_ns.
+ ****************************************************************/
+void reader_start_inventory(struct reader *r, uint64_t now_ns)
+{
+	PT_INIT(&r->pt);
+	r->state = READER_IDLE;
+	r->deadline_ns = now_ns;
+	r->wake = 0;
+}
+
+/****************************************************************
+ * reader_get_fd
+ *
+ * For external event loops: watch reader_get_fd() for
+ * reader_get_events() and call reader_irq() when it fires, and call
+ * reader_timer() once deadline_ns has passed.
+ ****************************************************************/
+int reader_get_fd(const struct reader *r)
+{
+	return r->irq_fd;
+}
+
+uint32_t reader_get_events(const struct reader *r)
+{
+	return r->emu ? EPOLLIN : EPOLLPRI | EPOLLERR;
+}
+
+/****************************************************************
+ * reader_irq
+ *
+ * Called when the IRQ fd reports an edge.
+ ****************************************************************/
+void reader_irq(struct reader *r, uint64_t now_ns)
+{
+	if (reader_irq_level(r))
+		reader_resume(r, now_ns, READER_WAKE_IRQ);
+}
+
+/****************************************************************
+ * reader_timer
+ *
+ * Called when deadline_ns has passed.
+ ****************************************************************/
+void reader_timer(struct reader *r, uint64_t now_ns)
+{
+	uint8_t wake = READER_WAKE_TIMER;
+
+	/* the edge may have been missed: check the line before giving up */
+	if ((r->state == READER_WAIT_TX || r->state == READER_WAIT_RX) && reader_irq_level(r))
+		wake |= READER_WAKE_IRQ;
+	reader_resume(r, now_ns, wake);
+}
+
+/****************************************************************
+ * reader_stats_dump
+ *
+ * stats section of one reader, arg is the struct reader.
+ ****************************************************************/
+void reader_stats_dump(FILE *fp, void *arg)
+{
+	const struct reader *r = arg;
+	const struct reader_stats *st = &r->st;
+	int i;
+
+	fprintf(fp, "  %s: %u cycles, %u reads, %u irq errors, %u rx errors, "
+		"%u tx timeouts, %u rx timeouts\n", r->device, r->cycles, r->reads,
+		r->irq_errors, r->rx_errors, st->tx_timeouts, st->rx_timeouts);
+	fprintf(fp, "  spi %u Hz", r->speed);
+	if (r->link.max_hz)
+		fprintf(fp, " (negotiated, max %u): %u checks, %u/%u tests failed, "
+			"%u steps up, %u fallbacks, %u re-probes", r->link.max_hz, r->link.checks,
+			r->link.test_errors, r->link.tests, r->link.steps_up, r->link.fallbacks,
+			r->link.reprobes);
+	fprintf(fp, ", %u bad UIDs\n", r->bad_uids);
+	for (i = 0; i < TRF_FLOW_COUNT; i++) {
+		if (st->flow_errors[i])
+			fprintf(fp, "  %-12s %u failed\n", trf_flows[i].name, st->flow_errors[i]);
+		stats_hist_print(&st->flow_us[i], trf_flows[i].name, "us", fp);
+	}
+	stats_hist_print(&st->tx_irq_us, "tx->irq", "us", fp);
+	stats_hist_print(&st->rx_irq_us, "irq->rx", "us", fp);
+	fprintf(fp, "  irq status:");
+	for (i = 0; i < 256; i++)
+		if (st->irq_status[i])
+			fprintf(fp, " 0x%.2X=%u", i, st->irq_status[i]);
+	fprintf(fp, "\n  fifo bytes:");
+	for (i = 0; i <= READER_FIFO_MAX; i++)
+		if (st->fifo_bytes[i])
+			fprintf(fp, " %d=%u", i, st->fifo_bytes[i]);
+	fprintf(fp, "\n");
+}
@@ -0,0 +1,164 @@
+/*
+ * reader.h
+ *
+ * One TRF7970A reader: its spidev node, enable line and IRQ line, and the
+ * ISO15693 single slot inventory written as one protothread (see pt.h)
+ * that reads top to bottom like the original blocking sequence but waits
+ * on "timer" and "IRQ edge or deadline" instead of sleeping. It is resumed
+ * by the epoll loop through reader_irq() when the IRQ line rises and
+ * reader_timer() when its deadline passes, so dozens of reader sessions
+ * interleave in one thread with a few dozen bytes of state each.
+ *
+ * With reader_set_link() the SPI clock is negotiated instead of fixed:
+ * between cycles, the session steps the clock up through
+ * reader_link_hz[] as long as READER_LINK_TESTS rounds of register and
+ * FIFO write/read-back patterns come back intact, up to max_hz, and
+ * settles on the last clock that passed. The clock is checked again every
+ * READER_LINK_CHECK_MS, and at once after a read that cannot have come
+ * over a clean bus (a UID that is not ISO15693, or a wrong TX done IRQ
+ * status); while the check fails the clock falls back a step. After
+ * READER_LINK_REPROBE_CHECKS clean checks in a row below the highest
+ * allowed step, one step up is tried again, so a transient error does
+ * not pin the lower clock.
+ */
+
+#ifndef READER_H_
+#define READER_H_
+
+#include <stdint.h>
+
+#include "rfid_event.h"
+#include "pt.h"
+#include "trf_cmd.h"
+#include "stats.h"
+
+#define READER_MAX 32
+#define READER_CYCLE_MS 500        /* default period between inventory starts */
+#define READER_READ_HOLD_MS 1000   /* default extra idle time after a successful read */
+#define READER_SETTLE_US 1000      /* after software init, before configuring */
+#define READER_TX_TIMEOUT_MS 50    /* inventory sent -> TX done IRQ */
+#define READER_RX_TIMEOUT_MS 20    /* TX done -> RX IRQ */
+#define READER_CYCLE_MAX_MS ((READER_SETTLE_US + 999) / 1000 + READER_TX_TIMEOUT_MS + \
+			     READER_RX_TIMEOUT_MS) /* field on, longest cycle */
+#define READER_DEFAULT_SPEED_HZ 3000000
+#define READER_LINK_TESTS 16       /* write/read-back rounds per clock check */
+#define READER_LINK_CHECK_MS 10000 /* revalidation of the negotiated clock */
+#define READER_LINK_REPROBE_CHECKS 6 /* clean checks before a step up is tried again */
+
+typedef enum {
+	READER_IDLE=0,
+	READER_SETTLE,
+	READER_WAIT_TX,
+	READER_WAIT_RX
+} READER_STATE;
+
+#define READER_FIFO_MAX 16         /* TRF7970A FIFO size */
+
+#define READER_WAKE_TIMER 0x01
+#define READER_WAKE_IRQ 0x02
+
+/* how an inventory cycle ended */
+typedef enum {
+	READER_RESULT_READ=0,      /* one UID read */
+	READER_RESULT_EMPTY,       /* no tag answered */
+	READER_RESULT_ERROR,       /* CRC/framing/collision or short FIFO */
+	READER_RESULT_TIMEOUT      /* no IRQ */
+} READER_RESULT;
+
+/* always-on instrumentation of the SPI flows and IRQ waits */
+struct reader_stats {
+	uint32_t flow_runs[TRF_FLOW_COUNT];
+	uint32_t flow_errors[TRF_FLOW_COUNT];
+	struct stats_hist flow_us[TRF_FLOW_COUNT]; /* SPI time of each flow */
+	struct stats_hist tx_irq_us;   /* inventory sent -> TX done IRQ */
+	struct stats_hist rx_irq_us;   /* TX done IRQ -> RX IRQ */
+	uint32_t irq_status[256];      /* IRQ status register values read */
+	uint32_t fifo_bytes[READER_FIFO_MAX + 1]; /* FIFO status after RX */
+	uint32_t tx_timeouts;
+	uint32_t rx_timeouts;
+};
+
+/* SPI clock negotiation, off while max_hz is 0 */
+struct reader_link {
+	uint32_t max_hz;
+	int settled;           /* stepped up as far as it goes */
+	uint64_t next_ns;      /* next check */
+	uint32_t clean_checks; /* in a row, without a fallback */
+	uint32_t checks;
+	uint32_t tests;        /* write/read-back rounds */
+	uint32_t test_errors;
+	uint32_t steps_up;
+	uint32_t fallbacks;
+	uint32_t reprobes;     /* steps up tried again after clean checks */
+};
+
+struct reader;
+struct trf_emu;
+typedef void (*reader_read_cb)(struct reader *r, const struct rfid_event *ev, void *arg);
+typedef void (*reader_cycle_cb)(struct reader *r, READER_RESULT result, uint64_t now_ns, void *arg);
+
+struct reader {
+	int id;
+	const char *device;
+	unsigned int en_gpio;
+	unsigned int irq_gpio;
+
+	/* spidev settings */
+	uint8_t mode;
+	uint8_t bits;
+	uint32_t speed;
+	uint16_t delay;
+
+	int spi_fd;
+	int irq_fd;            /* sysfs value, POLLPRI on the rising edge */
+	struct trf_emu *emu;   /* emulated chip instead of spidev/sysfs */
+	struct trf_batch batch[TRF_FLOW_COUNT]; /* trf_flows compiled at open */
+	struct reader_link link;
+
+	unsigned int cycle_ms;     /* period, 0 = back to back */
+	unsigned int hold_ms;
+
+	struct pt pt;
+	READER_STATE state;    /* where the protothread waits */
+	uint8_t wake;          /* READER_WAKE_* of the current resume */
+	uint64_t now_ns;       /* time of the current resume */
+	uint64_t deadline_ns;  /* timeout of the current wait, or next cycle */
+	uint64_t tx_ns;        /* inventory flow started */
+	uint64_t tx_irq_ns;    /* TX done IRQ */
+	uint64_t irq_ns;
+	uint64_t period_start_ns; /* deadline the current cycle was started for */
+	uint64_t cycle_start_ns; /* RF field on */
+	uint64_t last_end_ns;    /* RF field off */
+
+	reader_read_cb on_read;
+	reader_cycle_cb on_cycle_end; /* may move deadline_ns of the next cycle */
+	void *arg;
+
+	/* statistics */
+	uint32_t cycles;
+	uint32_t reads;
+	uint32_t timeouts;
+	uint32_t irq_errors;
+	uint32_t rx_errors;
+	uint32_t bad_uids;     /* not an ISO15693 UID: corrupted on the bus */
+	uint32_t overruns;     /* cycles that ran past their period */
+	uint32_t skipped;      /* periods lost to overruns */
+	struct reader_stats st;
+};
+
+/****************************************************************
+ * reader API
+ ****************************************************************/
+int reader_parse(struct reader *r, int id, const char *spec);
+int reader_open(struct reader *r);
+int reader_open_emu(struct reader *r, int id, struct trf_emu *emu);
+void reader_set_link(struct reader *r, uint32_t max_hz);
+void reader_close(struct reader *r);
+void reader_start_inventory(struct reader *r, uint64_t now_ns);
+int reader_get_fd(const struct reader *r);
+uint32_t reader_get_events(const struct reader *r);
+void reader_irq(struct reader *r, uint64_t now_ns);
+void reader_timer(struct reader *r, uint64_t now_ns);
+void reader_stats_dump(FILE *fp, void *arg);
+
+#endif /* READER_H_ */
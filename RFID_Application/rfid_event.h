@@ -0,0 +1,45 @@
+/*
+ * rfid_event.h
+ *
+ * Read event passed from the reader loop to local consumers (event bus,
+ * presence tracking, actions).
+ */
+
+#ifndef RFID_EVENT_H_
+#define RFID_EVENT_H_
+
+#include <stdint.h>
+#include <time.h>
+
+typedef enum {
+	RFID_EV_READ=1,        /* every successful inventory */
+	RFID_EV_ARRIVED=2,     /* tag came into range (see presence.h) */
+	RFID_EV_DEPARTED=3     /* tag not seen for the departure timeout, or receded */
+} RFID_EVENT_TYPE;
+
+/* event flags */
+#define RFID_EVF_RSSI_VALID 0x01
+#define RFID_EVF_APPROACHING 0x02
+#define RFID_EVF_RECEDING 0x04
+
+struct rfid_event {
+	uint64_t ts_ns;        /* CLOCK_MONOTONIC, taken at the IRQ of the read */
+	uint8_t uid[8];        /* MSB first, as printed */
+	uint32_t seq;
+	uint8_t type;
+	uint8_t rssi;
+	uint8_t reader;
+	uint8_t flags;
+};
+
+typedef void (*rfid_event_cb)(const struct rfid_event *ev, void *arg);
+
+static inline uint64_t rfid_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+#endif /* RFID_EVENT_H_ */
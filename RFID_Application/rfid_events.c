@@ -0,0 +1,170 @@
+/*
+ * rfid_events.c
+ *
+ * Print events from the reader as they happen, either from the shared
+ * memory event bus or from the reader's event socket with a filter.
+ * Replaces polling uid.txt or scraping stdout; also a minimal example of
+ * both client APIs.
+ *
+ * Usage: rfid_events [-n bus_name]
+ *        rfid_events -S socket [-t read,arrived,departed] [-r min_rssi] [-u uid_prefix]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "eventbus.h"
+#include "evsock.h"
+
+static const char *type_name(uint8_t type)
+{
+	switch (type) {
+	case RFID_EV_READ:
+		return "READ";
+	case RFID_EV_ARRIVED:
+		return "ARRIVED";
+	case RFID_EV_DEPARTED:
+		return "DEPARTED";
+	}
+	return "?";
+}
+
+static void print_event(const struct rfid_event *ev)
+{
+	int i;
+
+	printf("%-8s ", type_name(ev->type));
+	for (i = 0; i < 8; i++)
+		printf("%.2X", ev->uid[i]);
+	printf(" rssi=%u reader=%u\n", ev->rssi, ev->reader);
+}
+
+static int parse_types(const char *arg, uint32_t *mask)
+{
+	char buf[64], *tok, *save;
+
+	snprintf(buf, sizeof(buf), "%s", arg);
+	*mask = 0;
+	for (tok = strtok_r(buf, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+		if (!strcmp(tok, "read"))
+			*mask |= EVSOCK_TYPE_BIT(RFID_EV_READ);
+		else if (!strcmp(tok, "arrived"))
+			*mask |= EVSOCK_TYPE_BIT(RFID_EV_ARRIVED);
+		else if (!strcmp(tok, "departed"))
+			*mask |= EVSOCK_TYPE_BIT(RFID_EV_DEPARTED);
+		else
+			return -1;
+	}
+	return 0;
+}
+
+static int parse_prefix(const char *arg, struct evsock_sub *sub)
+{
+	unsigned int byte;
+	size_t len = strlen(arg);
+
+	if (len % 2 || len > 16)
+		return -1;
+	for (sub->prefix_len = 0; *arg; arg += 2) {
+		if (sscanf(arg, "%2x", &byte) != 1)
+			return -1;
+		sub->prefix[sub->prefix_len++] = byte;
+	}
+	return 0;
+}
+
+static int tail_bus(const char *name)
+{
+	struct bus_reader r;
+	struct rfid_event ev;
+	uint64_t lost = 0;
+	uint32_t reattaches = 0;
+
+	if (bus_attach(&r, name) < 0)
+		return 1;
+
+	while (bus_wait(&r, -1) >= 0) {
+		while (bus_read(&r, &ev) > 0)
+			print_event(&ev);
+		if (r.lost != lost) {
+			fprintf(stderr, "lost %llu events\n", (unsigned long long)(r.lost - lost));
+			lost = r.lost;
+		}
+		if (r.reattaches != reattaches) {
+			fprintf(stderr, "publisher restarted, re-attached to %s\n", name);
+			reattaches = r.reattaches;
+		}
+	}
+
+	bus_detach(&r);
+	return 0;
+}
+
+static int tail_socket(const char *path, const struct evsock_sub *sub)
+{
+	struct rfid_event ev[EVSOCK_MAX_BATCH];
+	uint32_t dropped;
+	int fd, n, i;
+
+	fd = evsock_connect(path, sub);
+	if (fd < 0)
+		return 1;
+
+	while ((n = evsock_recv(fd, ev, EVSOCK_MAX_BATCH, &dropped)) >= 0) {
+		for (i = 0; i < n; i++)
+			print_event(&ev[i]);
+		if (dropped)
+			fprintf(stderr, "dropped %u events\n", dropped);
+	}
+
+	close(fd);
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	const char *name = BUS_DEFAULT_NAME;
+	const char *sock = NULL;
+	struct evsock_sub sub;
+	int c;
+
+	memset(&sub, 0, sizeof(sub));
+	sub.magic = EVSOCK_SUB_MAGIC;
+
+	while ((c = getopt(argc, argv, "n:S:t:r:u:")) != -1) {
+		switch (c) {
+		case 'n':
+			name = optarg;
+			break;
+		case 'S':
+			sock = optarg;
+			break;
+		case 't':
+			if (parse_types(optarg, &sub.type_mask) < 0)
+				goto usage;
+			break;
+		case 'r':
+			sub.min_rssi = atoi(optarg);
+			break;
+		case 'u':
+			if (parse_prefix(optarg, &sub) < 0)
+				goto usage;
+			break;
+		default:
+			goto usage;
+		}
+	}
+
+	setvbuf(stdout, NULL, _IOLBF, 0);
+	if (sock)
+		return tail_socket(sock, &sub);
+	return tail_bus(name);
+
+usage:
+	fprintf(stderr, "Usage: %s [-n bus_name]\n"
+		"       %s -S socket [-t read,arrived,departed] [-r min_rssi] [-u uid_prefix]\n",
+		argv[0], argv[0]);
+	return 1;
+}
@@ -0,0 +1,442 @@
+/*
+ * rfid_fleet.c
+ *
+ * Fleet simulation for load-testing everything downstream of the readers.
+ * Forks -P daemons, each with -N emulated TRF7970A readers (see trf_emu.h)
+ * driven by the daemon's engine, presence tracking and publishing path:
+ * every daemon creates its own event bus "<bus>.<k>" and event socket
+ * "<sock>.<k>" (and, with -j, a journal <dir>/fleet.<k>.jrnl), exactly as
+ * one RFID process per host would, so consumers attach to them unchanged.
+ *
+ * Time is virtual (emu_field.clock, engine_step): the engine jumps from
+ * one reader deadline or emulated IRQ to the next instead of sleeping, and
+ * is paced to -x times real time, or runs as fast as the CPU allows with
+ * -x 0. At -x 1 the virtual clock is CLOCK_MONOTONIC, so event timestamps
+ * can be compared with the consumer's own clock.
+ *
+ * Tags arrive at each reader as a Poisson process of -r arrivals/s, stay an
+ * exponentially distributed time with mean -d ms, and are read with an
+ * RSSI drawn from 0x50-0x7C, and by the -o - 1 next readers as well, each
+ * one weaker, as by overlapping antennas. Reads are merged across readers
+ * within -W ms like in RFID (see aggregate.h). Every visit has a fresh
+ * UID, daemon number in bytes 3-4. The aggregate numbers of all daemons
+ * are printed at the end, and with -v the stats sections of daemon 0.
+ *
+ * Usage: rfid_fleet [-P daemons] [-N readers] [-t seconds] [-x speed]
+ *                   [-r arrivals/s] [-d dwell_ms] [-o readers/tag] [-W window_ms]
+ *                   [-c cycle_ms] [-H hold_ms] [-b bus] [-s sock] [-j dir] [-z seed] [-v]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <math.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include "engine.h"
+#include "trf_emu.h"
+#include "presence.h"
+#include "aggregate.h"
+#include "analytics.h"
+#include "eventbus.h"
+#include "evsock.h"
+#include "journal.h"
+
+#define FLEET_MAX_DAEMONS 512
+#define FLEET_DEFAULT_BUS "/rfid_fleet"
+#define FLEET_DEFAULT_SOCK "/tmp/rfid_fleet"
+#define FLEET_HORIZON_NS 100000000ull  /* arrivals planned this far ahead */
+
+struct fleet_config {
+	int ndaemons;
+	int nreaders;
+	unsigned int seconds;
+	double speed;          /* virtual s per real s, 0 = unpaced */
+	double rate;           /* arrivals/s per reader */
+	unsigned int dwell_ms;
+	int overlap;           /* readers that see each tag */
+	unsigned int window_ms;
+	unsigned int cycle_ms;
+	unsigned int hold_ms;
+	const char *bus;
+	const char *sock;
+	const char *journal_dir;
+	unsigned int seed;
+	int verbose;
+};
+
+/* one per daemon, in memory shared with the parent */
+struct fleet_result {
+	uint32_t reads;
+	uint32_t cycles;
+	uint32_t errors;
+	uint32_t arrivals;
+	uint32_t events[4];    /* published, by RFID_EV_* */
+	uint32_t steps;
+	uint64_t lag_ns_max;   /* virtual clock behind its real time pacing */
+	int done;
+};
+
+static struct emu_field field;
+static struct trf_emu emus[READER_MAX];
+static struct reader readers[READER_MAX];
+static struct engine engine;
+static struct presence presence;
+static struct aggregator aggregator;
+static struct analytics analytics;
+static struct bus bus;
+static struct evsock evsock;
+static struct journal journal;
+static int journal_on;
+static uint64_t vclock;
+static uint32_t visits;
+static struct fleet_result *result;
+static volatile sig_atomic_t running = 1;
+
+static void stop_handler(int sig)
+{
+	running = 0;
+}
+
+static double fleet_exp(unsigned int *seed, double mean)
+{
+	double u = (rand_r(seed) + 1.0) / (RAND_MAX + 2.0);
+
+	return -mean * log(u);
+}
+
+static void emit_event(const struct rfid_event *ev, void *arg)
+{
+	bus_publish(&bus, ev);
+	evsock_publish(&evsock, ev);
+	analytics_event(&analytics, ev);
+	result->events[ev->type & 3]++;
+}
+
+/* the daemon's on_read */
+static void on_read(struct reader *r, const struct rfid_event *read, void *arg)
+{
+	struct rfid_event ev = *read;
+	struct presence_tag *tag;
+
+	if (journal_on)
+		journal_append(&journal, ev.uid, ev.rssi, ev.reader, JREC_F_RSSI_VALID);
+	tag = presence_seen(&presence, &ev, emit_event, NULL);
+	ev.flags |= presence_trend_flags(tag);
+	aggregate_read(&aggregator, &ev, emit_event, NULL);
+}
+
+/* plan arrivals up to horizon_ns; a free tag slot per visit */
+static void fleet_schedule(const struct fleet_config *cfg, int daemon, uint64_t *next_ns, uint64_t horizon_ns)
+{
+	while (*next_ns <= horizon_ns) {
+		uint64_t at = *next_ns;
+		int i, k, first;
+
+		for (i = 0; i < field.ntags; i++) {
+			struct emu_tag *t = &field.tags[i];
+
+			if (t->depart_ns <= at)
+				break;
+		}
+		if (i < field.ntags) {
+			struct emu_tag *t = &field.tags[i];
+
+			memset(t->rssi, 0, sizeof(t->rssi));
+			t->uid[3] = daemon >> 8;
+			t->uid[4] = daemon;
+			t->uid[5] = visits >> 16;
+			t->uid[6] = visits >> 8;
+			t->uid[7] = visits;
+			visits++;
+			first = rand_r(&field.seed);
+			for (k = 0; k < cfg->overlap; k++)
+				t->rssi[(first + k) % cfg->nreaders] = 0x50 + rand_r(&field.seed) % (0x2D - 8 * k);
+			t->arrive_ns = at;
+			t->depart_ns = at + 1 + (uint64_t)(fleet_exp(&field.seed, cfg->dwell_ms) * 1e6);
+			result->arrivals++;
+		}
+		*next_ns += (uint64_t)fleet_exp(&field.seed, 1e9 / (cfg->rate * cfg->nreaders));
+	}
+}
+
+/* hold the virtual clock back to speed times real time */
+static void fleet_pace(const struct fleet_config *cfg, uint64_t start_ns)
+{
+	struct timespec ts;
+	uint64_t at, now;
+
+	if (cfg->speed <= 0)
+		return;
+	at = start_ns + (uint64_t)((vclock - start_ns) / cfg->speed);
+	now = rfid_now_ns();
+	if (now > at) {
+		if (now - at > result->lag_ns_max)
+			result->lag_ns_max = now - at;
+		return;
+	}
+	ts.tv_sec = at / 1000000000ull;
+	ts.tv_nsec = at % 1000000000ull;
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR && running)
+		;
+}
+
+/* one simulated daemon, in its own process */
+static int fleet_daemon(const struct fleet_config *cfg, int daemon, uint64_t start_ns)
+{
+	char name[256];
+	uint64_t end, next, arrival_ns;
+	int i;
+
+	signal(SIGINT, SIG_IGN);
+	signal(SIGTERM, stop_handler);
+
+	emu_field_init(&field, cfg->seed + daemon);
+	field.clock = &vclock;
+	for (i = 0; i < EMU_MAX_TAGS; i++) {
+		uint8_t uid[8] = {0xE0,0x07,0x00,0x00,0x00,0x00,0x00,0x00};
+
+		emu_field_add_tag(&field, uid);
+	}
+
+	snprintf(name, sizeof(name), "%s.%d", cfg->bus, daemon);
+	if (bus_create(&bus, name, BUS_DEFAULT_CAPACITY) < 0)
+		return 1;
+	snprintf(name, sizeof(name), "%s.%d", cfg->sock, daemon);
+	if (evsock_listen(&evsock, name) < 0)
+		return 1;
+	if (cfg->journal_dir) {
+		snprintf(name, sizeof(name), "%s/fleet.%d.jrnl", cfg->journal_dir, daemon);
+		if (journal_open(&journal, name, JOURNAL_DEFAULT_CAPACITY, JOURNAL_DEFAULT_SYNC_MS) < 0)
+			return 1;
+		journal_on = 1;
+	}
+	presence_init(&presence, PRESENCE_DEFAULT_DEPART_MS, 0);
+
+	vclock = start_ns;
+	aggregate_init(&aggregator, cfg->window_ms, vclock);
+	analytics_init(&analytics, ANALYTICS_DEFAULT_WINDOW_S, vclock);
+	if (engine_init(&engine) < 0)
+		return 1;
+	for (i = 0; i < cfg->nreaders; i++) {
+		struct reader *r = &readers[i];
+
+		if (trf_emu_init(&emus[i], &field) < 0 || reader_open_emu(r, i, &emus[i]) < 0)
+			return 1;
+		r->cycle_ms = cfg->cycle_ms;
+		r->hold_ms = cfg->hold_ms;
+		r->on_read = on_read;
+		if (engine_add(&engine, r, vclock) < 0)
+			return 1;
+	}
+
+	/* the daemon's loop, with the wait replaced by the virtual clock */
+	end = start_ns + cfg->seconds * 1000000000ull;
+	arrival_ns = start_ns;
+	while (running) {
+		fleet_schedule(cfg, daemon, &arrival_ns, vclock + FLEET_HORIZON_NS);
+		next = engine_next_ns(&engine);
+		if (next > vclock + FLEET_HORIZON_NS)
+			next = vclock + FLEET_HORIZON_NS;
+		if (next > end)
+			break;
+		if (next > vclock)
+			vclock = next;
+		fleet_pace(cfg, start_ns);
+		engine_step(&engine, vclock);
+		result->steps++;
+
+		presence_expire(&presence, vclock, emit_event, NULL);
+		aggregate_expire(&aggregator, vclock, emit_event, NULL);
+		analytics_tick(&analytics, vclock);
+		evsock_service(&evsock);
+		if (journal_on)
+			journal_sync(&journal, 0);
+	}
+
+	for (i = 0; i < cfg->nreaders; i++) {
+		result->reads += readers[i].reads;
+		result->cycles += readers[i].cycles;
+		result->errors += readers[i].rx_errors;
+	}
+	aggregate_flush(&aggregator, emit_event, NULL);
+	result->done = 1;
+	if (cfg->verbose && !daemon) {
+		stats_register("aggregate", aggregate_stats_dump, &aggregator);
+		stats_register("analytics", analytics_stats_dump, &analytics);
+		printf("[daemon 0]\n");
+		stats_dump(stdout);
+		fflush(stdout);
+	}
+
+	engine_close(&engine);
+	for (i = 0; i < cfg->nreaders; i++)
+		trf_emu_close(&emus[i]);
+	evsock_close(&evsock);
+	bus_destroy(&bus);
+	if (journal_on)
+		journal_close(&journal);
+	return 0;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [-P daemons] [-N readers] [-t seconds] [-x speed]\n"
+		"       [-r arrivals/s] [-d dwell_ms] [-o readers/tag] [-W window_ms]\n"
+		"       [-c cycle_ms] [-H hold_ms] [-b bus] [-s sock] [-j dir] [-z seed] [-v]\n", prog);
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	struct fleet_config cfg = {
+		.ndaemons = 4, .nreaders = 4, .seconds = 10, .speed = 1.0,
+		.rate = 0.2, .dwell_ms = 2000, .overlap = 1,
+		.window_ms = AGGREGATE_DEFAULT_WINDOW_MS, .cycle_ms = READER_CYCLE_MS,
+		.hold_ms = READER_READ_HOLD_MS, .bus = FLEET_DEFAULT_BUS,
+		.sock = FLEET_DEFAULT_SOCK, .journal_dir = NULL, .seed = 1,
+	};
+	struct fleet_result *res, sum;
+	static pid_t pids[FLEET_MAX_DAEMONS];
+	uint64_t start, elapsed;
+	double vsec;
+	int c, i, status, failed = 0;
+
+	while ((c = getopt(argc, argv, "P:N:t:x:r:d:o:W:c:H:b:s:j:z:v")) != -1) {
+		switch (c) {
+		case 'P':
+			cfg.ndaemons = atoi(optarg);
+			break;
+		case 'N':
+			cfg.nreaders = atoi(optarg);
+			break;
+		case 't':
+			cfg.seconds = atoi(optarg);
+			break;
+		case 'x':
+			cfg.speed = atof(optarg);
+			break;
+		case 'r':
+			cfg.rate = atof(optarg);
+			break;
+		case 'd':
+			cfg.dwell_ms = atoi(optarg);
+			break;
+		case 'o':
+			cfg.overlap = atoi(optarg);
+			break;
+		case 'W':
+			cfg.window_ms = atoi(optarg);
+			break;
+		case 'c':
+			cfg.cycle_ms = atoi(optarg);
+			break;
+		case 'H':
+			cfg.hold_ms = atoi(optarg);
+			break;
+		case 'b':
+			cfg.bus = optarg;
+			break;
+		case 's':
+			cfg.sock = optarg;
+			break;
+		case 'j':
+			cfg.journal_dir = optarg;
+			break;
+		case 'z':
+			cfg.seed = atoi(optarg);
+			break;
+		case 'v':
+			cfg.verbose = 1;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (cfg.ndaemons < 1 || cfg.ndaemons > FLEET_MAX_DAEMONS ||
+	    cfg.nreaders < 1 || cfg.nreaders > EMU_MAX_READERS ||
+	    cfg.overlap < 1 || cfg.overlap > cfg.nreaders || cfg.overlap > 5 ||
+	    !cfg.seconds || cfg.rate <= 0 || cfg.speed < 0)
+		usage(argv[0]);
+
+	res = mmap(NULL, cfg.ndaemons * sizeof(*res), PROT_READ | PROT_WRITE,
+		   MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (res == MAP_FAILED) {
+		perror("mmap");
+		return 1;
+	}
+	memset(res, 0, cfg.ndaemons * sizeof(*res));
+
+	signal(SIGINT, stop_handler);
+	signal(SIGTERM, stop_handler);
+	start = rfid_now_ns();
+	for (i = 0; i < cfg.ndaemons; i++) {
+		pids[i] = fork();
+		if (pids[i] < 0) {
+			perror("fork");
+			cfg.ndaemons = i;
+			running = 0;
+			break;
+		}
+		if (pids[i] == 0) {
+			result = &res[i];
+			_exit(fleet_daemon(&cfg, i, start));
+		}
+	}
+
+	for (i = 0; i < cfg.ndaemons; ) {
+		if (!running) {
+			int k;
+
+			for (k = 0; k < cfg.ndaemons; k++)
+				kill(pids[k], SIGTERM);
+			running = 1;  /* forward once */
+		}
+		if (waitpid(pids[i], &status, 0) < 0) {
+			if (errno == EINTR) {
+				running = 0;
+				continue;
+			}
+			perror("waitpid");
+			return 1;
+		}
+		if (!WIFEXITED(status) || WEXITSTATUS(status) || !res[i].done)
+			failed++;
+		i++;
+	}
+	elapsed = rfid_now_ns() - start;
+
+	memset(&sum, 0, sizeof(sum));
+	for (i = 0; i < cfg.ndaemons; i++) {
+		sum.reads += res[i].reads;
+		sum.cycles += res[i].cycles;
+		sum.errors += res[i].errors;
+		sum.arrivals += res[i].arrivals;
+		sum.events[RFID_EV_READ] += res[i].events[RFID_EV_READ];
+		sum.events[RFID_EV_ARRIVED] += res[i].events[RFID_EV_ARRIVED];
+		sum.events[RFID_EV_DEPARTED] += res[i].events[RFID_EV_DEPARTED];
+		sum.steps += res[i].steps;
+		if (res[i].lag_ns_max > sum.lag_ns_max)
+			sum.lag_ns_max = res[i].lag_ns_max;
+	}
+	vsec = cfg.seconds;
+	printf("%d daemons x %d readers, %u s virtual in %.2f s real (%d failed)\n",
+	       cfg.ndaemons, cfg.nreaders, cfg.seconds, elapsed / 1e9, failed);
+	printf("  reads      %10u  %9.1f/s virtual  %9.1f/s real\n",
+	       sum.reads, sum.reads / vsec, sum.reads / (elapsed / 1e9));
+	printf("  published  %10u  %9.1f/s virtual  (reads merged within %u ms)\n",
+	       sum.events[RFID_EV_READ], sum.events[RFID_EV_READ] / vsec, cfg.window_ms);
+	printf("  arrived    %10u  %9.1f/s virtual  (%u tag visits)\n",
+	       sum.events[RFID_EV_ARRIVED], sum.events[RFID_EV_ARRIVED] / vsec, sum.arrivals);
+	printf("  departed   %10u\n", sum.events[RFID_EV_DEPARTED]);
+	printf("  cycles     %10u  %9.1f/s virtual, %u rx errors\n",
+	       sum.cycles, sum.cycles / vsec, sum.errors);
+	printf("  engine steps %8u, pacing lag max %.3f ms\n", sum.steps, sum.lag_ns_max / 1e6);
+	munmap(res, cfg.ndaemons * sizeof(*res));
+	return failed ? 1 : 0;
+}
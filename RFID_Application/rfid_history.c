@@ -0,0 +1,142 @@
+/*
+ * rfid_history.c
+ *
+ * Query the read history store (see history.h), one event per line:
+ *
+ *   2014-05-02 14:03:11.204 E00700000392A286 read rssi=121 reader=0 flags=0x01
+ *
+ * Usage: rfid_history [-d dir] [-u uid] [-D days | -a from -b to] [-v] [-C [-y days]]
+ *   -d   history directory (default "history")
+ *   -u   only this UID, 16 hex digits as printed
+ *   -D   the last days (default 30)
+ *   -a   from this time (seconds since the epoch)
+ *   -b   up to this time (seconds since the epoch)
+ *   -v   print what the query looked at to stderr
+ *   -C   seal and compact the segments once, then query
+ *   -y   with -C, also delete segments older than this many days
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "history.h"
+
+#define NS_PER_S 1000000000ull
+
+static const char *type_name(uint8_t type)
+{
+	switch (type) {
+	case RFID_EV_READ:
+		return "read";
+	case RFID_EV_ARRIVED:
+		return "arrived";
+	case RFID_EV_DEPARTED:
+		return "departed";
+	}
+	return "?";
+}
+
+static void print_rec(const struct history_rec *rec, void *arg)
+{
+	char date[32];
+	time_t sec = rec->ts_ns / NS_PER_S;
+	struct tm tm;
+	int i;
+
+	localtime_r(&sec, &tm);
+	strftime(date, sizeof(date), "%Y-%m-%d %H:%M:%S", &tm);
+	printf("%s.%.3u ", date, (unsigned int)(rec->ts_ns % NS_PER_S / 1000000));
+	for (i = 0; i < 8; i++)
+		printf("%.2X", rec->uid[i]);
+	printf(" %s rssi=%u reader=%u flags=0x%.2X\n", type_name(rec->type),
+	       rec->rssi, rec->reader, rec->flags);
+}
+
+static int parse_uid(const char *s, uint8_t uid[8])
+{
+	unsigned int b;
+	int i;
+
+	if (strlen(s) != 16)
+		return -1;
+	for (i = 0; i < 8; i++) {
+		if (sscanf(s + 2 * i, "%2x", &b) != 1)
+			return -1;
+		uid[i] = b;
+	}
+	return 0;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [-d dir] [-u uid] [-D days | -a from -b to] [-v] [-C [-y days]]\n", prog);
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	const char *dir = HISTORY_DEFAULT_DIR;
+	struct history_query_stats qs;
+	uint64_t now = time(NULL), from = 0, to = 0;
+	unsigned int days = 30, retention_days = 0;
+	int verbose = 0, compact = 0, have_uid = 0;
+	uint32_t sealed = 0, compacted = 0, expired = 0;
+	uint8_t uid[8];
+	int c;
+
+	while ((c = getopt(argc, argv, "d:u:D:a:b:vCy:")) != -1) {
+		switch (c) {
+		case 'd':
+			dir = optarg;
+			break;
+		case 'u':
+			if (parse_uid(optarg, uid) < 0)
+				usage(argv[0]);
+			have_uid = 1;
+			break;
+		case 'D':
+			days = atoi(optarg);
+			break;
+		case 'a':
+			from = strtoull(optarg, NULL, 10);
+			break;
+		case 'b':
+			to = strtoull(optarg, NULL, 10);
+			break;
+		case 'v':
+			verbose = 1;
+			break;
+		case 'C':
+			compact = 1;
+			break;
+		case 'y':
+			retention_days = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (!from && !to && days)
+		from = now > days * 86400ull ? now - days * 86400ull : 0;
+
+	if (compact) {
+		if (history_compact(dir, now / HISTORY_PARTITION_S * HISTORY_PARTITION_S,
+				    retention_days, &sealed, &compacted, &expired) < 0)
+			return 1;
+		if (verbose)
+			fprintf(stderr, "%u hours sealed, %u days compacted, %u segments expired\n",
+				sealed, compacted, expired);
+	}
+
+	if (history_query(dir, have_uid ? uid : NULL, from * NS_PER_S, to * NS_PER_S,
+			  print_rec, NULL, &qs) < 0)
+		return 1;
+	if (verbose)
+		fprintf(stderr, "%u segments in range, %u skipped by the bloom filter, "
+			"%u unsealed records scanned, %u matched\n",
+			qs.segments, qs.bloom_skipped, qs.active_scanned, qs.matched);
+	return 0;
+}
@@ -0,0 +1,74 @@
+/*
+ * rfid_journal.c
+ *
+ * Export a binary read journal (see journal.h) as text, one read per line:
+ *
+ *   2014-05-02 14:03:11.204 E00700000392A286 rssi=121 reader=0 flags=0x0001
+ *
+ * Usage: rfid_journal [-c] [journal ...]
+ *   -c   only print records that have been committed to stable storage
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "journal.h"
+
+static void print_rec(const struct journal_rec *rec)
+{
+	char date[32];
+	time_t sec = rec->ts_ns / 1000000000ull;
+	struct tm tm;
+	int i;
+
+	localtime_r(&sec, &tm);
+	strftime(date, sizeof(date), "%Y-%m-%d %H:%M:%S", &tm);
+	printf("%s.%.3u ", date, (unsigned int)(rec->ts_ns % 1000000000ull / 1000000));
+	for (i = 0; i < 8; i++)
+		printf("%.2X", rec->uid[i]);
+	printf(" rssi=%u reader=%u flags=0x%.4X\n", rec->rssi, rec->reader, rec->flags);
+}
+
+static int dump(const char *path, int committed_only)
+{
+	struct journal j;
+	uint32_t i, n;
+
+	if (journal_open_ro(&j, path) < 0)
+		return -1;
+
+	n = committed_only ? j.hdr->count : j.next;
+	for (i = 0; i < n; i++)
+		print_rec(&j.recs[i]);
+
+	journal_close(&j);
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	int committed_only = 0;
+	int c, ret = 0;
+
+	while ((c = getopt(argc, argv, "c")) != -1) {
+		switch (c) {
+		case 'c':
+			committed_only = 1;
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-c] [journal ...]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	if (optind == argc)
+		return dump(JOURNAL_DEFAULT_PATH, committed_only) < 0;
+
+	for (; optind < argc; optind++)
+		if (dump(argv[optind], committed_only) < 0)
+			ret = 1;
+	return ret;
+}
@@ -0,0 +1,182 @@
+/*
+ * rfid_latency.c
+ *
+ * End-to-end latency benchmark: tag enters the field -> action done, on
+ * an emulated TRF7970A (see trf_emu.h) driven by the same engine,
+ * presence matching and dispatcher as unlockDemo. Each trial puts the tag
+ * in the field at a random point of the reader period, waits for the
+ * action (-a, run like the unlock script) to exit, takes the tag away and
+ * waits for it to depart. Percentiles are printed for
+ *
+ *   detect  tag in the field -> IRQ of the read that made it ARRIVE
+ *   action  that IRQ -> action exited with status 0
+ *   total   tag in the field -> action done
+ *
+ * Usage: rfid_latency [-n trials] [-a action] [-c cycle_ms] [-H hold_ms]
+ *                     [-P depart_ms] [-z seed]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "engine.h"
+#include "trf_emu.h"
+#include "presence.h"
+#include "dispatch.h"
+#include "stats.h"
+
+static struct emu_field field;
+static struct trf_emu emu;
+static struct reader reader;
+static struct engine engine;
+static struct presence presence;
+static struct dispatcher actions;
+static int present;
+
+static void on_presence(const struct rfid_event *ev, void *arg)
+{
+	if (ev->type == RFID_EV_ARRIVED) {
+		present = 1;
+		dispatch_run(arg, "action", ev->ts_ns);
+	} else if (ev->type == RFID_EV_DEPARTED) {
+		present = 0;
+	}
+}
+
+static void on_read(struct reader *r, const struct rfid_event *ev, void *arg)
+{
+	presence_seen(&presence, ev, on_presence, &actions);
+}
+
+/* run the loop until done() or the timeout */
+static int run_until(int (*done)(void), uint64_t timeout_ns)
+{
+	uint64_t end = rfid_now_ns() + timeout_ns;
+
+	while (!done()) {
+		if (rfid_now_ns() >= end)
+			return -1;
+		if (engine_run_once(&engine, 100) < 0)
+			exit(1);
+		presence_expire(&presence, rfid_now_ns(), on_presence, &actions);
+		dispatch_reap(&actions);
+	}
+	return 0;
+}
+
+static uint32_t completed_before;
+
+static int action_done(void)
+{
+	return actions.actions[0].completed > completed_before;
+}
+
+static int departed(void)
+{
+	return !present;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [-n trials] [-a action] [-c cycle_ms] [-H hold_ms]\n"
+		"       [-P depart_ms] [-z seed]\n", prog);
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	const char *action = "/bin/true";
+	unsigned int trials = 20, cycle_ms = READER_CYCLE_MS, hold_ms = READER_READ_HOLD_MS;
+	unsigned int depart_ms = 300, seed = 1, n, failed = 0, failed_before;
+	struct stats_hist detect, act, total;
+	struct dispatch_action *a;
+	struct emu_tag *t;
+	uint8_t uid[8] = {0xE0,0x07,0x00,0x00,0x03,0x92,0xA2,0x86};
+	int c;
+
+	while ((c = getopt(argc, argv, "n:a:c:H:P:z:")) != -1) {
+		switch (c) {
+		case 'n':
+			trials = atoi(optarg);
+			break;
+		case 'a':
+			action = optarg;
+			break;
+		case 'c':
+			cycle_ms = atoi(optarg);
+			break;
+		case 'H':
+			hold_ms = atoi(optarg);
+			break;
+		case 'P':
+			depart_ms = atoi(optarg);
+			break;
+		case 'z':
+			seed = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (!trials)
+		usage(argv[0]);
+
+	emu_field_init(&field, seed);
+	t = emu_field_add_tag(&field, uid);
+	t->rssi[0] = 0x70;
+	t->arrive_ns = ~0ull;  /* not in the field yet */
+
+	presence_init(&presence, depart_ms, 0);
+	dispatch_init(&actions);
+	a = dispatch_add(&actions, "action", action, 0);
+	memset(&detect, 0, sizeof(detect));
+	memset(&act, 0, sizeof(act));
+	memset(&total, 0, sizeof(total));
+
+	if (trf_emu_init(&emu, &field) < 0 || reader_open_emu(&reader, 0, &emu) < 0)
+		exit(1);
+	reader.cycle_ms = cycle_ms;
+	reader.hold_ms = hold_ms;
+	reader.on_read = on_read;
+	if (engine_init(&engine) < 0 || engine_add(&engine, &reader, rfid_now_ns()) < 0)
+		exit(1);
+
+	for (n = 0; n < trials; n++) {
+		uint64_t arrive, ready, period = (cycle_ms ? cycle_ms : 10) * 1000000ull;
+
+		/* arrive at a random point of the reader period */
+		arrive = rfid_now_ns() + (uint64_t)(rand_r(&field.seed) % 1000) * period / 1000;
+		t->arrive_ns = arrive;
+		t->depart_ns = 0;
+		completed_before = a->completed;
+		failed_before = a->failed;
+		if (run_until(action_done, 10 * period + 5000000000ull) < 0 ||
+		    a->failed != failed_before) {
+			fprintf(stderr, "trial %u: action not done\n", n);
+			failed++;
+		} else {
+			ready = a->req_ns + a->run_ns_last;
+			stats_hist_add(&detect, (a->req_ns - arrive) / 1000);
+			stats_hist_add(&act, a->run_ns_last / 1000);
+			stats_hist_add(&total, (ready - arrive) / 1000);
+		}
+
+		t->depart_ns = rfid_now_ns();
+		if (run_until(departed, 10 * period + depart_ms * 1000000ull) < 0) {
+			fprintf(stderr, "trial %u: tag did not depart\n", n);
+			exit(1);
+		}
+		t->arrive_ns = ~0ull;
+	}
+
+	printf("%u trials, %u failed, cycle %u ms, hold %u ms, action %s\n",
+	       trials, failed, cycle_ms, hold_ms, action);
+	stats_hist_print(&detect, "detect", "us", stdout);
+	stats_hist_print(&act, "action", "us", stdout);
+	stats_hist_print(&total, "total", "us", stdout);
+	engine_close(&engine);
+	trf_emu_close(&emu);
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,176 @@
+/*
+ * rfid_sim.c
+ *
+ * Offline comparison of reader schedules (see tdma.h) against emulated
+ * TRF7970A readers (see trf_emu.h). Every reader has one tag of its own in
+ * its field; readers couple into each other as given with -p, or in a
+ * line (each reader with its neighbours) with -c percent by default.
+ * Each policy runs the daemon's engine for the given time, then reads/s
+ * and the error rate of the group are printed.
+ *
+ * Usage: rfid_sim [-n readers] [-t seconds] [-c pct] [-p a-b:pct ...]
+ *                 [-s slot_ms] [-x shared|rr|adaptive] [-z seed] [-v]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "engine.h"
+#include "tdma.h"
+#include "trf_emu.h"
+#include "trace.h"
+
+static struct emu_field field;
+static struct trf_emu emus[READER_MAX];
+static struct reader readers[READER_MAX];
+static struct tdma tdma;
+
+static void on_cycle_end(struct reader *r, READER_RESULT result, uint64_t now_ns, void *arg)
+{
+	tdma_cycle_end(&tdma, r, result, now_ns);
+}
+
+static void run(int nreaders, TDMA_POLICY policy, unsigned int slot_ms, unsigned int seconds, int verbose)
+{
+	struct engine engine;
+	uint64_t now, end;
+	uint32_t reads = 0, errors = 0, cycles = 0;
+	int i;
+
+	for (i = 0; i < field.nreaders; i++)
+		trf_emu_close(field.readers[i]);
+	field.nreaders = 0;
+
+	if (engine_init(&engine) < 0)
+		exit(1);
+	now = rfid_now_ns();
+	tdma_init(&tdma, policy, slot_ms, now);
+	for (i = 0; i < nreaders; i++) {
+		if (trf_emu_init(&emus[i], &field) < 0 ||
+		    reader_open_emu(&readers[i], i, &emus[i]) < 0)
+			exit(1);
+		readers[i].cycle_ms = 0;
+		readers[i].hold_ms = 0;
+		readers[i].on_cycle_end = on_cycle_end;
+		tdma_add(&tdma, &readers[i]);
+		if (engine_add(&engine, &readers[i], tdma_next_start(&tdma, &readers[i], now)) < 0)
+			exit(1);
+	}
+
+	end = now + seconds * 1000000000ull;
+	while (rfid_now_ns() < end)
+		if (engine_run_once(&engine, 100) < 0)
+			exit(1);
+
+	for (i = 0; i < nreaders; i++) {
+		reads += readers[i].reads;
+		errors += readers[i].rx_errors;
+		cycles += readers[i].cycles;
+	}
+	printf("%-9s %2d slot(s)  %7.1f reads/s  %7.1f cycles/s  %5.1f%% errors\n",
+	       tdma_policy_name(policy), tdma.nslots, (double)reads / seconds,
+	       (double)cycles / seconds, reads + errors ? errors * 100.0 / (reads + errors) : 0.0);
+	if (verbose) {
+		tdma_report(&tdma, stdout);
+		engine_report(&engine, stdout);
+		for (i = 0; i < nreaders; i++) {
+			printf("[reader %d]\n", i);
+			reader_stats_dump(stdout, &readers[i]);
+		}
+	}
+	engine_close(&engine);
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [-n readers] [-t seconds] [-c pct] [-p a-b:pct ...]\n"
+		"       [-s slot_ms] [-x shared|rr|adaptive] [-z seed] [-o trace.json] [-v]\n", prog);
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned int seconds = 10, slot_ms = TDMA_DEFAULT_SLOT_MS, seed = 1;
+	int nreaders = 4, coupling = 60, pairs = 0, policy = -1, verbose = 0;
+	const char *trace_path = NULL;
+	int c, a, b, pct, i;
+	uint8_t uid[8];
+
+	memset(field.coupling, 0, sizeof(field.coupling));
+	while ((c = getopt(argc, argv, "n:t:c:p:s:x:z:o:v")) != -1) {
+		switch (c) {
+		case 'n':
+			nreaders = atoi(optarg);
+			break;
+		case 't':
+			seconds = atoi(optarg);
+			break;
+		case 'c':
+			coupling = atoi(optarg);
+			break;
+		case 'p':
+			if (sscanf(optarg, "%d-%d:%d", &a, &b, &pct) != 3 ||
+			    a < 0 || b < 0 || a >= READER_MAX || b >= READER_MAX)
+				usage(argv[0]);
+			field.coupling[a][b] = field.coupling[b][a] = pct;
+			pairs++;
+			break;
+		case 's':
+			slot_ms = atoi(optarg);
+			break;
+		case 'x':
+			policy = tdma_parse_policy(optarg);
+			if (policy < 0)
+				usage(argv[0]);
+			break;
+		case 'z':
+			seed = atoi(optarg);
+			break;
+		case 'o':
+			trace_path = optarg;
+			break;
+		case 'v':
+			verbose = 1;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (nreaders < 1 || nreaders > READER_MAX || !seconds)
+		usage(argv[0]);
+
+	/* field.coupling survives emu_field_init only through a copy */
+	{
+		uint8_t saved[EMU_MAX_READERS][EMU_MAX_READERS];
+
+		memcpy(saved, field.coupling, sizeof(saved));
+		emu_field_init(&field, seed);
+		memcpy(field.coupling, saved, sizeof(saved));
+	}
+	if (!pairs)
+		for (i = 0; i + 1 < nreaders; i++)
+			field.coupling[i][i + 1] = field.coupling[i + 1][i] = coupling;
+
+	for (i = 0; i < nreaders; i++) {
+		struct emu_tag *t;
+
+		memcpy(uid, "\xE0\x07\x00\x00\x03\x92\xA2\x00", 8);
+		uid[7] = i;
+		t = emu_field_add_tag(&field, uid);
+		t->rssi[i] = 0x70;
+	}
+
+	if (trace_path && trace_open(trace_path) < 0)
+		exit(1);
+	if (policy >= 0) {
+		run(nreaders, policy, slot_ms, seconds, verbose);
+	} else {
+		run(nreaders, TDMA_SHARED, slot_ms, seconds, verbose);
+		run(nreaders, TDMA_ROUND_ROBIN, slot_ms, seconds, verbose);
+		run(nreaders, TDMA_ADAPTIVE, slot_ms, seconds, verbose);
+	}
+	trace_close();
+	return 0;
+}
@@ -0,0 +1,81 @@
+/*
+ * rssi.c
+ *
+ * Per-tag RSSI smoothing, see rssi.h.
+ */
+
+#include "rssi.h"
+
+void rssi_add(struct rssi_track *t, uint8_t rssi)
+{
+	t->ring[t->head] = rssi;
+	t->head = (t->head + 1) & (RSSI_HIST_LEN - 1);
+	if (t->count < RSSI_HIST_LEN)
+		t->count++;
+}
+
+/* i-th oldest sample still in the ring */
+static uint8_t rssi_at(const struct rssi_track *t, int i)
+{
+	return t->ring[(t->head - t->count + i) & (RSSI_HIST_LEN - 1)];
+}
+
+uint8_t rssi_median(const struct rssi_track *t)
+{
+	uint8_t v[RSSI_HIST_LEN], x;
+	int i, j;
+
+	if (!t->count)
+		return 0;
+
+	/* insertion sort, at most RSSI_HIST_LEN entries */
+	for (i = 0; i < t->count; i++) {
+		x = rssi_at(t, i);
+		for (j = i; j > 0 && v[j - 1] > x; j--)
+			v[j] = v[j - 1];
+		v[j] = x;
+	}
+	return v[t->count / 2];
+}
+
+/****************************************************************
+ * rssi_trend
+ *
+ * Compares the mean of the newer half of the ring with the older half;
+ * a difference of a whole step or more is a trend.
+ ****************************************************************/
+RSSI_TREND rssi_trend(const struct rssi_track *t)
+{
+	int half = t->count / 2;
+	int older = 0, newer = 0, i;
+
+	if (half < 2)
+		return RSSI_STEADY;
+
+	for (i = 0; i < half; i++) {
+		older += rssi_at(t, t->count - 2 * half + i);
+		newer += rssi_at(t, t->count - half + i);
+	}
+	if (newer - older >= half)
+		return RSSI_APPROACHING;
+	if (older - newer >= half)
+		return RSSI_RECEDING;
+	return RSSI_STEADY;
+}
+
+/****************************************************************
+ * rssi_near
+ *
+ * Proximity gate with hysteresis. A threshold of 0 disables gating.
+ ****************************************************************/
+int rssi_near(const struct rssi_track *t, uint8_t threshold, int was_near)
+{
+	uint8_t m;
+
+	if (!threshold)
+		return 1;
+	m = rssi_median(t);
+	if (was_near)
+		return m + RSSI_HYSTERESIS >= threshold;
+	return m >= threshold;
+}
@@ -0,0 +1,35 @@
+/*
+ * rssi.h
+ *
+ * Per-tag RSSI history. The last RSSI_HIST_LEN readings of register 0x0F
+ * are kept in a ring; the median is used for proximity decisions because
+ * single readings jump by several steps at the edge of the field, and the
+ * ring halves are compared for a trend.
+ */
+
+#ifndef RSSI_H_
+#define RSSI_H_
+
+#include <stdint.h>
+
+#define RSSI_HIST_LEN 8        /* power of two */
+#define RSSI_HYSTERESIS 2      /* steps a near tag may drop below the threshold */
+
+typedef enum {
+	RSSI_STEADY=0,
+	RSSI_APPROACHING=1,
+	RSSI_RECEDING=2
+} RSSI_TREND;
+
+struct rssi_track {
+	uint8_t ring[RSSI_HIST_LEN];
+	uint8_t head;
+	uint8_t count;
+};
+
+void rssi_add(struct rssi_track *t, uint8_t rssi);
+uint8_t rssi_median(const struct rssi_track *t);
+RSSI_TREND rssi_trend(const struct rssi_track *t);
+int rssi_near(const struct rssi_track *t, uint8_t threshold, int was_near);
+
+#endif /* RSSI_H_ */
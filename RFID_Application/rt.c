@@ -0,0 +1,61 @@
+/*
+ * rt.c
+ *
+ * Real-time mode, see rt.h.
+ */
+
+#define _GNU_SOURCE
+#include "rt.h"
+#include <string.h>
+#include <sched.h>
+#include <sys/mman.h>
+
+/* touch the stack now so that the loop never faults it in */
+static void __attribute__((noinline)) rt_prefault_stack(void)
+{
+	volatile unsigned char stack[RT_STACK_PREFAULT];
+	size_t i;
+
+	for (i = 0; i < sizeof(stack); i += 4096)
+		stack[i] = 0;
+}
+
+/****************************************************************
+ * rt_enter
+ *
+ * prio 0 leaves the scheduling class alone, cpu < 0 leaves the
+ * affinity alone. Returns -1 if any step failed; the others still
+ * apply.
+ ****************************************************************/
+int rt_enter(int prio, int cpu)
+{
+	struct sched_param param;
+	int ret = 0;
+
+	if (mlockall(MCL_CURRENT | MCL_FUTURE) < 0) {
+		perror("rt/mlockall");
+		ret = -1;
+	}
+	rt_prefault_stack();
+
+	if (cpu >= 0) {
+		cpu_set_t set;
+
+		CPU_ZERO(&set);
+		CPU_SET(cpu, &set);
+		if (sched_setaffinity(0, sizeof(set), &set) < 0) {
+			perror("rt/sched_setaffinity");
+			ret = -1;
+		}
+	}
+
+	if (prio > 0) {
+		memset(&param, 0, sizeof(param));
+		param.sched_priority = prio;
+		if (sched_setscheduler(0, SCHED_FIFO, &param) < 0) {
+			perror("rt/sched_setscheduler");
+			ret = -1;
+		}
+	}
+	return ret;
+}
@@ -0,0 +1,24 @@
+/*
+ * rt.h
+ *
+ * Real-time execution of the acquisition thread: SCHED_FIFO at a given
+ * priority, all memory locked, the stack pre-faulted so that no page
+ * fault happens in the loop, and the thread pinned to one CPU so that it
+ * does not migrate away from its cache or share a core with the video
+ * pipeline.
+ */
+
+#ifndef RT_H_
+#define RT_H_
+
+#include <stdio.h>
+
+#define RT_DEFAULT_PRIO 50
+#define RT_STACK_PREFAULT (256 * 1024)
+
+/****************************************************************
+ * rt API
+ ****************************************************************/
+int rt_enter(int prio, int cpu);
+
+#endif /* RT_H_ */
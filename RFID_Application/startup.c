@@ -0,0 +1,196 @@
+/*
+ * startup.c
+ *
+ * Cold start helpers, see startup.h.
+ */
+
+#include "startup.h"
+#include "rfid_event.h"
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <limits.h>
+#include <sys/inotify.h>
+#include <signal.h>
+#include <sys/wait.h>
+
+struct startup_mark {
+	const char *name;
+	uint64_t ns;
+};
+
+static struct startup_mark phases[STARTUP_MAX_PHASES];
+static int nphases;
+static uint64_t begin_ns, last_ns;
+
+/****************************************************************
+ * startup_begin
+ ****************************************************************/
+void startup_begin(void)
+{
+	begin_ns = last_ns = rfid_now_ns();
+	nphases = 0;
+}
+
+/****************************************************************
+ * startup_phase
+ *
+ * Ends the phase called name, which started at the previous mark.
+ ****************************************************************/
+void startup_phase(const char *name)
+{
+	uint64_t now = rfid_now_ns();
+
+	if (nphases < STARTUP_MAX_PHASES) {
+		phases[nphases].name = name;
+		phases[nphases].ns = now - last_ns;
+		nphases++;
+	}
+	last_ns = now;
+}
+
+/****************************************************************
+ * startup_wait_path
+ *
+ * Waits until path exists; -1 with errno ETIMEDOUT after timeout_ms.
+ ****************************************************************/
+int startup_wait_path(const char *path, unsigned int timeout_ms)
+{
+	uint64_t deadline = rfid_now_ns() + timeout_ms * 1000000ull;
+	char dir[PATH_MAX], buf[1024];
+	struct pollfd pfd;
+	char *slash;
+	int wd = -1, wait_ms;
+
+	if (access(path, F_OK) == 0)
+		return 0;
+
+	snprintf(dir, sizeof(dir), "%s", path);
+	slash = strrchr(dir, '/');
+	if (!slash)
+		strcpy(dir, ".");
+	else if (slash == dir)
+		dir[1] = '\0';
+	else
+		*slash = '\0';
+
+	pfd.fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	pfd.events = POLLIN;
+	if (pfd.fd >= 0)
+		wd = inotify_add_watch(pfd.fd, dir, IN_CREATE | IN_MOVED_TO | IN_ATTRIB);
+
+	/* checked after the watch is in place, so a creation is not missed */
+	while (access(path, F_OK) < 0) {
+		uint64_t now = rfid_now_ns();
+
+		if (now >= deadline) {
+			if (pfd.fd >= 0)
+				close(pfd.fd);
+			errno = ETIMEDOUT;
+			return -1;
+		}
+		wait_ms = (deadline - now + 999999) / 1000000;
+		if (wd < 0 || !strncmp(path, "/sys/", 5))
+			wait_ms = wait_ms < STARTUP_POLL_MS ? wait_ms : STARTUP_POLL_MS;
+		if (poll(&pfd, wd < 0 ? 0 : 1, wait_ms) > 0)
+			while (read(pfd.fd, buf, sizeof(buf)) > 0)
+				;
+	}
+	if (pfd.fd >= 0)
+		close(pfd.fd);
+	return 0;
+}
+
+/*
+ * Waits for the overlay script up to the deadline; one still running then
+ * is stopped, so it is not left behind as a zombie. A failure is logged.
+ */
+static void startup_reap(pid_t pid, uint64_t deadline)
+{
+	int status;
+	pid_t ret;
+
+	while ((ret = waitpid(pid, &status, WNOHANG)) == 0 && rfid_now_ns() < deadline)
+		poll(NULL, 0, STARTUP_POLL_MS);
+	if (ret == 0) {
+		fprintf(stderr, "%s: still running, stopped\n", STARTUP_OVERLAY_SCRIPT);
+		kill(pid, SIGTERM);
+		ret = waitpid(pid, &status, 0);
+	}
+	if (ret < 0) {
+		perror("startup/waitpid");
+		return;
+	}
+	if (WIFEXITED(status) && WEXITSTATUS(status))
+		fprintf(stderr, "%s: exit status %d\n", STARTUP_OVERLAY_SCRIPT, WEXITSTATUS(status));
+	else if (WIFSIGNALED(status) && WTERMSIG(status) != SIGTERM)
+		fprintf(stderr, "%s: killed by signal %d\n", STARTUP_OVERLAY_SCRIPT, WTERMSIG(status));
+}
+
+/****************************************************************
+ * startup_spi_overlay
+ *
+ * Runs STARTUP_OVERLAY_SCRIPT (with argv) unless all the spidev nodes in
+ * devices are there already, e.g. on a restart, and waits for them for
+ * up to timeout_ms in total. Returns the number of missing nodes.
+ ****************************************************************/
+int startup_spi_overlay(char *argv[], const char *const devices[], int n, unsigned int timeout_ms)
+{
+	uint64_t deadline, now;
+	int i, missing = 0;
+	pid_t pid;
+
+	for (i = 0; i < n; i++)
+		if (access(devices[i], F_OK) < 0)
+			break;
+	if (i == n)
+		return 0;
+
+	pid = fork();
+	if (pid == 0) {
+		execv(STARTUP_OVERLAY_SCRIPT, argv);
+		perror(STARTUP_OVERLAY_SCRIPT);
+		_exit(127);
+	}
+	if (pid < 0)
+		perror("startup/fork");
+
+	deadline = rfid_now_ns() + timeout_ms * 1000000ull;
+	for (i = 0; i < n; i++) {
+		now = rfid_now_ns();
+		if (startup_wait_path(devices[i], now < deadline ?
+				      (deadline - now) / 1000000 : 0) < 0) {
+			fprintf(stderr, "%s: not there after %u ms\n", devices[i], timeout_ms);
+			missing++;
+		}
+	}
+	if (pid > 0)
+		startup_reap(pid, deadline);
+	return missing;
+}
+
+/****************************************************************
+ * startup_report
+ ****************************************************************/
+void startup_report(FILE *fp)
+{
+	int i;
+
+	fprintf(fp, "startup %.1f ms:", (last_ns - begin_ns) / 1e6);
+	for (i = 0; i < nphases; i++)
+		fprintf(fp, "%s %s %.1f", i ? "," : "", phases[i].name, phases[i].ns / 1e6);
+	fprintf(fp, "\n");
+}
+
+/****************************************************************
+ * startup_stats_dump
+ *
+ * stats section of the startup phases, arg is unused.
+ ****************************************************************/
+void startup_stats_dump(FILE *fp, void *arg)
+{
+	fprintf(fp, "  ");
+	startup_report(fp);
+}
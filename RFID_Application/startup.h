@@ -0,0 +1,38 @@
+/*
+ * startup.h
+ *
+ * Cold start of a reader daemon. Every restart is a window of missed
+ * reads, so startup waits for what it needs instead of sleeping: the SPI
+ * overlay is only applied when a spidev node is missing, and its nodes are
+ * then waited for with inotify on their directory, up to a timeout, and the
+ * script is reaped within the same timeout. Paths in sysfs, such as the
+ * value files of newly exported GPIO lines, are not reported by inotify
+ * and are checked again every STARTUP_POLL_MS.
+ *
+ * Startup is split into named phases (startup_phase ends one); the
+ * breakdown is printed once the readers are running and kept in the
+ * stats section "startup".
+ */
+
+#ifndef STARTUP_H_
+#define STARTUP_H_
+
+#include <stdio.h>
+#include <stdint.h>
+
+#define STARTUP_OVERLAY_SCRIPT "/home/root/BBB_SPI/spiDeviceTreeInit.sh"
+#define STARTUP_DEFAULT_TIMEOUT_MS 2000
+#define STARTUP_POLL_MS 5
+#define STARTUP_MAX_PHASES 16
+
+/****************************************************************
+ * startup API
+ ****************************************************************/
+void startup_begin(void);
+void startup_phase(const char *name);
+int startup_wait_path(const char *path, unsigned int timeout_ms);
+int startup_spi_overlay(char *argv[], const char *const devices[], int n, unsigned int timeout_ms);
+void startup_report(FILE *fp);
+void startup_stats_dump(FILE *fp, void *arg);
+
+#endif /* STARTUP_H_ */
@@ -0,0 +1,181 @@
+/*
+ * stats.c
+ *
+ * Counters, histograms and the stats section registry, see stats.h.
+ */
+
+#include "stats.h"
+#include <stdio.h>
+#include <string.h>
+#include <signal.h>
+
+struct stats_section {
+	const char *name;
+	stats_dump_fn fn;
+	void *arg;
+};
+
+static struct stats_section sections[STATS_MAX_SECTIONS];
+static int nsections;
+static volatile sig_atomic_t requested;
+
+/* values 0..3 have a bucket each, then 4 per power of two */
+static int stats_bucket(uint32_t v)
+{
+	int e;
+
+	if (v < 4)
+		return v;
+	e = 31 - __builtin_clz(v);
+	return (e - 1) * 4 + ((v >> (e - 2)) & 3);
+}
+
+/* smallest value that falls into bucket b */
+static uint32_t stats_bucket_floor(int b)
+{
+	if (b < 4)
+		return b;
+	return (uint32_t)(4 + b % 4) << (b / 4 - 1);
+}
+
+/****************************************************************
+ * stats_hist_add
+ ****************************************************************/
+void stats_hist_add(struct stats_hist *h, uint32_t v)
+{
+	if (!h->count || v < h->min)
+		h->min = v;
+	if (v > h->max)
+		h->max = v;
+	h->count++;
+	h->sum += v;
+	h->buckets[stats_bucket(v)]++;
+}
+
+/****************************************************************
+ * stats_hist_percentile
+ *
+ * Lower bound of the bucket holding the pct-th percentile, clamped
+ * to the observed min/max.
+ ****************************************************************/
+uint32_t stats_hist_percentile(const struct stats_hist *h, unsigned int pct)
+{
+	uint64_t rank, seen = 0;
+	uint32_t v;
+	int b;
+
+	if (!h->count)
+		return 0;
+	rank = (h->count * pct + 99) / 100;
+	if (!rank)
+		rank = 1;
+	for (b = 0; b < STATS_HIST_BUCKETS; b++) {
+		seen += h->buckets[b];
+		if (seen >= rank)
+			break;
+	}
+	v = stats_bucket_floor(b);
+	if (v < h->min)
+		v = h->min;
+	if (v > h->max)
+		v = h->max;
+	return v;
+}
+
+void stats_hist_print(const struct stats_hist *h, const char *name, const char *unit, FILE *fp)
+{
+	if (!h->count) {
+		fprintf(fp, "  %-12s 0\n", name);
+		return;
+	}
+	fprintf(fp, "  %-12s %llu, min %u, avg %llu, p50 %u, p90 %u, p99 %u, max %u %s\n",
+		name, (unsigned long long)h->count, h->min,
+		(unsigned long long)(h->sum / h->count),
+		stats_hist_percentile(h, 50), stats_hist_percentile(h, 90),
+		stats_hist_percentile(h, 99), h->max, unit);
+}
+
+/* {"count":..,"min":..,"avg":..,"p50":..,"p90":..,"p99":..,"max":..} */
+void stats_hist_json(const struct stats_hist *h, FILE *fp)
+{
+	fprintf(fp, "{\"count\":%llu,\"min\":%u,\"avg\":%llu,\"p50\":%u,\"p90\":%u,"
+		"\"p99\":%u,\"max\":%u}", (unsigned long long)h->count, h->min,
+		(unsigned long long)(h->count ? h->sum / h->count : 0),
+		stats_hist_percentile(h, 50), stats_hist_percentile(h, 90),
+		stats_hist_percentile(h, 99), h->max);
+}
+
+/****************************************************************
+ * stats_register
+ *
+ * name must stay valid; sections are printed in registration order.
+ ****************************************************************/
+int stats_register(const char *name, stats_dump_fn fn, void *arg)
+{
+	if (nsections == STATS_MAX_SECTIONS)
+		return -1;
+	sections[nsections].name = name;
+	sections[nsections].fn = fn;
+	sections[nsections].arg = arg;
+	nsections++;
+	return 0;
+}
+
+void stats_dump(FILE *fp)
+{
+	int i;
+
+	for (i = 0; i < nsections; i++) {
+		fprintf(fp, "[%s]\n", sections[i].name);
+		sections[i].fn(fp, sections[i].arg);
+	}
+	fflush(fp);
+}
+
+/****************************************************************
+ * stats_write_file
+ *
+ * Written to path.tmp and renamed, so readers never see half a file.
+ ****************************************************************/
+int stats_write_file(const char *path)
+{
+	char tmp[256];
+	FILE *fp;
+
+	snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+	fp = fopen(tmp, "w");
+	if (!fp) {
+		perror(tmp);
+		return -1;
+	}
+	stats_dump(fp);
+	if (fclose(fp) != 0 || rename(tmp, path) < 0) {
+		perror(path);
+		return -1;
+	}
+	return 0;
+}
+
+static void stats_handler(int sig)
+{
+	requested = 1;
+}
+
+void stats_signal(void)
+{
+	struct sigaction sa;
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = stats_handler;
+	sa.sa_flags = SA_RESTART;
+	sigaction(SIGUSR1, &sa, NULL);
+}
+
+/* true once per SIGUSR1 */
+int stats_requested(void)
+{
+	if (!requested)
+		return 0;
+	requested = 0;
+	return 1;
+}
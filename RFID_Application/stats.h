@@ -0,0 +1,50 @@
+/*
+ * stats.h
+ *
+ * Always-on counters and latency histograms for the hot paths, and a
+ * registry of named sections that are printed together on demand.
+ *
+ * stats_hist is log-linear: four buckets per power of two, so any value
+ * is placed within 25% at the cost of one bit scan per sample and no
+ * floating point. Modules own their counters and register a dump function;
+ * stats_dump() prints every section, stats_write_file() replaces a stats
+ * file atomically. stats_signal() installs a SIGUSR1 handler that only
+ * sets a flag; the main loop polls stats_requested() and dumps from there.
+ */
+
+#ifndef STATS_H_
+#define STATS_H_
+
+#include <stdio.h>
+#include <stdint.h>
+
+#define STATS_HIST_BUCKETS 128     /* 4 per power of two up to 2^32 */
+#define STATS_MAX_SECTIONS 64
+#define STATS_DEFAULT_PATH "/var/run/rfid.stats"
+#define STATS_DEFAULT_INTERVAL_MS 5000
+
+struct stats_hist {
+	uint64_t count;
+	uint64_t sum;
+	uint32_t min;
+	uint32_t max;
+	uint32_t buckets[STATS_HIST_BUCKETS];
+};
+
+typedef void (*stats_dump_fn)(FILE *fp, void *arg);
+
+/****************************************************************
+ * stats API
+ ****************************************************************/
+void stats_hist_add(struct stats_hist *h, uint32_t v);
+uint32_t stats_hist_percentile(const struct stats_hist *h, unsigned int pct);
+void stats_hist_print(const struct stats_hist *h, const char *name, const char *unit, FILE *fp);
+void stats_hist_json(const struct stats_hist *h, FILE *fp);
+
+int stats_register(const char *name, stats_dump_fn fn, void *arg);
+void stats_dump(FILE *fp);
+int stats_write_file(const char *path);
+void stats_signal(void);
+int stats_requested(void);
+
+#endif /* STATS_H_ */
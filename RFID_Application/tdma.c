@@ -0,0 +1,314 @@
+/*
+ * tdma.c
+ *
+ * Interference-aware reader time slots, see tdma.h.
+ */
+
+#include "tdma.h"
+#include <string.h>
+
+#define MS(x) ((uint64_t)(x) * 1000000ull)
+
+static const char *policy_names[] = { "shared", "rr", "adaptive" };
+static const char *pair_names[] = { "", " (ok)", " (conflict)" };
+
+int tdma_parse_policy(const char *name)
+{
+	int i;
+
+	for (i = 0; i < (int)(sizeof(policy_names) / sizeof(policy_names[0])); i++)
+		if (!strcmp(name, policy_names[i]))
+			return i;
+	return -1;
+}
+
+const char *tdma_policy_name(TDMA_POLICY policy)
+{
+	return policy_names[policy];
+}
+
+/****************************************************************
+ * tdma_init
+ *
+ * slot_ms is raised to TDMA_MIN_SLOT_MS; 0 takes the default.
+ ****************************************************************/
+void tdma_init(struct tdma *s, TDMA_POLICY policy, unsigned int slot_ms, uint64_t now_ns)
+{
+	memset(s, 0, sizeof(*s));
+	s->policy = policy;
+	s->slot_ms = slot_ms > TDMA_MIN_SLOT_MS ? slot_ms : TDMA_MIN_SLOT_MS;
+	s->epoch_ns = now_ns;
+	s->adapt_ns = now_ns + MS(TDMA_ADAPT_MS);
+	s->nslots = 1;
+}
+
+/****************************************************************
+ * tdma_add
+ *
+ * Round robin gives every reader its own slot; shared puts them all in
+ * slot 0, and adaptive keeps them apart until measured.
+ ****************************************************************/
+static void tdma_layout(struct tdma *s);
+
+int tdma_add(struct tdma *s, struct reader *r)
+{
+	if (s->nreaders == READER_MAX)
+		return -1;
+	s->slot_of[s->nreaders] = s->policy == TDMA_ROUND_ROBIN ? s->nreaders : 0;
+	s->readers[s->nreaders++] = r;
+	if (s->policy == TDMA_ROUND_ROBIN)
+		s->nslots = s->nreaders;
+	else if (s->policy == TDMA_ADAPTIVE)
+		tdma_layout(s);
+	return 0;
+}
+
+static int tdma_index(const struct tdma *s, const struct reader *r)
+{
+	int i;
+
+	for (i = 0; i < s->nreaders; i++)
+		if (s->readers[i] == r)
+			return i;
+	return -1;
+}
+
+/****************************************************************
+ * tdma_next_start
+ *
+ * First start of the reader's slot at or after earliest_ns.
+ ****************************************************************/
+uint64_t tdma_next_start(const struct tdma *s, const struct reader *r, uint64_t earliest_ns)
+{
+	uint64_t frame = MS(s->slot_ms) * s->nslots;
+	uint64_t start;
+	int i = tdma_index(s, r);
+
+	if (s->policy == TDMA_SHARED || i < 0)
+		return earliest_ns;
+	start = s->epoch_ns + MS(s->slot_ms) * s->slot_of[i];
+	if (earliest_ns <= start)
+		return start;
+	return start + (earliest_ns - start + frame - 1) / frame * frame;
+}
+
+/* readers that must not share a slot */
+static int tdma_apart(const struct tdma *s, int a, int b)
+{
+	const struct tdma_pair *p = &s->pair[a][b];
+
+	return a != b && p->state != TDMA_PAIR_OK && !p->probing;
+}
+
+/*
+ * Greedy colouring, highest degree first. A probed pair is merged into
+ * one node so that it is sure to end up in the same slot.
+ */
+static void tdma_layout(struct tdma *s)
+{
+	int rep[READER_MAX], order[READER_MAX], degree[READER_MAX], slot[READER_MAX];
+	uint32_t adj[READER_MAX];
+	int i, j, k, x, n = s->nreaders, nreps = 0, nslots = 1;
+
+	for (i = 0; i < n; i++)
+		rep[i] = i;
+	for (i = 0; i < n; i++)
+		for (j = i + 1; j < n; j++)
+			if (s->pair[i][j].probing)
+				rep[j] = i;
+
+	memset(adj, 0, sizeof(adj));
+	for (i = 0; i < n; i++)
+		for (j = 0; j < n; j++)
+			if (rep[i] != rep[j] && tdma_apart(s, i, j))
+				adj[rep[i]] |= 1u << rep[j];
+
+	for (x = 0; x < n; x++) {
+		if (rep[x] != x)
+			continue;
+		degree[x] = __builtin_popcount(adj[x]);
+		for (k = nreps; k > 0 && degree[order[k - 1]] < degree[x]; k--)
+			order[k] = order[k - 1];
+		order[k] = x;
+		nreps++;
+		slot[x] = -1;
+	}
+
+	for (k = 0; k < nreps; k++) {
+		uint32_t used = 0;
+
+		x = order[k];
+		for (j = 0; j < n; j++)
+			if ((adj[x] & (1u << j)) && slot[j] >= 0)
+				used |= 1u << slot[j];
+		for (slot[x] = 0; used & (1u << slot[x]); slot[x]++)
+			;
+		if (slot[x] + 1 > nslots)
+			nslots = slot[x] + 1;
+	}
+	for (i = 0; i < n; i++)
+		slot[i] = slot[rep[i]];
+
+	if (nslots != s->nslots || memcmp(slot, s->slot_of, n * sizeof(slot[0]))) {
+		memcpy(s->slot_of, slot, n * sizeof(slot[0]));
+		s->nslots = nslots;
+		s->relayouts++;
+	}
+}
+
+static void tdma_set_pair(struct tdma *s, int a, int b, const struct tdma_pair *p)
+{
+	s->pair[a][b] = *p;
+	s->pair[b][a] = *p;
+}
+
+/* judge measured pairs, age conflicts, pick the next probes */
+static void tdma_adapt(struct tdma *s)
+{
+	int matched[READER_MAX] = {0, };
+	int a, b;
+
+	s->rounds++;
+	for (a = 0; a < s->nreaders; a++) {
+		for (b = a + 1; b < s->nreaders; b++) {
+			struct tdma_pair p = s->pair[a][b];
+			uint32_t n = p.overlap + s->pair[b][a].overlap;
+			uint32_t err = p.overlap_err + s->pair[b][a].overlap_err;
+			uint32_t alone = s->alone[a] + s->alone[b];
+			uint32_t base = alone ? (s->alone_err[a] + s->alone_err[b]) * 100 / alone : 0;
+
+			p.probing = 0;
+			if (n >= TDMA_MIN_SAMPLES) {
+				if (err * 100 / n >= base + TDMA_CONFLICT_PCT) {
+					p.state = TDMA_PAIR_CONFLICT;
+					p.ttl = TDMA_CONFLICT_ROUNDS;
+				} else {
+					p.state = TDMA_PAIR_OK;
+				}
+				p.overlap = p.overlap_err = 0;
+				p.probes = 0;
+			} else if (p.state == TDMA_PAIR_CONFLICT && --p.ttl == 0) {
+				p.state = TDMA_PAIR_UNKNOWN;
+			}
+			tdma_set_pair(s, a, b, &p);
+		}
+	}
+
+	/* disjoint unknown pairs, least probed first */
+	for (;;) {
+		struct tdma_pair *best = NULL;
+		int ba = 0, bb = 0;
+
+		for (a = 0; a < s->nreaders; a++)
+			for (b = a + 1; b < s->nreaders; b++)
+				if (!matched[a] && !matched[b] &&
+				    s->pair[a][b].state == TDMA_PAIR_UNKNOWN &&
+				    (!best || s->pair[a][b].probes < best->probes)) {
+					best = &s->pair[a][b];
+					ba = a;
+					bb = b;
+				}
+		if (!best)
+			break;
+		best->probing = 1;
+		best->probes++;
+		tdma_set_pair(s, ba, bb, best);
+		matched[ba] = matched[bb] = 1;
+	}
+	tdma_layout(s);
+}
+
+/* every probed pair has its samples: no need to wait for the round */
+static int tdma_probes_done(const struct tdma *s)
+{
+	int a, b, probing = 0;
+
+	for (a = 0; a < s->nreaders; a++) {
+		for (b = a + 1; b < s->nreaders; b++) {
+			if (!s->pair[a][b].probing)
+				continue;
+			if (s->pair[a][b].overlap + s->pair[b][a].overlap < TDMA_MIN_SAMPLES)
+				return 0;
+			probing = 1;
+		}
+	}
+	return probing;
+}
+
+/****************************************************************
+ * tdma_cycle_end
+ *
+ * Records how the reader's cycle went against the reader that was
+ * active at the same time, adapts the layout when due, and moves the
+ * reader's next cycle to its slot. A cycle overlapping several readers
+ * is charged to the one that is not known to be harmless, if there is
+ * exactly one.
+ ****************************************************************/
+void tdma_cycle_end(struct tdma *s, struct reader *r, READER_RESULT result, uint64_t now_ns)
+{
+	int a = tdma_index(s, r), b, overlaps = 0, suspects = 0, any = -1, suspect = -1;
+	int err = result == READER_RESULT_ERROR;
+
+	if (a < 0)
+		return;
+
+	if (result == READER_RESULT_READ || result == READER_RESULT_ERROR) {
+		for (b = 0; b < s->nreaders; b++) {
+			struct reader *o = s->readers[b];
+
+			if (b == a)
+				continue;
+			if ((o->state != READER_IDLE && o->cycle_start_ns < now_ns) ||
+			    o->last_end_ns > r->cycle_start_ns) {
+				overlaps++;
+				any = b;
+				if (s->pair[a][b].state != TDMA_PAIR_OK) {
+					suspects++;
+					suspect = b;
+				}
+			}
+		}
+		if (overlaps == 1 || suspects == 1) {
+			b = overlaps == 1 ? any : suspect;
+			s->pair[a][b].overlap++;
+			s->pair[a][b].overlap_err += err;
+		} else if (!overlaps) {
+			s->alone[a]++;
+			s->alone_err[a] += err;
+			if (s->alone[a] > 1024) {
+				s->alone[a] /= 2;
+				s->alone_err[a] /= 2;
+			}
+		}
+	}
+
+	if (s->policy == TDMA_ADAPTIVE && (now_ns >= s->adapt_ns || tdma_probes_done(s))) {
+		tdma_adapt(s);
+		s->adapt_ns = now_ns + MS(TDMA_ADAPT_MS);
+	}
+	r->deadline_ns = tdma_next_start(s, r, r->deadline_ns);
+}
+
+/****************************************************************
+ * tdma_report
+ ****************************************************************/
+void tdma_report(const struct tdma *s, FILE *fp)
+{
+	int a, b;
+
+	fprintf(fp, "tdma: %s, %u slot(s) of %u ms, %u rounds, %u relayouts\n",
+		tdma_policy_name(s->policy), s->nslots, s->slot_ms, s->rounds, s->relayouts);
+	for (a = 0; a < s->nreaders; a++) {
+		const struct reader *r = s->readers[a];
+
+		fprintf(fp, "  reader %d: slot %d, %u cycles, %u reads, %u rx errors, alone %u/%u err",
+			r->id, s->slot_of[a], r->cycles, r->reads, r->rx_errors,
+			s->alone_err[a], s->alone[a]);
+		for (b = 0; b < s->nreaders; b++)
+			if (b != a && (s->pair[a][b].overlap || s->pair[a][b].state))
+				fprintf(fp, ", with %d %u/%u err%s", s->readers[b]->id,
+					s->pair[a][b].overlap_err, s->pair[a][b].overlap,
+					pair_names[s->pair[a][b].state]);
+		fputc('\n', fp);
+	}
+}
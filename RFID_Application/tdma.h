@@ -0,0 +1,93 @@
+/*
+ * tdma.h
+ *
+ * Time slot (TDMA) scheduling of co-located readers. Time is divided into
+ * frames of nslots slots of slot_ms each; a reader only starts an
+ * inventory cycle at the beginning of its own slot. A slot is at least
+ * TDMA_MIN_SLOT_MS long: the longest cycle with the RF field on
+ * (READER_CYCLE_MAX_MS, a cycle whose tag times out) plus TDMA_GUARD_MS
+ * for a link check and wakeup latency before it. So readers in different
+ * slots do not have their fields on at the same time, unless a cycle
+ * starts more than TDMA_GUARD_MS into its slot.
+ *
+ * Every cycle that got a tag answer is recorded against the reader whose
+ * cycle overlapped it, which gives an error rate per reader pair next to
+ * each reader's error rate when running alone. The adaptive policy keeps
+ * readers apart until their pair has been measured: each round it lets a
+ * few disjoint unmeasured pairs share a slot (a probe), marks a pair as
+ * conflicting when overlapping clearly hurts, and colours the graph of
+ * conflicting and unmeasured pairs so that all other readers share slots:
+ * as few slots as possible, hence as many cycles per second as possible.
+ * Conflicts age out after a while so that separated pairs are probed
+ * again.
+ */
+
+#ifndef TDMA_H_
+#define TDMA_H_
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "reader.h"
+
+#define TDMA_GUARD_MS 5           /* start delay a slot allows for */
+#define TDMA_MIN_SLOT_MS (READER_CYCLE_MAX_MS + TDMA_GUARD_MS)
+#define TDMA_DEFAULT_SLOT_MS TDMA_MIN_SLOT_MS
+#define TDMA_ADAPT_MS 2000        /* re-evaluate conflicts this often */
+#define TDMA_MIN_SAMPLES 10       /* overlapping answers before judging a pair */
+#define TDMA_CONFLICT_PCT 15      /* error rate increase that makes a conflict */
+#define TDMA_CONFLICT_ROUNDS 15   /* adaptation rounds a conflict is kept */
+
+typedef enum {
+	TDMA_PAIR_UNKNOWN=0,
+	TDMA_PAIR_OK,
+	TDMA_PAIR_CONFLICT
+} TDMA_PAIR_STATE;
+
+typedef enum {
+	TDMA_SHARED=0,            /* free running, no slots */
+	TDMA_ROUND_ROBIN,         /* one slot per reader */
+	TDMA_ADAPTIVE             /* slots from the measured conflict graph */
+} TDMA_POLICY;
+
+struct tdma_pair {
+	uint32_t overlap;          /* answers received while the other reader was active */
+	uint32_t overlap_err;
+	uint8_t state;             /* TDMA_PAIR_STATE, kept symmetric */
+	uint8_t ttl;               /* rounds until a conflict is probed again */
+	uint8_t probes;            /* rounds probed without enough samples */
+	uint8_t probing;
+};
+
+struct tdma {
+	TDMA_POLICY policy;
+	unsigned int slot_ms;
+	uint64_t epoch_ns;
+	uint64_t adapt_ns;
+
+	struct reader *readers[READER_MAX];
+	int nreaders;
+	int slot_of[READER_MAX];
+	int nslots;
+
+	struct tdma_pair pair[READER_MAX][READER_MAX];
+	uint32_t alone[READER_MAX];
+	uint32_t alone_err[READER_MAX];
+
+	/* statistics */
+	uint32_t rounds;
+	uint32_t relayouts;
+};
+
+/****************************************************************
+ * tdma API
+ ****************************************************************/
+int tdma_parse_policy(const char *name);
+const char *tdma_policy_name(TDMA_POLICY policy);
+void tdma_init(struct tdma *s, TDMA_POLICY policy, unsigned int slot_ms, uint64_t now_ns);
+int tdma_add(struct tdma *s, struct reader *r);
+void tdma_cycle_end(struct tdma *s, struct reader *r, READER_RESULT result, uint64_t now_ns);
+uint64_t tdma_next_start(const struct tdma *s, const struct reader *r, uint64_t earliest_ns);
+void tdma_report(const struct tdma *s, FILE *fp);
+
+#endif /* TDMA_H_ */
@@ -0,0 +1,187 @@
+/*
+ * trace.c
+ *
+ * Chrome trace-event sink, see trace.h.
+ *
+ * Every ring has one producer (its thread) and one consumer (the flush
+ * thread); head is only written by the producer and tail only by the
+ * consumer, so acquire/release on the two indices is all the locking.
+ * Span names must be string literals or otherwise outlive the trace.
+ */
+
+#include "trace.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+
+struct trace_rec {
+	const char *name;
+	uint64_t start_ns;
+	uint32_t dur_ns;
+	int32_t tid;
+};
+
+struct trace_ring {
+	uint32_t head;         /* next slot to write, producer */
+	uint32_t tail;         /* next slot to read, consumer */
+	uint32_t dropped;
+	struct trace_rec rec[TRACE_RING_LEN];
+};
+
+int trace_active;
+
+static FILE *trace_fp;
+static pthread_t trace_thread;
+static volatile int trace_stop;
+static struct trace_ring *rings[TRACE_MAX_RINGS];
+static int nrings;
+static pthread_mutex_t rings_lock = PTHREAD_MUTEX_INITIALIZER;
+static __thread struct trace_ring *my_ring;
+static int trace_first;
+static uint8_t tid_named[256 / 8];
+static int trace_pid;
+
+static struct trace_ring *trace_ring_get(void)
+{
+	struct trace_ring *ring;
+
+	if (my_ring)
+		return my_ring;
+	pthread_mutex_lock(&rings_lock);
+	if (nrings < TRACE_MAX_RINGS && (ring = calloc(1, sizeof(*ring))) != NULL) {
+		rings[nrings++] = ring;
+		my_ring = ring;
+	}
+	pthread_mutex_unlock(&rings_lock);
+	return my_ring;
+}
+
+/****************************************************************
+ * trace_span
+ *
+ * tid is the track, the reader number for reader spans.
+ ****************************************************************/
+void trace_span(const char *name, int tid, uint64_t start_ns, uint64_t end_ns)
+{
+	struct trace_ring *ring = trace_ring_get();
+	struct trace_rec *rec;
+	uint32_t head;
+
+	if (!ring)
+		return;
+	head = ring->head;
+	if (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) == TRACE_RING_LEN) {
+		ring->dropped++;
+		return;
+	}
+	rec = &ring->rec[head & (TRACE_RING_LEN - 1)];
+	rec->name = name;
+	rec->start_ns = start_ns;
+	rec->dur_ns = end_ns > start_ns ? end_ns - start_ns : 0;
+	rec->tid = tid;
+	__atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+}
+
+static void trace_write(const struct trace_rec *rec)
+{
+	unsigned int t = rec->tid & 0xFF;
+
+	if (!(tid_named[t / 8] & (1 << (t % 8)))) {
+		tid_named[t / 8] |= 1 << (t % 8);
+		fprintf(trace_fp, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,"
+			"\"args\":{\"name\":\"reader %d\"}}", trace_first ? "" : ",\n",
+			trace_pid, rec->tid, rec->tid);
+		trace_first = 0;
+	}
+	fprintf(trace_fp, "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%d,\"tid\":%d,"
+		"\"ts\":%llu.%03u,\"dur\":%u.%03u}", trace_first ? "" : ",\n",
+		rec->name, trace_pid, rec->tid,
+		(unsigned long long)(rec->start_ns / 1000), (unsigned int)(rec->start_ns % 1000),
+		rec->dur_ns / 1000, rec->dur_ns % 1000);
+	trace_first = 0;
+}
+
+static void trace_drain(void)
+{
+	int i, n;
+
+	pthread_mutex_lock(&rings_lock);
+	n = nrings;
+	pthread_mutex_unlock(&rings_lock);
+	for (i = 0; i < n; i++) {
+		struct trace_ring *ring = rings[i];
+		uint32_t tail = ring->tail;
+		uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+
+		for (; tail != head; tail++)
+			trace_write(&ring->rec[tail & (TRACE_RING_LEN - 1)]);
+		__atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+	}
+	fflush(trace_fp);
+}
+
+static void *trace_flush(void *arg)
+{
+	struct timespec ts = { 0, TRACE_FLUSH_MS * 1000000L };
+
+	while (!trace_stop) {
+		nanosleep(&ts, NULL);
+		trace_drain();
+	}
+	return NULL;
+}
+
+/****************************************************************
+ * trace_open
+ ****************************************************************/
+int trace_open(const char *path)
+{
+	int ret;
+
+	trace_fp = fopen(path, "w");
+	if (!trace_fp) {
+		perror(path);
+		return -1;
+	}
+	trace_pid = getpid();
+	trace_first = 1;
+	fprintf(trace_fp, "[");
+	trace_stop = 0;
+	ret = pthread_create(&trace_thread, NULL, trace_flush, NULL);
+	if (ret) {
+		fprintf(stderr, "trace: can't start flush thread: %s\n", strerror(ret));
+		fclose(trace_fp);
+		trace_fp = NULL;
+		return -1;
+	}
+	trace_active = 1;
+	return 0;
+}
+
+/****************************************************************
+ * trace_close
+ *
+ * Writes out what is left and terminates the JSON array.
+ ****************************************************************/
+void trace_close(void)
+{
+	uint32_t dropped = 0;
+	int i;
+
+	if (!trace_fp)
+		return;
+	trace_active = 0;
+	trace_stop = 1;
+	pthread_join(trace_thread, NULL);
+	trace_drain();
+	fprintf(trace_fp, "]\n");
+	fclose(trace_fp);
+	trace_fp = NULL;
+	for (i = 0; i < nrings; i++)
+		dropped += rings[i]->dropped;
+	if (dropped)
+		fprintf(stderr, "trace: %u spans dropped, ring full\n", dropped);
+}
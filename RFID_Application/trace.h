@@ -0,0 +1,40 @@
+/*
+ * trace.h
+ *
+ * Optional timeline of the reader cycles in Chrome trace-event JSON
+ * (load the file in chrome://tracing or ui.perfetto.dev). Each reader is
+ * a track; a cycle is one span with its phases nested inside: init (with
+ * the settle time), inventory TX, IRQ wait, FIFO read and dispatch of
+ * the read, plus the SPI time of every command flow.
+ *
+ * Spans are recorded into a lock-free ring owned by the recording thread
+ * (registered on its first span) and written out by a background thread,
+ * so the reader loop never touches the file. A full ring drops spans and
+ * counts them. With no trace open, TRACE_SPAN is one load and a branch.
+ */
+
+#ifndef TRACE_H_
+#define TRACE_H_
+
+#include <stdint.h>
+
+#define TRACE_RING_LEN 8192        /* spans per thread, power of two */
+#define TRACE_MAX_RINGS 16
+#define TRACE_FLUSH_MS 200
+
+extern int trace_active;
+
+#define TRACE_SPAN(name, tid, start_ns, end_ns)				\
+	do {								\
+		if (trace_active)					\
+			trace_span((name), (tid), (start_ns), (end_ns));	\
+	} while (0)
+
+/****************************************************************
+ * trace API
+ ****************************************************************/
+int trace_open(const char *path);
+void trace_span(const char *name, int tid, uint64_t start_ns, uint64_t end_ns);
+void trace_close(void);
+
+#endif /* TRACE_H_ */
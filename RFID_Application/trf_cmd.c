@@ -0,0 +1,112 @@
+/*
+ * trf_cmd.c
+ *
+ * TRF7970A command flows, see trf_cmd.h.
+ *
+ * 5438_TRF7960_SPI_ISO15693_Single_Slot
+ */
+
+#include "trf_cmd.h"
+#include <stdio.h>
+#include <string.h>
+#include <sys/ioctl.h>
+
+const struct trf_flow trf_flows[TRF_FLOW_COUNT] = {
+	[TRF_FLOW_INIT] = { "soft_init", 0, 3, {
+		TRF_DIRECT(TRF_CMD_SOFT_INIT),
+		TRF_DIRECT(TRF_CMD_IDLE),
+		/* cont write 0x21 to chip status control, 0x02 to ISO control */
+		{ 7, { 0x20 | TRF_REG_CHIP_STATUS, 0x21, 0x02, 0x00, 0x00, 0xC1, 0xBB } },
+	} },
+	[TRF_FLOW_INVENTORY] = { "inventory", 0, 4, {
+		TRF_WRITE(TRF_REG_MODULATOR, 0x21),      /* SYS_CLK 6.78 MHz */
+		TRF_WRITE(TRF_REG_RX_NORESP_WAIT, 0x13),
+		{ 3, { 0x60 | TRF_REG_IRQ_STATUS, 0x00, 0x00 } }, /* clear IRQ */
+		/* reset FIFO, transmit with CRC, cont write from 0x1D:
+		 * TX length 3 bytes, inventory request 0x26 0x01 0x00 */
+		{ 8, { 0x80 | TRF_CMD_RESET_FIFO, 0x80 | TRF_CMD_TX_CRC,
+		       0x20 | TRF_REG_TX_LEN1, 0x00, 0x30, 0x26, 0x01, 0x00 } },
+	} },
+	[TRF_FLOW_TX_DONE] = { "tx_done", TRF_IRQ_TX, 2, {
+		{ 3, { 0x60 | TRF_REG_IRQ_STATUS, 0x00, 0x00 } },
+		TRF_DIRECT(TRF_CMD_RESET_FIFO),
+	} },
+	[TRF_FLOW_RX] = { "rx", TRF_IRQ_SRX, 8, {
+		[TRF_RX_IRQ_STATUS] = { 3, { 0x60 | TRF_REG_IRQ_STATUS, 0x00, 0x00 } },
+		[TRF_RX_FIFO_STATUS] = TRF_READ(TRF_REG_FIFO_STATUS),
+		/* flags, DSFID, UID: only valid when FIFO status says 10 */
+		[TRF_RX_FIFO] = { 11, { 0x60 | TRF_REG_FIFO } },
+		TRF_DIRECT(TRF_CMD_RESET_FIFO),
+		[TRF_RX_RSSI] = TRF_READ(TRF_REG_RSSI),
+		TRF_DIRECT(TRF_CMD_RESET_FIFO),
+		TRF_DIRECT(TRF_CMD_BLOCK_RX),
+		TRF_READ(TRF_REG_IRQ_STATUS),
+	} },
+	[TRF_FLOW_RF_OFF] = { "rf_off", 0, 1, {
+		TRF_WRITE(TRF_REG_CHIP_STATUS, 0x01),
+	} },
+	/*
+	 * alternating bits through a register the inventory rewrites anyway,
+	 * then a burst through the FIFO as the RX flow drains it
+	 */
+	[TRF_FLOW_LINK_TEST] = { "link_test", 0, 8, {
+		TRF_WRITE(TRF_REG_RX_NORESP_WAIT, 0x55),
+		[TRF_LINK_REG_55] = TRF_READ(TRF_REG_RX_NORESP_WAIT),
+		TRF_WRITE(TRF_REG_RX_NORESP_WAIT, 0xAA),
+		[TRF_LINK_REG_AA] = TRF_READ(TRF_REG_RX_NORESP_WAIT),
+		TRF_DIRECT(TRF_CMD_RESET_FIFO),
+		[TRF_LINK_FIFO_WRITE] = { 1 + TRF_LINK_FIFO_LEN, { 0x20 | TRF_REG_FIFO,
+			0x00, 0xFF, 0x0F, 0xF0, 0x33, 0xCC, 0x5A, 0xA5 } },
+		[TRF_LINK_FIFO_READ] = { 1 + TRF_LINK_FIFO_LEN, { 0x60 | TRF_REG_FIFO } },
+		TRF_DIRECT(TRF_CMD_RESET_FIFO),
+	} },
+};
+
+/****************************************************************
+ * trf_batch_compile
+ ****************************************************************/
+void trf_batch_compile(struct trf_batch *b, const struct trf_flow *flow,
+		       uint32_t speed, uint8_t bits, uint16_t delay)
+{
+	int i;
+
+	memset(b, 0, sizeof(*b));
+	b->flow = flow;
+	b->n = flow->nframes;
+	for (i = 0; i < b->n; i++) {
+		memcpy(b->tx[i], flow->frames[i].bytes, flow->frames[i].len);
+		b->xfer[i].tx_buf = (unsigned long)b->tx[i];
+		b->xfer[i].rx_buf = (unsigned long)b->rx[i];
+		b->xfer[i].len = flow->frames[i].len;
+		b->xfer[i].delay_usecs = delay;
+		b->xfer[i].speed_hz = speed;
+		b->xfer[i].bits_per_word = bits;
+		/* every frame is a command of its own: release chip select */
+		b->xfer[i].cs_change = i + 1 < b->n;
+	}
+}
+
+/****************************************************************
+ * trf_batch_run
+ ****************************************************************/
+int trf_batch_run(struct trf_batch *b, int spi_fd)
+{
+	if (ioctl(spi_fd, SPI_IOC_MESSAGE(b->n), b->xfer) < 1) {
+		perror(b->flow->name);
+		return -1;
+	}
+	return 0;
+}
+
+/****************************************************************
+ * trf_link_check
+ *
+ * 0 if a TRF_FLOW_LINK_TEST batch read back what it wrote.
+ ****************************************************************/
+int trf_link_check(const struct trf_batch *b)
+{
+	if (b->rx[TRF_LINK_REG_55][1] != 0x55 || b->rx[TRF_LINK_REG_AA][1] != 0xAA)
+		return -1;
+	return memcmp(&b->rx[TRF_LINK_FIFO_READ][1], &b->tx[TRF_LINK_FIFO_WRITE][1],
+		      TRF_LINK_FIFO_LEN) ? -1 : 0;
+}
@@ -0,0 +1,115 @@
+/*
+ * trf_cmd.h
+ *
+ * TRF7970A command flows as data. A flow is the list of SPI frames sent
+ * back to back for one step of the protocol (register writes, direct
+ * commands, FIFO loads and reads); trf_flows[] declares every flow the
+ * reader uses. trf_batch_compile() turns a flow into a ready
+ * spi_ioc_transfer array with its tx bytes in place once, at open time,
+ * and trf_batch_run() sends the whole flow with a single
+ * SPI_IOC_MESSAGE ioctl, chip select toggling between frames. A new
+ * command flow is a table entry; batching comes with it.
+ */
+
+#ifndef TRF_CMD_H_
+#define TRF_CMD_H_
+
+#include <stdint.h>
+#include <linux/types.h>
+#include <linux/spi/spidev.h>
+
+/* registers */
+#define TRF_REG_CHIP_STATUS 0x00
+#define TRF_REG_ISO_CONTROL 0x01
+#define TRF_REG_RX_NORESP_WAIT 0x07
+#define TRF_REG_MODULATOR 0x09
+#define TRF_REG_IRQ_STATUS 0x0C
+#define TRF_REG_COLLISION_POS 0x0D
+#define TRF_REG_RSSI 0x0F
+#define TRF_REG_FIFO_STATUS 0x1C
+#define TRF_REG_TX_LEN1 0x1D
+#define TRF_REG_TX_LEN2 0x1E
+#define TRF_REG_FIFO 0x1F
+
+/* direct commands */
+#define TRF_CMD_IDLE 0x00
+#define TRF_CMD_SOFT_INIT 0x03
+#define TRF_CMD_RESET_FIFO 0x0F
+#define TRF_CMD_TX_NO_CRC 0x10
+#define TRF_CMD_TX_CRC 0x11
+#define TRF_CMD_BLOCK_RX 0x16
+#define TRF_CMD_ENABLE_RX 0x17
+
+/* IRQ status register (0x0C) bits */
+#define TRF_IRQ_TX 0x80
+#define TRF_IRQ_SRX 0x40
+#define TRF_IRQ_CRC 0x10
+#define TRF_IRQ_PARITY 0x08
+#define TRF_IRQ_FRAMING 0x04
+#define TRF_IRQ_COLLISION 0x02
+#define TRF_IRQ_NORESP 0x01
+#define TRF_IRQ_ERRORS (TRF_IRQ_CRC | TRF_IRQ_PARITY | TRF_IRQ_FRAMING | TRF_IRQ_COLLISION)
+
+/* frame builders for the tables */
+#define TRF_DIRECT(cmd) { 1, { 0x80 | (cmd) } }
+#define TRF_WRITE(reg, v) { 2, { (reg), (v) } }
+#define TRF_READ(reg) { 2, { 0x40 | (reg), 0x00 } }
+
+#define TRF_FRAME_MAX 12
+#define TRF_FLOW_MAX 8
+
+struct trf_frame {
+	uint8_t len;
+	uint8_t bytes[TRF_FRAME_MAX];
+};
+
+struct trf_flow {
+	const char *name;
+	uint8_t expect_irq;    /* IRQ status frame 0 must read, 0 = none */
+	uint8_t nframes;
+	struct trf_frame frames[TRF_FLOW_MAX];
+};
+
+typedef enum {
+	TRF_FLOW_INIT=0,       /* software init, idle, chip status/ISO control */
+	TRF_FLOW_INVENTORY,    /* SYS_CLK, RX wait time, clear IRQ, inventory */
+	TRF_FLOW_TX_DONE,      /* IRQ status, reset FIFO */
+	TRF_FLOW_RX,           /* IRQ status, FIFO status, UID, RSSI, block receiver */
+	TRF_FLOW_RF_OFF,       /* turn off transmitter */
+	TRF_FLOW_LINK_TEST,    /* register and FIFO write/read-back patterns */
+	TRF_FLOW_COUNT
+} TRF_FLOW;
+
+/* frames of TRF_FLOW_RX */
+#define TRF_RX_IRQ_STATUS 0
+#define TRF_RX_FIFO_STATUS 1
+#define TRF_RX_FIFO 2
+#define TRF_RX_RSSI 4
+
+/* frames of TRF_FLOW_LINK_TEST read back */
+#define TRF_LINK_REG_55 1
+#define TRF_LINK_REG_AA 3
+#define TRF_LINK_FIFO_WRITE 5
+#define TRF_LINK_FIFO_READ 6
+#define TRF_LINK_FIFO_LEN 8
+
+extern const struct trf_flow trf_flows[TRF_FLOW_COUNT];
+
+/* a flow ready to send */
+struct trf_batch {
+	const struct trf_flow *flow;
+	int n;
+	struct spi_ioc_transfer xfer[TRF_FLOW_MAX];
+	uint8_t tx[TRF_FLOW_MAX][TRF_FRAME_MAX];
+	uint8_t rx[TRF_FLOW_MAX][TRF_FRAME_MAX];
+};
+
+/****************************************************************
+ * trf_cmd API
+ ****************************************************************/
+void trf_batch_compile(struct trf_batch *b, const struct trf_flow *flow,
+		       uint32_t speed, uint8_t bits, uint16_t delay);
+int trf_batch_run(struct trf_batch *b, int spi_fd);
+int trf_link_check(const struct trf_batch *b);
+
+#endif /* TRF_CMD_H_ */
@@ -0,0 +1,343 @@
+/*
+ * trf_emu.c
+ *
+ * Emulated TRF7970A, see trf_emu.h.
+ *
+ * Air interface timing is modelled coarsely at 26.48 kbps: the inventory
+ * request takes EMU_TX_US to send, a tag answers EMU_RESP_US after the end
+ * of the request, and without an answer the no-response IRQ comes after
+ * the RX no response wait time programmed in register 0x07.
+ */
+
+#include "trf_emu.h"
+#include "rfid_event.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/timerfd.h>
+
+#define EMU_TX_US 1500
+#define EMU_RESP_US 4000
+#define EMU_NORESP_UNIT_NS 37760 /* register 0x07 unit */
+
+void emu_field_init(struct emu_field *f, unsigned int seed)
+{
+	memset(f, 0, sizeof(*f));
+	f->seed = seed ? seed : 1;
+}
+
+struct emu_tag *emu_field_add_tag(struct emu_field *f, const uint8_t uid[8])
+{
+	struct emu_tag *t;
+
+	if (f->ntags == EMU_MAX_TAGS)
+		return NULL;
+	t = &f->tags[f->ntags++];
+	memset(t, 0, sizeof(*t));
+	memcpy(t->uid, uid, sizeof(t->uid));
+	return t;
+}
+
+static int emu_roll(struct emu_field *f, unsigned int pct)
+{
+	return pct && (unsigned int)(rand_r(&f->seed) % 100) < pct;
+}
+
+/****************************************************************
+ * trf_emu_init
+ ****************************************************************/
+int trf_emu_init(struct trf_emu *e, struct emu_field *f)
+{
+	memset(e, 0, sizeof(*e));
+	if (f->nreaders == EMU_MAX_READERS)
+		return -1;
+	e->irq_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (e->irq_fd < 0) {
+		perror("emu/timerfd");
+		return -1;
+	}
+	e->field = f;
+	e->id = f->nreaders;
+	f->readers[f->nreaders++] = e;
+	e->regs[TRF_REG_CHIP_STATUS] = 0x01;
+	e->rssi = 0x40;
+	return 0;
+}
+
+void trf_emu_close(struct trf_emu *e)
+{
+	if (e->irq_fd >= 0)
+		close(e->irq_fd);
+	e->irq_fd = -1;
+}
+
+static uint64_t emu_now(const struct trf_emu *e)
+{
+	return e->field->clock ? *e->field->clock : rfid_now_ns();
+}
+
+/* arm the IRQ timerfd for the next pending air interface event */
+static void emu_arm(struct trf_emu *e)
+{
+	struct itimerspec its;
+	uint64_t at = e->tx_done_ns;
+
+	if (!at || (e->rx_done_ns && e->rx_done_ns < at))
+		at = e->rx_done_ns;
+	if (at == e->armed_ns)
+		return;
+	e->armed_ns = at;
+	if (e->field->clock)
+		return;
+
+	memset(&its, 0, sizeof(its));
+	its.it_value.tv_sec = at / 1000000000ull;
+	its.it_value.tv_nsec = at % 1000000000ull;
+	timerfd_settime(e->irq_fd, TFD_TIMER_ABSTIME, &its, NULL);
+}
+
+static int emu_interfered(struct trf_emu *e)
+{
+	struct emu_field *f = e->field;
+	int j;
+
+	for (j = 0; j < f->nreaders; j++) {
+		struct trf_emu *o = f->readers[j];
+
+		if (o == e || !f->coupling[e->id][j])
+			continue;
+		if ((o->rf_on || o->rf_off_ns > e->rx_window_ns) &&
+		    emu_roll(f, f->coupling[e->id][j]))
+			return 1;
+	}
+	return 0;
+}
+
+static void emu_receive(struct trf_emu *e)
+{
+	struct emu_field *f = e->field;
+	int i;
+
+	e->fifo_len = e->fifo_pos = 0;
+	e->rssi = 0x40;
+
+	if (!e->response) {
+		e->irq_status |= TRF_IRQ_NORESP;
+		return;
+	}
+	e->irq_status |= TRF_IRQ_SRX;
+	if (e->response > 1) {
+		e->irq_status |= TRF_IRQ_COLLISION;
+		e->fifo_len = 3;
+		e->collisions++;
+		return;
+	}
+	e->rssi = e->responder->rssi[e->id];
+	if (emu_interfered(e) || emu_roll(f, f->collision_pct)) {
+		e->irq_status |= TRF_IRQ_CRC;
+		e->fifo_len = 4 + rand_r(&f->seed) % 5;
+		e->interfered++;
+		return;
+	}
+
+	/* flags, DSFID, UID LSB first */
+	e->fifo[0] = 0x00;
+	e->fifo[1] = 0x00;
+	for (i = 0; i < 8; i++)
+		e->fifo[2 + i] = e->responder->uid[7 - i];
+	e->fifo_len = 10;
+}
+
+/* apply air interface events that are due */
+static void emu_update(struct trf_emu *e, uint64_t now)
+{
+	if (e->tx_done_ns && now >= e->tx_done_ns) {
+		e->irq_status |= TRF_IRQ_TX;
+		e->tx_done_ns = 0;
+	}
+	if (e->rx_done_ns && !e->tx_done_ns && now >= e->rx_done_ns) {
+		emu_receive(e);
+		e->rx_done_ns = 0;
+	}
+	emu_arm(e);
+}
+
+static void emu_transmit(struct trf_emu *e, uint64_t now)
+{
+	struct emu_field *f = e->field;
+	int i;
+
+	e->inventories++;
+	e->response = 0;
+	e->responder = NULL;
+	if (e->regs[TRF_REG_CHIP_STATUS] & 0x20) {
+		for (i = 0; i < f->ntags; i++) {
+			struct emu_tag *t = &f->tags[i];
+
+			if (!t->rssi[e->id] || t->arrive_ns > now ||
+			    (t->depart_ns && t->depart_ns <= now))
+				continue;
+			e->response++;
+			e->responder = t;
+		}
+	}
+	e->tx_done_ns = now + EMU_TX_US * 1000ull;
+	e->rx_window_ns = e->tx_done_ns;
+	if (e->response)
+		e->rx_done_ns = e->tx_done_ns + EMU_RESP_US * 1000ull;
+	else
+		e->rx_done_ns = e->tx_done_ns + (uint64_t)e->regs[0x07] * EMU_NORESP_UNIT_NS;
+	emu_arm(e);
+}
+
+static uint8_t emu_read(struct trf_emu *e, uint8_t addr, uint64_t now)
+{
+	uint8_t v;
+
+	switch (addr) {
+	case TRF_REG_IRQ_STATUS:
+		emu_update(e, now);
+		v = e->irq_status;
+		e->irq_status = 0;
+		return v;
+	case TRF_REG_COLLISION_POS:
+		return 0;
+	case TRF_REG_RSSI:
+		return e->rssi;
+	case TRF_REG_FIFO_STATUS:
+		return e->fifo_len - e->fifo_pos;
+	case TRF_REG_FIFO:
+		return e->fifo_pos < e->fifo_len ? e->fifo[e->fifo_pos++] : 0;
+	}
+	return e->regs[addr];
+}
+
+static void emu_write(struct trf_emu *e, uint8_t addr, uint8_t v, uint64_t now)
+{
+	if (addr == TRF_REG_FIFO) {
+		if (e->fifo_len < (int)sizeof(e->fifo))
+			e->fifo[e->fifo_len++] = v;
+		return;
+	}
+	if (addr == TRF_REG_CHIP_STATUS) {
+		int on = !!(v & 0x20);
+
+		if (e->rf_on && !on)
+			e->rf_off_ns = now;
+		e->rf_on = on;
+	}
+	e->regs[addr] = v;
+}
+
+static void emu_command(struct trf_emu *e, uint8_t cmd, uint64_t now, int *transmit)
+{
+	switch (cmd) {
+	case TRF_CMD_SOFT_INIT:
+		if (e->rf_on)
+			e->rf_off_ns = now;
+		memset(e->regs, 0, sizeof(e->regs));
+		e->regs[TRF_REG_CHIP_STATUS] = 0x01;
+		e->rf_on = 0;
+		e->fifo_len = e->fifo_pos = 0;
+		e->irq_status = 0;
+		e->tx_done_ns = e->rx_done_ns = 0;
+		emu_arm(e);
+		break;
+	case TRF_CMD_RESET_FIFO:
+		e->fifo_len = e->fifo_pos = 0;
+		break;
+	case TRF_CMD_TX_NO_CRC:
+	case TRF_CMD_TX_CRC:
+		*transmit = 1;
+		break;
+	default:   // Idle, block/enable receiver, ...
+		break;
+	}
+}
+
+/****************************************************************
+ * trf_emu_xfer
+ *
+ * One SPI transfer with chip select held for its whole length.
+ ****************************************************************/
+int trf_emu_xfer(struct trf_emu *e, const uint8_t *tx, uint8_t *rx, unsigned int len)
+{
+	uint64_t now = emu_now(e);
+	unsigned int i = 0;
+	int transmit = 0;
+
+	while (i < len) {
+		uint8_t b = tx[i];
+		uint8_t addr = b & 0x1F;
+
+		rx[i++] = 0;
+		if (b & 0x80) {
+			emu_command(e, addr, now, &transmit);
+			continue;
+		}
+		if (!(b & 0x20)) {
+			/* single address mode: one data byte */
+			if (i < len) {
+				if (b & 0x40)
+					rx[i] = emu_read(e, addr, now);
+				else
+					emu_write(e, addr, tx[i], now);
+				i++;
+			}
+			continue;
+		}
+		/* continuous mode: the rest of the transfer */
+		for (; i < len; i++) {
+			if (b & 0x40)
+				rx[i] = emu_read(e, addr, now);
+			else
+				emu_write(e, addr, tx[i], now);
+			if (addr != TRF_REG_FIFO)
+				addr++;
+		}
+	}
+
+	if (transmit && e->fifo_len >= (e->regs[TRF_REG_TX_LEN2] >> 4 | e->regs[TRF_REG_TX_LEN1] << 4)) {
+		e->fifo_len = 0;
+		emu_transmit(e, now);
+	}
+	return 0;
+}
+
+/****************************************************************
+ * trf_emu_batch
+ *
+ * A compiled flow, chip select released between its frames.
+ ****************************************************************/
+int trf_emu_batch(struct trf_emu *e, struct trf_batch *b)
+{
+	struct emu_field *f = e->field;
+	unsigned int j;
+	int i;
+
+	for (i = 0; i < b->n; i++) {
+		trf_emu_xfer(e, b->tx[i], b->rx[i], b->xfer[i].len);
+		if (!f->spi_max_hz || b->xfer[i].speed_hz <= f->spi_max_hz)
+			continue;
+		for (j = 0; j < b->xfer[i].len; j++)
+			if (emu_roll(f, EMU_SPI_ERROR_PCT))
+				b->rx[i][j] ^= 1 << (rand_r(&f->seed) % 8);
+	}
+	return 0;
+}
+
+/****************************************************************
+ * trf_emu_irq_level
+ *
+ * Acknowledges the timerfd and returns the IRQ line level.
+ ****************************************************************/
+int trf_emu_irq_level(struct trf_emu *e)
+{
+	uint64_t expirations;
+
+	if (!e->field->clock && read(e->irq_fd, &expirations, sizeof(expirations)) > 0)
+		e->armed_ns = 0;
+	emu_update(e, emu_now(e));
+	return e->irq_status != 0;
+}
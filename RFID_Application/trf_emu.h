@@ -0,0 +1,91 @@
+/*
+ * trf_emu.h
+ *
+ * Emulated TRF7970A for running the reader state machine without
+ * hardware. It decodes the same SPI frames as the chip (register
+ * reads/writes, continuous mode, direct commands, FIFO), answers ISO15693
+ * single slot inventories from a simulated tag field, and raises its IRQ
+ * line through a timerfd so the reader is driven by the same epoll loop.
+ *
+ * All emulated readers of one emu_field share the tag population and an
+ * interference model: a reader receiving while another reader with a
+ * non-zero coupling has its RF field on gets a corrupted response with
+ * that probability (percent). Above spi_max_hz the SPI bus itself is
+ * unreliable: every byte read back is corrupted with EMU_SPI_ERROR_PCT.
+ *
+ * With a virtual clock (emu_field.clock pointing at a time in ns that the
+ * caller advances) the emulator reads that instead of CLOCK_MONOTONIC and
+ * does not arm its timerfd; armed_ns is the time its IRQ line rises next
+ * and the caller runs the reader once its clock gets there (engine_step).
+ */
+
+#ifndef TRF_EMU_H_
+#define TRF_EMU_H_
+
+#include <stdint.h>
+
+#include "trf_cmd.h"
+
+#define EMU_MAX_READERS 32
+#define EMU_MAX_TAGS 256
+#define EMU_SPI_ERROR_PCT 2
+
+struct emu_tag {
+	uint8_t uid[8];        /* MSB first */
+	uint8_t rssi[EMU_MAX_READERS]; /* register 0x0F value per reader, 0 = out of range */
+	uint64_t arrive_ns;    /* in the field from arrive_ns ... */
+	uint64_t depart_ns;    /* ... to depart_ns, 0 = forever */
+};
+
+struct trf_emu;
+
+struct emu_field {
+	struct emu_tag tags[EMU_MAX_TAGS];
+	int ntags;
+	uint8_t coupling[EMU_MAX_READERS][EMU_MAX_READERS];
+	unsigned int collision_pct; /* extra random corruption of single-tag replies */
+	uint32_t spi_max_hz;    /* clean SPI up to this clock, 0 = any */
+	struct trf_emu *readers[EMU_MAX_READERS];
+	int nreaders;
+	unsigned int seed;
+	const uint64_t *clock;  /* virtual time, NULL = CLOCK_MONOTONIC */
+};
+
+struct trf_emu {
+	int id;
+	struct emu_field *field;
+	int irq_fd;            /* timerfd, readable when the IRQ line rises */
+
+	uint8_t regs[32];
+	uint8_t fifo[16];
+	int fifo_len;
+	int fifo_pos;
+	uint8_t irq_status;
+	uint8_t rssi;
+
+	int rf_on;
+	uint64_t rf_off_ns;    /* last time the field was switched off */
+
+	/* pending air interface events */
+	uint64_t tx_done_ns;
+	uint64_t rx_done_ns;
+	uint64_t rx_window_ns; /* start of the reception window */
+	int response;          /* tags answering the pending inventory */
+	struct emu_tag *responder;
+	uint64_t armed_ns;      /* next IRQ, 0 if none */
+
+	/* statistics */
+	uint32_t inventories;
+	uint32_t interfered;
+	uint32_t collisions;
+};
+
+void emu_field_init(struct emu_field *f, unsigned int seed);
+struct emu_tag *emu_field_add_tag(struct emu_field *f, const uint8_t uid[8]);
+int trf_emu_init(struct trf_emu *e, struct emu_field *f);
+void trf_emu_close(struct trf_emu *e);
+int trf_emu_xfer(struct trf_emu *e, const uint8_t *tx, uint8_t *rx, unsigned int len);
+int trf_emu_batch(struct trf_emu *e, struct trf_batch *b);
+int trf_emu_irq_level(struct trf_emu *e);
+
+#endif /* TRF_EMU_H_ */
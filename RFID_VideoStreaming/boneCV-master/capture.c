@@ -26,9 +26,12 @@
 #include <sys/time.h>
 #include <sys/mman.h>
 #include <sys/ioctl.h>
+#include <time.h>
 
 #include <linux/videodev2.h>
 
+#include "probes.h"
+
 #define CLEAR(x) memset(&(x), 0, sizeof(x))
 
 enum io_method {
@@ -68,8 +71,37 @@ static int xioctl(int fh, int request, void *arg)
         return r;
 }
 
+/*
+ * Tell whoever started the stream (RFID_VideoStreaming/streamsup.c) that
+ * it is live: the CLOCK_MONOTONIC time of the first frame in ns, written
+ * to the fd named in $RFID_READY_FD.
+ */
+static void notify_ready(void)
+{
+        static int sent;
+        struct timespec ts;
+        const char *env;
+        char msg[32];
+        int rfd, n;
+
+        if (sent)
+                return;
+        sent = 1;
+        env = getenv("RFID_READY_FD");
+        if (!env)
+                return;
+        rfd = atoi(env);
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        n = snprintf(msg, sizeof(msg), "%llu\n",
+                     (unsigned long long)ts.tv_sec * 1000000000ull + ts.tv_nsec);
+        if (write(rfd, msg, n) != n)
+                perror("RFID_READY_FD");
+        close(rfd);
+}
+
 static void process_image(const void *p, int size)
 {
+        notify_ready();
         if (out_buf)
                 fwrite(p, size, 1, stdout);
 
@@ -124,12 +156,14 @@ static int read_frame(void)
                         }
                 }
 
+                PROBE2(capture, dqbuf, buf.index, buf.bytesused);
                 assert(buf.index < n_buffers);
 
                 process_image(buffers[buf.index].start, buf.bytesused);
 
                 if (-1 == xioctl(fd, VIDIOC_QBUF, &buf))
                         errno_exit("VIDIOC_QBUF");
+                PROBE1(capture, qbuf, buf.index);
                 break;
 
         case IO_METHOD_USERPTR:
@@ -159,11 +193,13 @@ static int read_frame(void)
                                 break;
 
                 assert(i < n_buffers);
+                PROBE2(capture, dqbuf, i, buf.bytesused);
 
                 process_image((void *)buf.m.userptr, buf.bytesused);
 
                 if (-1 == xioctl(fd, VIDIOC_QBUF, &buf))
                         errno_exit("VIDIOC_QBUF");
+                PROBE1(capture, qbuf, i);
                 break;
         }
 
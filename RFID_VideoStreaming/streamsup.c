@@ -0,0 +1,257 @@
+/*
+ * streamsup.c
+ *
+ * Video stream supervisor, see streamsup.h.
+ *
+ * The stream script is spawned into its own process group so that the
+ * whole pipeline it launches can be stopped with one signal: SIGTERM
+ * first, SIGKILL if it is still there after STREAMSUP_KILL_GRACE_MS.
+ */
+
+#define _GNU_SOURCE
+#include "streamsup.h"
+#include "probes.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <spawn.h>
+#include <sys/wait.h>
+
+#define MS(x) ((uint64_t)(x) * 1000000ull)
+
+extern char **environ;
+
+void streamsup_init(struct stream_sup *s, const char *camera, const char *path, unsigned int linger_ms)
+{
+	memset(s, 0, sizeof(*s));
+	s->camera = camera;
+	s->path = path;
+	s->linger_ms = linger_ms;
+	s->backoff_ms = STREAMSUP_RESTART_MIN_MS;
+	s->ready_fd = -1;
+	setenv("RFID_READY_FD", "3", 1); /* STREAMSUP_READY_FD */
+}
+
+static void streamsup_ready_close(struct stream_sup *s)
+{
+	if (s->ready_fd >= 0)
+		close(s->ready_fd);
+	s->ready_fd = -1;
+	s->live_req_ns = 0;
+}
+
+/* the pipeline wrote its first-frame time */
+static void streamsup_ready(struct stream_sup *s, uint64_t now_ns)
+{
+	char buf[32];
+	ssize_t n;
+	uint64_t ts;
+
+	n = read(s->ready_fd, buf, sizeof(buf) - 1);
+	if (n < 0 && errno == EAGAIN)
+		return;
+	if (n > 0 && s->live_req_ns) {
+		buf[n] = 0;
+		ts = strtoull(buf, NULL, 10);
+		if (ts < s->live_req_ns || ts > now_ns)
+			ts = now_ns;
+		stats_hist_add(&s->live_us, (ts - s->live_req_ns) / 1000);
+		printf("stream %s: live %.1f ms after the tag\n", s->camera,
+		       (ts - s->live_req_ns) / 1e6);
+	}
+	streamsup_ready_close(s);
+}
+
+static int streamsup_spawn(struct stream_sup *s, uint64_t now_ns)
+{
+	posix_spawn_file_actions_t fa;
+	posix_spawnattr_t attr;
+	char *argv[3];
+	int ret, pfd[2];
+
+	streamsup_ready_close(s);
+	posix_spawn_file_actions_init(&fa);
+	if (pipe2(pfd, O_CLOEXEC | O_NONBLOCK) == 0) {
+		posix_spawn_file_actions_adddup2(&fa, pfd[1], STREAMSUP_READY_FD);
+		s->ready_fd = pfd[0];
+	} else {
+		pfd[1] = -1;
+	}
+	posix_spawnattr_init(&attr);
+	posix_spawnattr_setpgroup(&attr, 0);
+	posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETPGROUP
+#ifdef POSIX_SPAWN_USEVFORK
+				 | POSIX_SPAWN_USEVFORK
+#endif
+				 );
+	argv[0] = (char *)s->path;
+	argv[1] = (char *)s->camera;
+	argv[2] = NULL;
+	ret = posix_spawn(&s->pid, s->path, &fa, &attr, argv, environ);
+	posix_spawnattr_destroy(&attr);
+	posix_spawn_file_actions_destroy(&fa);
+	if (pfd[1] >= 0)
+		close(pfd[1]);
+	if (ret) {
+		errno = ret;
+		perror("streamsup/spawn");
+		s->pid = 0;
+		streamsup_ready_close(s);
+		return -1;
+	}
+	s->started_ns = now_ns;
+	s->starts++;
+	PROBE3(rfid, dispatch, "stream", s->pid, now_ns);
+	printf("stream %s: started (pid %d)\n", s->camera, (int)s->pid);
+	return 0;
+}
+
+static void streamsup_stop(struct stream_sup *s, uint64_t now_ns)
+{
+	if (!s->pid || s->stopping)
+		return;
+	kill(-s->pid, SIGTERM);
+	s->stopping = 1;
+	s->kill_at_ns = now_ns + MS(STREAMSUP_KILL_GRACE_MS);
+	s->stops++;
+	printf("stream %s: stopping\n", s->camera);
+}
+
+/****************************************************************
+ * streamsup_event
+ *
+ * Feed ARRIVED/DEPARTED events of authorised tags only.
+ ****************************************************************/
+void streamsup_event(struct stream_sup *s, const struct rfid_event *ev)
+{
+	switch (ev->type) {
+	case RFID_EV_ARRIVED:
+		if (s->present++ == 0 && !s->pid)
+			s->arrived_ns = ev->ts_ns;
+		s->stop_at_ns = 0;
+		break;
+	case RFID_EV_DEPARTED:
+		if (s->present > 0 && --s->present == 0)
+			s->stop_at_ns = ev->ts_ns + MS(s->linger_ms);
+		break;
+	}
+}
+
+/****************************************************************
+ * streamsup_poll
+ *
+ * Called once per reader cycle: reaps the stream, applies the linger
+ * deadline and (re)starts the stream when it is wanted.
+ ****************************************************************/
+void streamsup_poll(struct stream_sup *s, uint64_t now_ns)
+{
+	int status;
+	uint64_t d;
+
+	if (s->pid && waitpid(s->pid, &status, WNOHANG) == s->pid) {
+		kill(-s->pid, SIGKILL); /* leftovers of the pipeline */
+		streamsup_ready_close(s);
+		s->uptime_ns_total += now_ns - s->started_ns;
+		s->pid = 0;
+		if (s->stopping) {
+			s->stopping = 0;
+			printf("stream %s: stopped\n", s->camera);
+			streamsup_report(s, stdout);
+		} else {
+			/* died on its own: restart with exponential backoff */
+			if (now_ns - s->started_ns >= MS(STREAMSUP_STABLE_MS))
+				s->backoff_ms = STREAMSUP_RESTART_MIN_MS;
+			s->crashes++;
+			s->crashed_ns = now_ns;
+			s->restart_at_ns = now_ns + MS(s->backoff_ms);
+			printf("stream %s: exited (status 0x%x), restart in %u ms\n",
+			       s->camera, status, s->backoff_ms);
+			s->backoff_ms *= 2;
+			if (s->backoff_ms > STREAMSUP_RESTART_MAX_MS)
+				s->backoff_ms = STREAMSUP_RESTART_MAX_MS;
+		}
+	}
+
+	if (s->ready_fd >= 0)
+		streamsup_ready(s, now_ns);
+
+	if (s->stopping && now_ns >= s->kill_at_ns)
+		kill(-s->pid, SIGKILL);
+
+	if (s->present == 0 && s->stop_at_ns && now_ns >= s->stop_at_ns) {
+		s->stop_at_ns = 0;
+		s->restart_at_ns = 0;
+		s->crashed_ns = 0;
+		streamsup_stop(s, now_ns);
+	}
+
+	if ((s->present || s->stop_at_ns) && !s->pid && now_ns >= s->restart_at_ns) {
+		if (streamsup_spawn(s, now_ns) < 0) {
+			s->restart_at_ns = now_ns + MS(s->backoff_ms);
+			return;
+		}
+		if (s->crashed_ns) {
+			d = now_ns - s->crashed_ns;
+			s->restarts++;
+			s->restart_ns_total += d;
+			if (d > s->restart_ns_max)
+				s->restart_ns_max = d;
+			s->crashed_ns = 0;
+		} else if (s->arrived_ns) {
+			d = now_ns - s->arrived_ns;
+			if (d > s->start_ns_max)
+				s->start_ns_max = d;
+			s->live_req_ns = s->arrived_ns;
+			s->arrived_ns = 0;
+		}
+	}
+}
+
+/****************************************************************
+ * streamsup_shutdown
+ *
+ * Stops the stream on exit: SIGTERM, and SIGKILL if it has not exited
+ * after STREAMSUP_KILL_GRACE_MS, so a stuck pipeline cannot hang us.
+ ****************************************************************/
+void streamsup_shutdown(struct stream_sup *s)
+{
+	uint64_t kill_at_ns = rfid_now_ns() + MS(STREAMSUP_KILL_GRACE_MS);
+	int status;
+	pid_t ret;
+
+	if (!s->pid)
+		return;
+	kill(-s->pid, SIGTERM);
+	while ((ret = waitpid(s->pid, &status, WNOHANG)) == 0 && rfid_now_ns() < kill_at_ns)
+		usleep(STREAMSUP_SHUTDOWN_POLL_MS * 1000);
+	kill(-s->pid, SIGKILL); /* leftovers of the pipeline, or all of it */
+	if (ret == 0) {
+		printf("stream %s: still running after %u ms, killed\n", s->camera,
+		       STREAMSUP_KILL_GRACE_MS);
+		waitpid(s->pid, &status, 0);
+	}
+	s->pid = 0;
+	streamsup_ready_close(s);
+}
+
+void streamsup_report(struct stream_sup *s, FILE *f)
+{
+	fprintf(f, "stream %s: starts %u stops %u crashes %u restarts %u"
+		" start max %.1f ms restart avg %.1f ms max %.1f ms uptime %.1f s\n",
+		s->camera, s->starts, s->stops, s->crashes, s->restarts,
+		s->start_ns_max / 1e6,
+		s->restarts ? s->restart_ns_total / 1e6 / s->restarts : 0.0,
+		s->restart_ns_max / 1e6, s->uptime_ns_total / 1e9);
+}
+
+/* stats section: counters and tag -> live percentiles */
+void streamsup_stats_dump(FILE *fp, void *arg)
+{
+	struct stream_sup *s = arg;
+
+	streamsup_report(s, fp);
+	stats_hist_print(&s->live_us, "live", "us", fp);
+}
@@ -0,0 +1,70 @@
+/*
+ * streamsup.h
+ *
+ * Supervisor for the long-running video stream. There is at most one
+ * stream per camera. It is started when an authorised tag ARRIVES, kept
+ * running while any authorised tag is present, stopped linger_ms after the
+ * last one DEPARTS, and restarted with backoff if it dies on its own.
+ *
+ * The stream counts as live when the pipeline reports it: it inherits a
+ * pipe as fd STREAMSUP_READY_FD (named in $RFID_READY_FD) and writes its
+ * CLOCK_MONOTONIC time in ns there on the first captured frame, which
+ * boneCV-master/capture does. Tag IRQ -> live goes into live_us.
+ */
+
+#ifndef STREAMSUP_H_
+#define STREAMSUP_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/types.h>
+
+#include "rfid_event.h"
+#include "stats.h"
+
+#define STREAMSUP_DEFAULT_LINGER_MS 10000
+#define STREAMSUP_RESTART_MIN_MS 500
+#define STREAMSUP_RESTART_MAX_MS 30000
+#define STREAMSUP_STABLE_MS 60000   /* uptime that resets the backoff */
+#define STREAMSUP_KILL_GRACE_MS 2000
+#define STREAMSUP_SHUTDOWN_POLL_MS 10
+#define STREAMSUP_READY_FD 3
+
+struct stream_sup {
+	const char *camera;
+	const char *path;
+	unsigned int linger_ms;
+
+	int present;           /* authorised tags currently in the field */
+	pid_t pid;
+	int stopping;
+	uint64_t stop_at_ns;   /* linger deadline, 0 if none */
+	uint64_t kill_at_ns;   /* SIGKILL deadline while stopping */
+	uint64_t restart_at_ns;
+	unsigned int backoff_ms;
+	uint64_t arrived_ns;   /* IRQ time of the read that asked for the stream */
+	uint64_t started_ns;
+	uint64_t crashed_ns;
+	int ready_fd;          /* read end of the readiness pipe, -1 if none */
+	uint64_t live_req_ns;  /* IRQ time the pending readiness is timed from */
+
+	/* statistics */
+	uint32_t starts;
+	uint32_t stops;
+	uint32_t crashes;
+	uint32_t restarts;
+	uint64_t start_ns_max;   /* ARRIVED -> stream spawned */
+	uint64_t restart_ns_total; /* crash detected -> respawned */
+	uint64_t restart_ns_max;
+	uint64_t uptime_ns_total;
+	struct stats_hist live_us; /* ARRIVED read IRQ -> first frame */
+};
+
+void streamsup_init(struct stream_sup *s, const char *camera, const char *path, unsigned int linger_ms);
+void streamsup_event(struct stream_sup *s, const struct rfid_event *ev);
+void streamsup_poll(struct stream_sup *s, uint64_t now_ns);
+void streamsup_shutdown(struct stream_sup *s);
+void streamsup_report(struct stream_sup *s, FILE *f);
+void streamsup_stats_dump(FILE *fp, void *arg);
+
+#endif /* STREAMSUP_H_ */
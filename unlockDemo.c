@@ -16,14 +16,19 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <getopt.h>
-#include <fcntl.h>
-#include <sys/ioctl.h>
+#include <poll.h>
 #include <linux/types.h>
 #include <linux/spi/spidev.h>
 #include <string.h>
 #include <sys/types.h>
 
 #include "SimpleGPIO.h"
+#include "engine.h"
+#include "dispatch.h"
+#include "presence.h"
+#include "stats.h"
+#include "journal.h"
+#include "led.h"
 
 #define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
 
@@ -33,55 +38,23 @@ static void pabort(const char *s)
 	abort();
 }
 
-int unlockScreen(char *adr[])
-{
-        pid_t pid;
- 
-        pid=fork();
-        if (pid==0)
-        {
-                if (execv("/home/root/BBB_SPI/unlockscreen.sh",adr)<0)
-                        return -1;
-                else
-                        return 1;
-        }
-        else if(pid>0)
-                return 2;
-        else
-                return 0;
-}
-
 static const char *device = "/dev/spidev1.0";
 static uint8_t mode;
 static uint8_t bits = 8;
 static uint32_t speed = 3000000;
 static uint16_t delay;
+static unsigned int depart_ms = PRESENCE_DEFAULT_DEPART_MS;
+static uint8_t near_rssi;
+static struct reader reader;
+static struct engine engine;
+static struct dispatcher actions;
+static struct presence presence;
+static struct journal journal;
+static struct leds leds;
 
-static void transfer(int fd, uint8_t *tx, uint8_t *rx, uint8_t size, uint8_t printflag)
-{
-	int ret;
-	struct spi_ioc_transfer tr = {
-		.tx_buf = (unsigned long)tx,
-		.rx_buf = (unsigned long)rx,
-		.len = size,
-		.delay_usecs = delay,
-		.speed_hz = speed,
-		.bits_per_word = bits,
-	};
-
-	ret = ioctl(fd, SPI_IOC_MESSAGE(1), &tr);
-	if (ret < 1)
-		pabort("can't send spi message");
-
-	if (printflag) {
-		for (ret = 0; ret < size; ret++) {
-			if (!(ret % 6))
-				puts("");
-			printf("%.2X ", rx[ret]);
-		}
-		puts("");
-	}
-}
+static const unsigned char unlock_uids[][8] = {
+	{0xE0,0x07,0x00,0x00,0x03,0x92,0xA2,0x86}, // Me
+};
 
 static void print_usage(const char *prog)
 {
@@ -95,7 +68,9 @@ static void print_usage(const char *prog)
 	     "  -O --cpol     clock polarity\n"
 	     "  -L --lsb      least significant bit first\n"
 	     "  -C --cs-high  chip select active high\n"
-	     "  -3 --3wire    SI/SO signals shared\n");
+	     "  -3 --3wire    SI/SO signals shared\n"
+	     "  -P --depart-ms  tag departure timeout (ms)\n"
+	     "  -r --near-rssi  RSSI a tag must reach to unlock (0 = any read)\n");
 	exit(1);
 }
 
@@ -115,11 +90,13 @@ static void parse_opts(int argc, char *argv[])
 			{ "3wire",   0, 0, '3' },
 			{ "no-cs",   0, 0, 'N' },
 			{ "ready",   0, 0, 'R' },
+			{ "depart-ms", 1, 0, 'P' },
+			{ "near-rssi", 1, 0, 'r' },
 			{ NULL, 0, 0, 0 },
 		};
 		int c;
 
-		c = getopt_long(argc, argv, "D:s:d:b:lHOLC3NR", lopts, NULL);
+		c = getopt_long(argc, argv, "D:s:d:b:lHOLC3NRP:r:", lopts, NULL);
 
 		if (c == -1)
 			break;
@@ -161,6 +138,12 @@ static void parse_opts(int argc, char *argv[])
 		case 'R':
 			mode |= SPI_READY;
 			break;
+		case 'P':
+			depart_ms = atoi(optarg);
+			break;
+		case 'r':
+			near_rssi = atoi(optarg);
+			break;
 		default:
 			print_usage(argv[0]);
 			break;
@@ -170,281 +153,121 @@ static void parse_opts(int argc, char *argv[])
 
 int init(int argc, char *argv[])
 {
-	int ret = 0;
-	int fd;
+	char spec[64];
 
 	parse_opts(argc, argv);
 
-	fd = open(device, O_RDWR);
-	if (fd < 0)
-		pabort("can't open device");
-
-	/*
-	 * spi mode
-	 */
-	mode |= SPI_CPHA;
-	ret = ioctl(fd, SPI_IOC_WR_MODE, &mode);
-	if (ret == -1)
-		pabort("can't set spi mode");
-
-	ret = ioctl(fd, SPI_IOC_RD_MODE, &mode);
-	if (ret == -1)
-		pabort("can't get spi mode");
-
-	/*
-	 * bits per word
-	 */
-	ret = ioctl(fd, SPI_IOC_WR_BITS_PER_WORD, &bits);
-	if (ret == -1)
-		pabort("can't set bits per word");
-
-	ret = ioctl(fd, SPI_IOC_RD_BITS_PER_WORD, &bits);
-	if (ret == -1)
-		pabort("can't get bits per word");
-
-	/*
-	 * max speed hz
-	 */
-	ret = ioctl(fd, SPI_IOC_WR_MAX_SPEED_HZ, &speed);
-	if (ret == -1)
-		pabort("can't set max speed hz");
+	snprintf(spec, sizeof(spec), "%s:26:45", device); // EN GPIO0_26, IRQ GPIO1_13
+	if (reader_parse(&reader, 0, spec) < 0)
+		return -1;
+	reader.mode = mode | SPI_CPHA;
+	reader.bits = bits;
+	reader.speed = speed;
+	reader.delay = delay;
+	return reader_open(&reader);
+}
 
-	ret = ioctl(fd, SPI_IOC_RD_MAX_SPEED_HZ, &speed);
-	if (ret == -1)
-		pabort("can't get max speed hz");
+/*
+ * Unlock when an authorised tag comes near the reader
+ */
+static void unlock_presence(const struct rfid_event *ev, void *arg)
+{
+	unsigned int i;
 
-	//printf("spi mode: %d\n", mode);
-	//printf("bits per word: %d\n", bits);
-	//printf("max speed: %d Hz (%d KHz)\n", speed, speed/1000);
-	return fd;
+	if (ev->type != RFID_EV_ARRIVED)
+		return;
+	for (i = 0; i < ARRAY_SIZE(unlock_uids); i++)
+		if (0 == memcmp(ev->uid, unlock_uids[i], 8))
+			dispatch_run(arg, "unlock", ev->ts_ns);
 }
 
-void setLED(char lednum, char state)
+static void handle_read(const struct rfid_event *ev)
 {
-	FILE *LEDHandle = NULL;
-	char stateStr[1];
-	char LED_Brightness[] = "/sys/class/leds/beaglebone:green:usr0/brightness";
-	sprintf(stateStr, "%d", state);
-	switch (lednum)
+	unsigned char joker[] = {0xE0,0x07,0x00,0x00,0x14,0xE0,0x89,0x2B};
+	unsigned char Qspade[] = {0xE0,0x07,0x00,0x00,0x14,0xE0,0x89,0x2C};
+	unsigned char Kdiamond[] = {0xE0,0x07,0x00,0x00,0x30,0x92,0x81,0x13};
+	unsigned char Me[] = {0xE0,0x07,0x00,0x00,0x03,0x92,0xA2,0x86};
+	unsigned char uid_cnt;
+
+	journal_append(&journal, ev->uid, ev->rssi, ev->reader, JREC_F_RSSI_VALID);
+
+	if (0 == memcmp(ev->uid,joker,8))
 	{
-		case 0:
-			strcpy(LED_Brightness, "/sys/class/leds/beaglebone:green:usr0/brightness");
-			break;
-		case 1:
-			strcpy(LED_Brightness, "/sys/class/leds/beaglebone:green:usr1/brightness");
-			break;
-		case 2:
-			strcpy(LED_Brightness, "/sys/class/leds/beaglebone:green:usr2/brightness");
-			break;
-		case 3:
-			strcpy(LED_Brightness, "/sys/class/leds/beaglebone:green:usr3/brightness");
-			break;
+		printf("Joker!\n");
+	} else if (0 == memcmp(ev->uid,Qspade,8)){
+		printf("Queen of Spade!\n");
+	} else if (0 == memcmp(ev->uid,Kdiamond,8)){
+		printf("King of Diamond!\n");
+	} else if (0 == memcmp(ev->uid,Me,8)){
+		// unlocked by unlock_presence() once the tag is near
+	} else
+	{
+		printf("UID:\n");
+		for (uid_cnt=0; uid_cnt<8; uid_cnt++)
+			printf("%.2X", ev->uid[uid_cnt]);
+		printf("\n");
 	}
+	printf("rssi: %d\n\n", ev->rssi);
 	
-	if ((LEDHandle = fopen(LED_Brightness,"r+"))!=NULL)
-	{
-		fwrite(stateStr,sizeof(char), 1, LEDHandle);
-		fclose(LEDHandle);
-	}	
+	led_shot(&leds, 0, ev->ts_ns);
+	presence_seen(&presence, ev, unlock_presence, &actions);
 }
 
 int main(int argc, char *argv[])
 {
-	unsigned char uid[10] = {0};
-	unsigned char uid_cnt = 0;
-	FILE * fp;
-	int fd;
-	unsigned char wFlag = 0; // flag written
-	
-	unsigned int timeout = 0;
-	unsigned int irq_status = 0;
-	
-	// GPIO pins
-	unsigned int EN_GPIO = 26;   // GPIO0_26 = (0x32) + 26 = 26
-	unsigned int IRQ_GPIO = 45;   // GPIO1_13 = (32x1) + 13 = 45
+	struct pollfd pfd;
+	struct rfid_event ev;
+	int i;
 	
-	gpio_export(EN_GPIO);
-    gpio_set_dir(EN_GPIO, OUTPUT_PIN);
-	gpio_set_value(EN_GPIO, HIGH);
+	led_open(&leds, NULL);
+	for (i = 0; i < LED_COUNT; i++)
+		led_set(&leds, i, LED_OFF);
 	
-	gpio_export(IRQ_GPIO);
-    gpio_set_dir(IRQ_GPIO, INPUT_PIN);
-	gpio_set_edge(IRQ_GPIO, "rising");
+	if (init(argc, argv) < 0) // Initialize SPI driver and check status
+		pabort("can't open reader");
+	// on, dark for a moment on every read
+	led_set(&leds, 0, LED_READING);
 	
-	setLED(0, LOW);
-	setLED(1, LOW);
-	setLED(2, LOW);
-	setLED(3, LOW);
+	dispatch_init(&actions);
+	actions.verbose = 1;
+	dispatch_add(&actions, "unlock", "/home/root/BBB_SPI/unlockscreen.sh", DISPATCH_DEFAULT_COOLDOWN_MS);
+	if (journal_open(&journal, JOURNAL_DEFAULT_PATH, JOURNAL_DEFAULT_CAPACITY, JOURNAL_DEFAULT_SYNC_MS) < 0)
+		pabort("can't open journal");
+	presence_init(&presence, depart_ms, near_rssi);
 	
-	fd = init(argc, argv); // Initialize SPI driver and check status
+	/* no on_read callback: reads are pulled with engine_read() */
+	if (engine_init(&engine) < 0)
+		pabort("can't create epoll");
+	if (engine_add(&engine, &reader, rfid_now_ns()) < 0)
+		pabort("can't watch irq line");
+	stats_register("reader 0", reader_stats_dump, &reader);
+	stats_register("actions", dispatch_stats_dump, &actions);
+	stats_signal();
 	
 	/*
-	 * 5438_TRF7960_SPI_ISO15693_Single_Slot 
+	 * 5438_TRF7960_SPI_ISO15693_Single_Slot, driven by the reader library
+	 * from this program's own poll() loop
 	 */
 	while(1)
 	{
-		setLED(0, HIGH);
-		timeout = 1000; // timeout used to break from waiting for IRQ
+		pfd.fd = engine_get_fd(&engine);
+		pfd.events = POLLIN;
+		poll(&pfd, 1, ENGINE_MAX_WAIT_MS);
+		if (engine_run_once(&engine, 0) < 0)
+			pabort("epoll_wait");
 		
-		uint8_t tx01[] = {0x83}; // Software Initialization
-		uint8_t rx01[ARRAY_SIZE(tx01)] = {0, };
-		transfer(fd, tx01, rx01, ARRAY_SIZE(tx01),0);
+		while (engine_read(&engine, &ev))
+			handle_read(&ev);
 		
-		uint8_t tx02[] = {0x80}; // Idle
-		uint8_t rx02[ARRAY_SIZE(tx02)] = {0, };
-		transfer(fd, tx02, rx02, ARRAY_SIZE(tx02),0);
-		 
-		uint8_t tx03[] = {0x20,0x21,0x02,0x00,0x00,0xC1,0xBB}; // Cont write 0x21 to Chip Status Control (0x00), 
-		uint8_t rx03[ARRAY_SIZE(tx03)] = {0, }; // 0x02  to ISO Control (0x01)
-		transfer(fd, tx03, rx03, ARRAY_SIZE(tx03),0);
-		
-		usleep(1000); // Sleep 1ms
-		
-		uint8_t tx[] = {0x09, 0x21}; //Write to 0x09 (Modulator and SYS_CLK control) 0x21. 
-		uint8_t rx[ARRAY_SIZE(tx)] = {0, }; //Set SYSCLK to 6.78MHz
-		transfer(fd, tx, rx, ARRAY_SIZE(tx),0);
-		
-		uint8_t tx2[] = {0x07, 0x13}; //Write to 0x07 (RX No Response Wait Time Register) value 0x13
-		uint8_t rx2[ARRAY_SIZE(tx2)] = {0, };
-		transfer(fd, tx2, rx2, ARRAY_SIZE(tx2),0);
-		
-		uint8_t tx3[] = {0x6C, 0x00, 0x00}; // Cont read from 0x0C (IRQ Status)
-		uint8_t rx3[ARRAY_SIZE(tx3)] = {0, };
-		transfer(fd, tx3, rx3, ARRAY_SIZE(tx3),0);
-		
-		uint8_t tx4[] = {0x8F,0x91,0x3D,0x00,0x30,0x26,0x01,0x00}; //Reset, Transmit w/ CRC
-		uint8_t rx4[ARRAY_SIZE(tx4)] = {0, }; // Cont write from 0x1D, TX Length 3 bytes. Data: 0x26,0x01,0x00
-		transfer(fd, tx4, rx4, ARRAY_SIZE(tx4),0); //Reset to Ready, Inventory, Idle
-		
-		irq_status = 0;
-		while (irq_status != 1) //wait till IRQ line is HIGH
-		{
-			gpio_get_value(IRQ_GPIO, &irq_status);
-		}
-		//printf("irq_status: %d\n", irq_status);
-
-		uint8_t tx5[] = {0x6C, 0x00,0x00}; // Cont read from 0x0C (IRQ Status)
-		uint8_t rx5[ARRAY_SIZE(tx5)] = {0, };
-		transfer(fd, tx5, rx5, ARRAY_SIZE(tx5),0);
-
-		if (rx5[1] == 0x80)
-		{
-			uint8_t tx6[] = {0x8F};
-			uint8_t rx6[ARRAY_SIZE(tx6)] = {0, };
-			transfer(fd, tx6, rx6, ARRAY_SIZE(tx6),0);
-		
-			irq_status = 0;
-			while ((irq_status != 1) && (timeout)) //wait till IRQ line is HIGH or times out
-			{
-				gpio_get_value(IRQ_GPIO, &irq_status);
-				timeout--;
-			}
-			
-			if (timeout == 0)
-			{
-				//printf("timed out\n");
-			}
-			else {
-				uint8_t tx7[] = {0x6C, 0x00,0x00};  // Cont read from 0x0C (IRQ Status)
-				uint8_t rx7[ARRAY_SIZE(tx7)] = {0, };
-				transfer(fd, tx7, rx7, ARRAY_SIZE(tx7),0);
-				if (rx7[1] != 0x40)
-				{
-					//printf("irq error: 0x%X\n",rx7[1]);
-				}
-				
-				uint8_t tx8[] = {0x5C,0x00}; //Read 0x1C (FIFO Status)
-				uint8_t rx8[ARRAY_SIZE(tx8)] = {0, };
-				transfer(fd, tx8, rx8, ARRAY_SIZE(tx8),0);
-				//printf("bytes to read: %d\n", rx8[1]);
-				
-				if ((irq_status) && (rx8[1]==10)) { // Only when bytes to read is 10, the UID in FIFO is correct
-					uint8_t tx9[] = {0x7F,0x00,0x00,0x00,0x00, 
-									 0x00,0x00,0x00,0x00,0x00,0x00}; //Read FIFO register
-					uint8_t rx9[ARRAY_SIZE(tx9)] = {0, };
-					transfer(fd, tx9, rx9, ARRAY_SIZE(tx9),0);
-					
-					fp = fopen("uid.txt", "w");
-					for (uid_cnt=0; uid_cnt<8; uid_cnt++)
-					{
-						uid[uid_cnt] = rx9[10-uid_cnt];
-						fprintf(fp, "%.2X", uid[uid_cnt]);
-						//printf("%.2X", uid[uid_cnt]);
-					}
-					fprintf(fp, "\n");
-					//printf("\n");
-					fclose(fp);
-					
-					unsigned char joker[] = {0xE0,0x07,0x00,0x00,0x14,0xE0,0x89,0x2B};
-					unsigned char Qspade[] = {0xE0,0x07,0x00,0x00,0x14,0xE0,0x89,0x2C};
-					unsigned char Kdiamond[] = {0xE0,0x07,0x00,0x00,0x30,0x92,0x81,0x13};
-					unsigned char Me[] = {0xE0,0x07,0x00,0x00,0x03,0x92,0xA2,0x86};
-					if (0 == memcmp(uid,joker,8))
-					{
-						printf("Joker!\n");
-					} else if (0 == memcmp(uid,Qspade,8)){
-						printf("Queen of Spade!\n");
-					} else if (0 == memcmp(uid,Kdiamond,8)){
-						printf("King of Diamond!\n");
-					} else if (0 == memcmp(uid,Me,8)){
-						unlockScreen(argv);
-					} else
-					{
-						printf("UID:\n");
-						for (uid_cnt=0; uid_cnt<8; uid_cnt++)
-						{
-							printf("%.2X", uid[uid_cnt]);
-						}
-						printf("\n");
-					}
-					
-					setLED(0, LOW);
-					wFlag = 1;
-					//printf("UID written\n");
-					
-				}
-				
-				uint8_t tx15[] = {0x8F};
-				uint8_t rx15[ARRAY_SIZE(tx15)] = {0, };
-				transfer(fd, tx15, rx15, ARRAY_SIZE(tx15),0);
-				
-				uint8_t tx16[] = {0x4F, 0x00}; //Read RSSI Level
-				uint8_t rx16[ARRAY_SIZE(tx16)] = {0, };
-				transfer(fd, tx16, rx16, ARRAY_SIZE(tx16),0);
-				printf("rssi: %d\n\n", rx16[1]);
-				
-				uint8_t tx17[] = {0x8F}; // Reset FIFO
-				uint8_t rx17[ARRAY_SIZE(tx17)] = {0, };
-				transfer(fd, tx17, rx17, ARRAY_SIZE(tx17),0);
-				
-				uint8_t tx18[] = {0x96}; // Block Receiver
-				uint8_t rx18[ARRAY_SIZE(tx18)] = {0, };
-				transfer(fd, tx18, rx18, ARRAY_SIZE(tx18),0);
-				
-				uint8_t tx19[] = {0x4C, 0x00}; // Read IRQ status
-				uint8_t rx19[ARRAY_SIZE(tx19)] = {0, };
-				transfer(fd, tx19, rx19, ARRAY_SIZE(tx19),0);
-				
-				uint8_t tx20[] = {0x00,0x01}; // Turn off transmitter
-				uint8_t rx20[ARRAY_SIZE(tx20)] = {0, }; // 0x02  to ISO Control (0x01)
-				transfer(fd, tx20, rx20, ARRAY_SIZE(tx20),0);
-				
-				if (wFlag)
-				{
-					wFlag = 0;
-					sleep(1);
-				}
-			}
-		}
-		else
-		{
-			//printf(" ERROR: 0x%X. \n", rx5[1]);
-		}
+		presence_expire(&presence, rfid_now_ns(), unlock_presence, &actions);
+		dispatch_reap(&actions);
+		journal_sync(&journal, 0);
 		
-		usleep(500*1000); //500ms
+		if (stats_requested())
+			stats_dump(stdout);
 	}
 
-	close(fd);
+	engine_close(&engine);
 	printf("Complete\n");
 
 	return 0;